@@ -19,6 +19,11 @@
 #include <math.h> // INFINITY
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h> // INT_MAX
+#include <errno.h> // ERANGE
+#ifdef _WIN32
+#include <malloc.h> // _aligned_malloc
+#endif
 
 int mousePosX;
 int mousePosY;
@@ -28,10 +33,21 @@ int mousePosY;
 #define WINDOW_WIDTH  1920
 #define SIZE WINDOW_WIDTH*WINDOW_HEIGHT
 
-// The number of satellites can be changed to see how it affects performance.
+// Default number of satellites. It can be changed with --satellites=N at
+// startup to see how it affects performance.
 // Benchmarks must be run with the original number of satellites
 #define SATELLITE_COUNT 64
 
+// Alignment of heap buffers used by the simulation (one cache line)
+#define MEMORY_ALIGNMENT 64
+
+// Satellite arrays are padded to a multiple of this many floats (one
+// 512-bit vector), so SIMD loops over satellites need no remainder handling
+#define SIMD_WIDTH 16
+
+// Position of the unused padding satellites, far outside the window
+#define PADDING_POSITION 1.0e6f
+
 // These are used to control the satellite movement
 #define SATELLITE_RADIUS 3.16f
 #define MAX_VELOCITY 0.1f
@@ -69,12 +85,20 @@ typedef struct{
    uint8_t reserved;
 } color_u8;
 
-// Stores the satellite data, which fly around black hole in the space
+// Stores the satellite data, which fly around black hole in the space.
+// Structure of arrays: every array holds 'capacity' aligned floats, of which
+// the first 'count' are real satellites and the rest is padding.
 typedef struct{
-   color_f32 identifier;
-   floatvector position;
-   floatvector velocity;
-} satellite;
+   float* x;
+   float* y;
+   float* vx;
+   float* vy;
+   float* red;
+   float* green;
+   float* blue;
+   int count;
+   int capacity;
+} satellitestore;
 
 // Pixel buffer which is rendered to the screen
 color_u8* pixels;
@@ -83,25 +107,145 @@ color_u8* pixels;
 color_u8* correctPixels;
 
 // Buffer for all satellites in the space
-satellite* satellites;
-satellite* backupSatelites;
+satellitestore satellites;
+satellitestore backupSatelites;
 
+// Number of satellites in the space, decided at startup
+int satelliteCount = SATELLITE_COUNT;
 
+// Heap allocation aligned to MEMORY_ALIGNMENT. Exits if out of memory.
+void* alignedMalloc(size_t bytes) {
+   void* ptr = NULL;
+#ifdef _WIN32
+   ptr = _aligned_malloc(bytes, MEMORY_ALIGNMENT);
+#else
+   if (posix_memalign(&ptr, MEMORY_ALIGNMENT, bytes) != 0) ptr = NULL;
+#endif
+   if (!ptr) {
+      fprintf(stderr, "Failed to allocate %zu bytes\n", bytes);
+      exit(1);
+   }
+   return ptr;
+}
 
+// Releases memory from alignedMalloc()
+void alignedFree(void* ptr) {
+#ifdef _WIN32
+   _aligned_free(ptr);
+#else
+   free(ptr);
+#endif
+}
 
+// Allocates the arrays of a satellite store. Padding satellites are parked
+// far away with zero velocity and color, so they can be advanced by the
+// physics like real ones and never dominate a pixel.
+void satelliteStoreAlloc(satellitestore* s, int count) {
+   s->count = count;
+   s->capacity = (count + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+   size_t bytes = sizeof(float) * s->capacity;
+   s->x = (float*)alignedMalloc(bytes);
+   s->y = (float*)alignedMalloc(bytes);
+   s->vx = (float*)alignedMalloc(bytes);
+   s->vy = (float*)alignedMalloc(bytes);
+   s->red = (float*)alignedMalloc(bytes);
+   s->green = (float*)alignedMalloc(bytes);
+   s->blue = (float*)alignedMalloc(bytes);
+   for (int i = count; i < s->capacity; ++i) {
+      s->x[i] = PADDING_POSITION;
+      s->y[i] = PADDING_POSITION;
+      s->vx[i] = s->vy[i] = 0.f;
+      s->red[i] = s->green[i] = s->blue[i] = 0.f;
+   }
+}
 
+void satelliteStoreFree(satellitestore* s) {
+   alignedFree(s->x);
+   alignedFree(s->y);
+   alignedFree(s->vx);
+   alignedFree(s->vy);
+   alignedFree(s->red);
+   alignedFree(s->green);
+   alignedFree(s->blue);
+}
 
+// Copies all satellites, including padding. Both stores have the same capacity.
+void satelliteStoreCopy(satellitestore* dst, const satellitestore* src) {
+   size_t bytes = sizeof(float) * src->capacity;
+   memcpy(dst->x, src->x, bytes);
+   memcpy(dst->y, src->y, bytes);
+   memcpy(dst->vx, src->vx, bytes);
+   memcpy(dst->vy, src->vy, bytes);
+   memcpy(dst->red, src->red, bytes);
+   memcpy(dst->green, src->green, bytes);
+   memcpy(dst->blue, src->blue, bytes);
+}
+
+// Bitwise comparison of satellite i in two stores
+int satelliteStoreEqual(const satellitestore* a, const satellitestore* b, int i) {
+   return !memcmp(&a->x[i], &b->x[i], sizeof(float)) &&
+      !memcmp(&a->y[i], &b->y[i], sizeof(float)) &&
+      !memcmp(&a->vx[i], &b->vx[i], sizeof(float)) &&
+      !memcmp(&a->vy[i], &b->vy[i], sizeof(float)) &&
+      !memcmp(&a->red[i], &b->red[i], sizeof(float)) &&
+      !memcmp(&a->green[i], &b->green[i], sizeof(float)) &&
+      !memcmp(&a->blue[i], &b->blue[i], sizeof(float));
+}
+
+color_f32 satelliteColor(const satellitestore* s, int i) {
+   color_f32 color = {.blue = s->blue[i], .green = s->green[i], .red = s->red[i]};
+   return color;
+}
+
+// Parses all of 'text' as a decimal integer. Returns 0 if it is empty, has
+// anything left over or does not fit an int.
+int parseIntValue(const char* text, int* value) {
+   char* end;
+   errno = 0;
+   long v = strtol(text, &end, 10);
+   if (end == text || *end != '\0' || errno == ERANGE || v < INT_MIN || v > INT_MAX) return 0;
+   *value = (int)v;
+   return 1;
+}
+
+// Parses all of 'text' as a finite floating point number. Returns 0 if it
+// is empty or has anything left over.
+int parseDoubleValue(const char* text, double* value) {
+   char* end;
+   double v = strtod(text, &end);
+   if (end == text || *end != '\0' || !isfinite(v)) return 0;
+   *value = v;
+   return 1;
+}
+
+// Parses one "--name=value" command line option. Returns 0 if the option
+// is unknown or its value is invalid.
+int parseOption(const char* arg) {
+   if (strncmp(arg, "--satellites=", 13) == 0) {
+      return parseIntValue(arg + 13, &satelliteCount) &&
+         satelliteCount > 0 && satelliteCount <= INT_MAX - SIMD_WIDTH;
+   }
+   return 0;
+}
 
 
-// ## You may add your own variables here ##
 
 
 
 
-// ## You may add your own initialization routines here ##
-void init(){
 
 
+// ## You may add your own variables here ##
+
+// Double precision working state of parallelPhysicsEngine, allocated in init()
+doublevector* physicsPosition;
+doublevector* physicsVelocity;
+
+
+// ## You may add your own initialization routines here ##
+void init(){
+   physicsPosition = (doublevector*)alignedMalloc(sizeof(doublevector) * satelliteCount);
+   physicsVelocity = (doublevector*)alignedMalloc(sizeof(doublevector) * satelliteCount);
 }
 
 // ## You are asked to make this code parallel ##
@@ -116,15 +260,15 @@ void parallelPhysicsEngine(){
 
    // double precision required for accumulation inside this routine,
    // but float storage is ok outside these loops.
-   doublevector tmpPosition[SATELLITE_COUNT];
-   doublevector tmpVelocity[SATELLITE_COUNT];
+   doublevector* tmpPosition = physicsPosition;
+   doublevector* tmpVelocity = physicsVelocity;
 
    int idx;
-   for (idx = 0; idx < SATELLITE_COUNT; ++idx) {
-       tmpPosition[idx].x = satellites[idx].position.x;
-       tmpPosition[idx].y = satellites[idx].position.y;
-       tmpVelocity[idx].x = satellites[idx].velocity.x;
-       tmpVelocity[idx].y = satellites[idx].velocity.y;
+   for (idx = 0; idx < satelliteCount; ++idx) {
+       tmpPosition[idx].x = satellites.x[idx];
+       tmpPosition[idx].y = satellites.y[idx];
+       tmpVelocity[idx].x = satellites.vx[idx];
+       tmpVelocity[idx].y = satellites.vy[idx];
    }
    int physicsUpdateIndex;
    // Physics iteration loop
@@ -133,7 +277,7 @@ void parallelPhysicsEngine(){
       ++physicsUpdateIndex){
       int i;
        // Physics satellite loop
-      for(i = 0; i < SATELLITE_COUNT; ++i){
+      for(i = 0; i < satelliteCount; ++i){
 
          // Distance to the blackhole (bit ugly code because C-struct cannot have member functions)
          doublevector positionToBlackHole = {.x = tmpPosition[i].x -
@@ -168,11 +312,11 @@ void parallelPhysicsEngine(){
    // but float storage is ok outside these loops.
    // copy back the float storage.
    int idx2;
-   for (idx2 = 0; idx2 < SATELLITE_COUNT; ++idx2) {
-       satellites[idx2].position.x = tmpPosition[idx2].x;
-       satellites[idx2].position.y = tmpPosition[idx2].y;
-       satellites[idx2].velocity.x = tmpVelocity[idx2].x;
-       satellites[idx2].velocity.y = tmpVelocity[idx2].y;
+   for (idx2 = 0; idx2 < satelliteCount; ++idx2) {
+       satellites.x[idx2] = tmpPosition[idx2].x;
+       satellites.y[idx2] = tmpPosition[idx2].y;
+       satellites.vx[idx2] = tmpVelocity[idx2].x;
+       satellites.vy[idx2] = tmpVelocity[idx2].y;
    }
 
 }
@@ -217,9 +361,9 @@ void parallelGraphicsEngine(){
 
       // First Graphics satellite loop: Find the closest satellite.
       int j;
-      for(j = 0; j < SATELLITE_COUNT; ++j){
-         floatvector difference = {.x = pixel.x - satellites[j].position.x,
-                                   .y = pixel.y - satellites[j].position.y};
+      for(j = 0; j < satelliteCount; ++j){
+         floatvector difference = {.x = pixel.x - satellites.x[j],
+                                   .y = pixel.y - satellites.y[j]};
          float distance = sqrt(difference.x * difference.x +
                                difference.y * difference.y);
 
@@ -234,7 +378,7 @@ void parallelGraphicsEngine(){
             weights += weight;
             if(distance < shortestDistance){
                shortestDistance = distance;
-               renderColor = satellites[j].identifier;
+               renderColor = satelliteColor(&satellites, j);
             }
          }
       }
@@ -242,20 +386,20 @@ void parallelGraphicsEngine(){
       // Second graphics loop: Calculate the color based on distance to every satellite.
       if (!hitsSatellite) {
          int k;
-         for(k = 0; k < SATELLITE_COUNT; ++k){
-            floatvector difference = {.x = pixel.x - satellites[k].position.x,
-                                      .y = pixel.y - satellites[k].position.y};
+         for(k = 0; k < satelliteCount; ++k){
+            floatvector difference = {.x = pixel.x - satellites.x[k],
+                                      .y = pixel.y - satellites.y[k]};
             float dist2 = (difference.x * difference.x +
                            difference.y * difference.y);
             float weight = 1.0f/(dist2* dist2);
 
-            renderColor.red += (satellites[k].identifier.red *
+            renderColor.red += (satellites.red[k] *
                                 weight /weights) * 3.0f;
 
-            renderColor.green += (satellites[k].identifier.green *
+            renderColor.green += (satellites.green[k] *
                                   weight / weights) * 3.0f;
 
-            renderColor.blue += (satellites[k].identifier.blue *
+            renderColor.blue += (satellites.blue[k] *
                                  weight / weights) * 3.0f;
          }
       }
@@ -267,8 +411,8 @@ void parallelGraphicsEngine(){
 
 // ## You may add your own destrcution routines here ##
 void destroy(){
-
-
+   alignedFree(physicsPosition);
+   alignedFree(physicsVelocity);
 }
 
 
@@ -324,9 +468,9 @@ void sequentialGraphicsEngine(){
       int hitsSatellite = 0;
 
       // First Graphics satellite loop: Find the closest satellite.
-      for(int j = 0; j < SATELLITE_COUNT; ++j){
-         floatvector difference = {.x = pixel.x - satellites[j].position.x,
-                                   .y = pixel.y - satellites[j].position.y};
+      for(int j = 0; j < satelliteCount; ++j){
+         floatvector difference = {.x = pixel.x - satellites.x[j],
+                                   .y = pixel.y - satellites.y[j]};
          float distance = sqrt(difference.x * difference.x +
                                difference.y * difference.y);
 
@@ -341,27 +485,27 @@ void sequentialGraphicsEngine(){
             weights += weight;
             if(distance < shortestDistance){
                shortestDistance = distance;
-               renderColor = satellites[j].identifier;
+               renderColor = satelliteColor(&satellites, j);
             }
          }
       }
 
       // Second graphics loop: Calculate the color based on distance to every satellite.
       if (!hitsSatellite) {
-         for(int j = 0; j < SATELLITE_COUNT; ++j){
-            floatvector difference = {.x = pixel.x - satellites[j].position.x,
-                                      .y = pixel.y - satellites[j].position.y};
+         for(int j = 0; j < satelliteCount; ++j){
+            floatvector difference = {.x = pixel.x - satellites.x[j],
+                                      .y = pixel.y - satellites.y[j]};
             float dist2 = (difference.x * difference.x +
                            difference.y * difference.y);
             float weight = 1.0f/(dist2* dist2);
 
-            renderColor.red += (satellites[j].identifier.red *
+            renderColor.red += (satellites.red[j] *
                                 weight /weights) * 3.0f;
 
-            renderColor.green += (satellites[j].identifier.green *
+            renderColor.green += (satellites.green[j] *
                                   weight / weights) * 3.0f;
 
-            renderColor.blue += (satellites[j].identifier.blue *
+            renderColor.blue += (satellites.blue[j] *
                                  weight / weights) * 3.0f;
          }
       }
@@ -371,18 +515,18 @@ void sequentialGraphicsEngine(){
     }
 }
 
-void sequentialPhysicsEngine(satellite *s){
+void sequentialPhysicsEngine(satellitestore *s){
 
    // double precision required for accumulation inside this routine,
    // but float storage is ok outside these loops.
-   doublevector tmpPosition[SATELLITE_COUNT];
-   doublevector tmpVelocity[SATELLITE_COUNT];
-
-   for (int i = 0; i < SATELLITE_COUNT; ++i) {
-       tmpPosition[i].x = s[i].position.x;
-       tmpPosition[i].y = s[i].position.y;
-       tmpVelocity[i].x = s[i].velocity.x;
-       tmpVelocity[i].y = s[i].velocity.y;
+   doublevector* tmpPosition = (doublevector*)alignedMalloc(sizeof(doublevector) * satelliteCount);
+   doublevector* tmpVelocity = (doublevector*)alignedMalloc(sizeof(doublevector) * satelliteCount);
+
+   for (int i = 0; i < satelliteCount; ++i) {
+       tmpPosition[i].x = s->x[i];
+       tmpPosition[i].y = s->y[i];
+       tmpVelocity[i].x = s->vx[i];
+       tmpVelocity[i].y = s->vy[i];
    }
 
    // Physics iteration loop
@@ -391,7 +535,7 @@ void sequentialPhysicsEngine(satellite *s){
       ++physicsUpdateIndex){
 
        // Physics satellite loop
-      for(int i = 0; i < SATELLITE_COUNT; ++i){
+      for(int i = 0; i < satelliteCount; ++i){
 
          // Distance to the blackhole
          // (bit ugly code because C-struct cannot have member functions)
@@ -426,12 +570,15 @@ void sequentialPhysicsEngine(satellite *s){
    // double precision required for accumulation inside this routine,
    // but float storage is ok outside these loops.
    // copy back the float storage.
-   for (int i = 0; i < SATELLITE_COUNT; ++i) {
-       s[i].position.x = tmpPosition[i].x;
-       s[i].position.y = tmpPosition[i].y;
-       s[i].velocity.x = tmpVelocity[i].x;
-       s[i].velocity.y = tmpVelocity[i].y;
+   for (int i = 0; i < satelliteCount; ++i) {
+       s->x[i] = tmpPosition[i].x;
+       s->y[i] = tmpPosition[i].y;
+       s->vx[i] = tmpVelocity[i].x;
+       s->vy[i] = tmpVelocity[i].y;
    }
+
+   alignedFree(tmpPosition);
+   alignedFree(tmpVelocity);
 }
 
 // Just some value that barely passes for OpenCL example program
@@ -466,8 +613,8 @@ void compute(void){
 
    // Error check during first frames
    if (frameNumber < 2) {
-      memcpy(backupSatelites, satellites, sizeof(satellite) * SATELLITE_COUNT);
-      sequentialPhysicsEngine(backupSatelites);
+      satelliteStoreCopy(&backupSatelites, &satellites);
+      sequentialPhysicsEngine(&backupSatelites);
       mousePosX = HORIZONTAL_CENTER;
       mousePosY = VERTICAL_CENTER;
    } else {
@@ -479,8 +626,8 @@ void compute(void){
    }
    parallelPhysicsEngine();
    if (frameNumber < 2) {
-      for (int i = 0; i < SATELLITE_COUNT; i++) {
-         if (memcmp (&satellites[i], &backupSatelites[i], sizeof(satellite))) {
+      for (int i = 0; i < satelliteCount; i++) {
+         if (!satelliteStoreEqual(&satellites, &backupSatelites, i)) {
             printf("Incorrect satellite data of satellite: %d\n", i);
             getchar();
          }
@@ -541,14 +688,14 @@ void fixedInit(unsigned int seed){
    // Init pixel buffer which is used for error checking
    correctPixels = (color_u8*)malloc(sizeof(color_u8) * SIZE);
 
-   backupSatelites = (satellite*)malloc(sizeof(satellite) * SATELLITE_COUNT);
+   satelliteStoreAlloc(&backupSatelites, satelliteCount);
 
 
    // Init satellites buffer which are moving in the space
-   satellites = (satellite*)malloc(sizeof(satellite) * SATELLITE_COUNT);
+   satelliteStoreAlloc(&satellites, satelliteCount);
 
    // Create random satellites
-   for(int i = 0; i < SATELLITE_COUNT; ++i){
+   for(int i = 0; i < satelliteCount; ++i){
 
       // Random reddish color
       color_f32 id = {.red = randomNumber(0.f, 0.15f) + 0.1f,
@@ -560,7 +707,7 @@ void fixedInit(unsigned int seed){
                               .y = VERTICAL_CENTER - randomNumber(50, 320) };
       initialPosition.x = (i / 2 % 2 == 0) ?
          initialPosition.x : WINDOW_WIDTH - initialPosition.x;
-      initialPosition.y = (i < SATELLITE_COUNT / 2) ?
+      initialPosition.y = (i < satelliteCount / 2) ?
          initialPosition.y : WINDOW_HEIGHT - initialPosition.y;
 
       // Randomize velocity tangential to the balck hole
@@ -578,9 +725,13 @@ void fixedInit(unsigned int seed){
          initialVelocity.y = -initialVelocity.y;
       }
 
-      satellite tmpSatelite = {.identifier = id, .position = initialPosition,
-                              .velocity = initialVelocity};
-      satellites[i] = tmpSatelite;
+      satellites.red[i] = id.red;
+      satellites.green[i] = id.green;
+      satellites.blue[i] = id.blue;
+      satellites.x[i] = initialPosition.x;
+      satellites.y[i] = initialPosition.y;
+      satellites.vx[i] = initialVelocity.x;
+      satellites.vy[i] = initialVelocity.y;
    }
 }
 
@@ -590,7 +741,8 @@ void fixedDestroy(void){
 
    free(pixels);
    free(correctPixels);
-   free(satellites);
+   satelliteStoreFree(&satellites);
+   satelliteStoreFree(&backupSatelites);
 
    if(seed != 0){
      printf("Used seed: %i\n", seed);
@@ -612,10 +764,19 @@ void render(void){
 // Inits render window and starts mainloop
 int main(int argc, char** argv){
 
-   if(argc > 1){
-     seed = atoi(argv[1]);
-     printf("Using seed: %i\n", seed);
+   // Usage: parallel [seed] [--option=value ...]
+   for(int a = 1; a < argc; ++a){
+     if(strncmp(argv[a], "--", 2) == 0){
+       if(!parseOption(argv[a])){
+         fprintf(stderr, "Unknown or invalid option: %s\n", argv[a]);
+         return 1;
+       }
+     } else {
+       seed = atoi(argv[a]);
+       printf("Using seed: %i\n", seed);
+     }
    }
+   printf("Satellite count: %d\n", satelliteCount);
 
    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_TIMER);
    win = SDL_CreateWindow(
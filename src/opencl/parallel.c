@@ -25,21 +25,40 @@ __declspec(dllexport) unsigned long NvOptimusEnablement = 0x00000001;    // NVID
 #include <math.h> // INFINITY
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h> // INT_MAX
+#include <errno.h> // ERANGE
+#ifdef _WIN32
+#include <malloc.h> // _aligned_malloc
+#endif
 
 #include <CL/cl.h>
 
 int mousePosX;
 int mousePosY;
 
+// Defined with the main loop below, used to know when compute() checks the satellites
+extern unsigned int frameNumber;
+
 // These are used to decide the window size
 #define WINDOW_HEIGHT 1024
 #define WINDOW_WIDTH  1920
 #define SIZE WINDOW_WIDTH*WINDOW_HEIGHT
 
-// The number of satellites can be changed to see how it affects performance.
+// Default number of satellites. It can be changed with --satellites=N at
+// startup to see how it affects performance.
 // Benchmarks must be run with the original number of satellites
 #define SATELLITE_COUNT 64
 
+// Alignment of heap buffers used by the simulation (one cache line)
+#define MEMORY_ALIGNMENT 64
+
+// Satellite arrays are padded to a multiple of this many floats (one
+// 512-bit vector), so SIMD loops over satellites need no remainder handling
+#define SIMD_WIDTH 16
+
+// Position of the unused padding satellites, far outside the window
+#define PADDING_POSITION 1.0e6f
+
 // These are used to control the satellite movement
 #define SATELLITE_RADIUS 3.16f
 #define MAX_VELOCITY 0.1f
@@ -56,19 +75,51 @@ int mousePosY;
 static cl_platform_id      OCL_platform = NULL;
 static cl_device_id        OCL_device = NULL;
 static cl_context          OCL_context = NULL;
-static cl_command_queue    OCL_queue = NULL;
+static cl_command_queue    OCL_queue = NULL;          // physics and shading, in order
+static cl_command_queue    OCL_queueTransfer = NULL;  // pixel readbacks
 static cl_program          OCL_program = NULL;
 static cl_kernel           OCL_kernel = NULL;
-
-static cl_mem              OCL_bufPixels = NULL;
+static cl_kernel           OCL_kernelPhysics = NULL;
+static cl_kernel           OCL_kernelNbodyLoad = NULL;
+static cl_kernel           OCL_kernelNbodyStore = NULL;
+static cl_kernel           OCL_kernelNbodyDrift = NULL;
+static cl_kernel           OCL_kernelNbodyForce = NULL;
+static cl_kernel           OCL_kernelShadeBounds = NULL;
+static cl_kernel           OCL_kernelJfaClear = NULL;
+static cl_kernel           OCL_kernelJfaSeed = NULL;
+static cl_kernel           OCL_kernelJfaStep = NULL;
+static cl_kernel           OCL_kernelShadeJfa = NULL;
+
+// Frames alternate between two pixel buffers on the device and two on the
+// host, so the readback of one frame runs on the transfer queue while the
+// next frame is integrated and shaded. OCL_pixelsRead[b] is the readback of
+// buffer b's latest frame; shading into b again waits for it.
+static cl_mem              OCL_bufPixels[2] = { NULL, NULL };
+static cl_event            OCL_pixelsRead[2] = { NULL, NULL };
+static int                 OCL_pixelSlot = 0;     // buffer of the frame being computed
+static cl_event            OCL_nbodyEvents[2][2] = { { NULL, NULL }, { NULL, NULL } }; // first and last N-body command per buffer
 static cl_mem              OCL_bufPosX = NULL;
 static cl_mem              OCL_bufPosY = NULL;
+static cl_mem              OCL_bufVelX = NULL;
+static cl_mem              OCL_bufVelY = NULL;
 static cl_mem              OCL_bufIdR = NULL;
 static cl_mem              OCL_bufIdG = NULL;
 static cl_mem              OCL_bufIdB = NULL;
 
+// N-body mode state in kernel 'real' precision, and the satellite masses
+static cl_mem              OCL_bufNbodyX = NULL;
+static cl_mem              OCL_bufNbodyY = NULL;
+static cl_mem              OCL_bufNbodyVX = NULL;
+static cl_mem              OCL_bufNbodyVY = NULL;
+static cl_mem              OCL_bufNbodyAX = NULL;
+static cl_mem              OCL_bufNbodyAY = NULL;
+static cl_mem              OCL_bufMass = NULL;
+static cl_mem              OCL_bufJfaMap[2] = { NULL, NULL };
+static cl_mem              OCL_bufJfaNext = NULL;
+
 static size_t              OCL_wgSizeX = 32;
 static size_t              OCL_wgSizeY = 32;
+static int                 OCL_pixelsPerItem = 1;  // pixels per shade work-item along X
 
 
 
@@ -93,6 +144,166 @@ static char* OCL_loadKernelSource(const char* path, size_t * outSize) {
     return OCL_kernelSource;
 }
 
+////////////////////////////////////////////////
+//   ¤¤     PROGRAM BINARY CACHE      ¤¤      //
+////////////////////////////////////////////////
+// Built programs are kept in the working directory as
+// parallel-<hash of the key>.clbin, where the key names the device, its
+// driver version, the build options and a hash of the kernel source. A
+// file holds the key itself, so a hash collision is caught, and the
+// program binary. An unreadable or stale binary is rebuilt from source.
+// --no-kernel-cache always builds from source.
+int kernelCache = 1;
+
+// The shade kernels are built specialized for this run's satellite count,
+// window size and radii (SHADE_* in parallel.cl). Every count is its own
+// program variant, which the kernel cache keeps apart by the build options.
+// --generic-shade builds them with these as run-time arguments.
+int specializeShade = 1;
+
+// 64-bit FNV-1a
+static unsigned long long OCL_hash(unsigned long long h, const void* data, size_t n) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= bytes[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+#define OCL_HASH_SEED 14695981039346656037ull
+
+// Builds the cache key and the file name for 'source' built with 'options'
+// for 'dev'
+static void OCL_cacheKey(cl_device_id dev, const char* source, size_t sourceLen, const char* options,
+    char* key, size_t keySize, char* path, size_t pathSize) {
+    char device[256] = { 0 };
+    char driver[256] = { 0 };
+    clGetDeviceInfo(dev, CL_DEVICE_NAME, sizeof(device), device, NULL);
+    clGetDeviceInfo(dev, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+    snprintf(key, keySize, "%s|%s|%s|%016llx", device, driver, options,
+        OCL_hash(OCL_HASH_SEED, source, sourceLen));
+    snprintf(path, pathSize, "parallel-%016llx.clbin", OCL_hash(OCL_HASH_SEED, key, strlen(key)));
+}
+
+// Creates and builds the program from the cache file, NULL if there is no
+// usable one
+static cl_program OCL_loadCachedProgram(cl_context context, cl_device_id device,
+    const char* key, const char* path, const char* options) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    cl_program program = NULL;
+    unsigned int keyLen = 0;
+    unsigned long long binarySize = 0;
+    char storedKey[1024];
+    unsigned char* binary = NULL;
+    int valid = fread(&keyLen, sizeof(keyLen), 1, f) == 1 && keyLen < sizeof(storedKey) &&
+        fread(storedKey, 1, keyLen, f) == keyLen;
+    if (valid) {
+        storedKey[keyLen] = '\0';
+        valid = strcmp(storedKey, key) == 0 &&
+            fread(&binarySize, sizeof(binarySize), 1, f) == 1 && binarySize > 0;
+    }
+    if (valid) {
+        // the binary must fill the rest of the file exactly, so a truncated
+        // or corrupt size never reaches malloc()
+        long start = ftell(f);
+        valid = start >= 0 && fseek(f, 0, SEEK_END) == 0;
+        long end = valid ? ftell(f) : -1;
+        valid = valid && end >= start && binarySize == (unsigned long long)(end - start) &&
+            fseek(f, start, SEEK_SET) == 0;
+    }
+    if (valid) {
+        binary = (unsigned char*)malloc((size_t)binarySize);
+        if (binary && fread(binary, 1, (size_t)binarySize, f) == binarySize) {
+            size_t size = (size_t)binarySize;
+            const unsigned char* binaries[] = { binary };
+            cl_int status, err;
+            program = clCreateProgramWithBinary(context, 1, &device, &size, binaries, &status, &err);
+            if (err != CL_SUCCESS || status != CL_SUCCESS) {
+                if (program) clReleaseProgram(program);
+                program = NULL;
+            } else if (clBuildProgram(program, 1, &device, options, NULL, NULL) != CL_SUCCESS) {
+                clReleaseProgram(program);
+                program = NULL;
+            }
+        }
+        free(binary);
+    }
+    fclose(f);
+    if (!program) {
+        printf("Kernel cache %s is stale, rebuilding\n", path);
+    }
+    return program;
+}
+
+// Writes the binary of a built program to the cache file. The file is
+// written under a temporary name and renamed into place, so a concurrent
+// or interrupted run never leaves a half-written cache behind.
+static void OCL_storeCachedProgram(cl_program program, const char* key, const char* path) {
+    size_t size = 0;
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) != CL_SUCCESS || size == 0) {
+        return;
+    }
+    unsigned char* binary = (unsigned char*)malloc(size);
+    unsigned char* binaries[] = { binary };
+    char tempPath[96];
+    snprintf(tempPath, sizeof(tempPath), "%s.%08x.tmp", path, (unsigned int)SDL_GetPerformanceCounter());
+    FILE* f = NULL;
+    if (binary && clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaries), binaries, NULL) == CL_SUCCESS) {
+        f = fopen(tempPath, "wb");
+    }
+    if (f) {
+        unsigned int keyLen = (unsigned int)strlen(key);
+        unsigned long long binarySize = size;
+        int written = fwrite(&keyLen, sizeof(keyLen), 1, f) == 1 &&
+            fwrite(key, 1, keyLen, f) == keyLen &&
+            fwrite(&binarySize, sizeof(binarySize), 1, f) == 1 &&
+            fwrite(binary, 1, size, f) == size;
+        written = fclose(f) == 0 && written;
+#ifdef _WIN32
+        // rename() does not replace an existing file on Windows
+        if (written) remove(path);
+#endif
+        if (!written || rename(tempPath, path) != 0) {
+            fprintf(stderr, "Could not write kernel cache %s\n", path);
+            remove(tempPath);
+        }
+    }
+    free(binary);
+}
+
+// Builds 'source' with 'options' for 'device', from the kernel cache when
+// it holds the program. Sets *cached to whether it did.
+static cl_program OCL_buildProgram(cl_context context, cl_device_id device,
+    const char* source, size_t sourceLen, const char* options, int* cached) {
+    char cacheKey[1024];
+    char cachePath[64];
+    OCL_cacheKey(device, source, sourceLen, options, cacheKey, sizeof(cacheKey), cachePath, sizeof(cachePath));
+    cl_program program = kernelCache ? OCL_loadCachedProgram(context, device, cacheKey, cachePath, options) : NULL;
+    *cached = program != NULL;
+    if (program) return program;
+
+    cl_int err;
+    program = clCreateProgramWithSource(context, 1, &source, &sourceLen, &err);
+    CL_CHECK(err);
+
+    err = clBuildProgram(program, 1, &device, options, NULL, NULL); // build from kernel file
+    if (err != CL_SUCCESS) {
+        size_t logSize = 0; 
+        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &logSize);
+        char* log = (char*)malloc(logSize + 1);
+        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, logSize, log, NULL);
+        log[logSize] = '\0'; 
+        fprintf(stderr, "Build failed:\n%s\n", log); free(log);
+        CL_CHECK(err);
+    }
+    if (kernelCache) {
+        OCL_storeCachedProgram(program, cacheKey, cachePath);
+    }
+    return program;
+}
+
 
 
 
@@ -123,29 +334,422 @@ typedef struct{
    uint8_t reserved;
 } color_u8;
 
-// Stores the satellite data, which fly around black hole in the space
+// Stores the satellite data, which fly around black hole in the space.
+// Structure of arrays: every array holds 'capacity' aligned floats, of which
+// the first 'count' are real satellites and the rest is padding.
 typedef struct{
-   color_f32 identifier;
-   floatvector position;
-   floatvector velocity;
-} satellite;
+   float* x;
+   float* y;
+   float* vx;
+   float* vy;
+   float* red;
+   float* green;
+   float* blue;
+   int count;
+   int capacity;
+} satellitestore;
 
 // Pixel buffer which is rendered to the screen
 color_u8* pixels;
 
+// Host sides of OCL_bufPixels, 'pixels' points to the one presented.
+// [0] is the buffer of fixedInit().
+static color_u8* OCL_hostPixels[2] = { NULL, NULL };
+
+// With --zero-copy the pixel buffers are allocated in host-visible memory
+// and mapped instead of read back: 'pixels' points into the mapping, so
+// render() copies straight from the buffer the kernel wrote. On CPU devices
+// and integrated GPUs mapping only returns a pointer. A buffer is unmapped
+// before it is shaded again.
+int zeroCopy = 0;
+static color_u8* OCL_mappedPixels[2] = { NULL, NULL };
+
 // Pixel buffer which is used for error checking
 color_u8* correctPixels;
 
 // Buffer for all satellites in the space
-satellite* satellites;
-satellite* backupSatelites;
+satellitestore satellites;
+satellitestore backupSatelites;
+
+// Number of satellites in the space, decided at startup
+int satelliteCount = SATELLITE_COUNT;
+
+// Heap allocation aligned to MEMORY_ALIGNMENT. Exits if out of memory.
+void* alignedMalloc(size_t bytes) {
+    void* ptr = NULL;
+#ifdef _WIN32
+    ptr = _aligned_malloc(bytes, MEMORY_ALIGNMENT);
+#else
+    if (posix_memalign(&ptr, MEMORY_ALIGNMENT, bytes) != 0) ptr = NULL;
+#endif
+    if (!ptr) {
+        fprintf(stderr, "Failed to allocate %zu bytes\n", bytes);
+        exit(1);
+    }
+    return ptr;
+}
+
+// Releases memory from alignedMalloc()
+void alignedFree(void* ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+// Allocates the arrays of a satellite store. Padding satellites are parked
+// far away with zero velocity and color, so they can be advanced by the
+// physics like real ones and never dominate a pixel.
+void satelliteStoreAlloc(satellitestore* s, int count) {
+    s->count = count;
+    s->capacity = (count + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    size_t bytes = sizeof(float) * s->capacity;
+    s->x = (float*)alignedMalloc(bytes);
+    s->y = (float*)alignedMalloc(bytes);
+    s->vx = (float*)alignedMalloc(bytes);
+    s->vy = (float*)alignedMalloc(bytes);
+    s->red = (float*)alignedMalloc(bytes);
+    s->green = (float*)alignedMalloc(bytes);
+    s->blue = (float*)alignedMalloc(bytes);
+    for (int i = count; i < s->capacity; ++i) {
+        s->x[i] = PADDING_POSITION;
+        s->y[i] = PADDING_POSITION;
+        s->vx[i] = s->vy[i] = 0.f;
+        s->red[i] = s->green[i] = s->blue[i] = 0.f;
+    }
+}
+
+void satelliteStoreFree(satellitestore* s) {
+    alignedFree(s->x);
+    alignedFree(s->y);
+    alignedFree(s->vx);
+    alignedFree(s->vy);
+    alignedFree(s->red);
+    alignedFree(s->green);
+    alignedFree(s->blue);
+}
+
+// Copies all satellites, including padding. Both stores have the same capacity.
+void satelliteStoreCopy(satellitestore* dst, const satellitestore* src) {
+    size_t bytes = sizeof(float) * src->capacity;
+    memcpy(dst->x, src->x, bytes);
+    memcpy(dst->y, src->y, bytes);
+    memcpy(dst->vx, src->vx, bytes);
+    memcpy(dst->vy, src->vy, bytes);
+    memcpy(dst->red, src->red, bytes);
+    memcpy(dst->green, src->green, bytes);
+    memcpy(dst->blue, src->blue, bytes);
+}
+
+// Bitwise comparison of satellite i in two stores
+int satelliteStoreEqual(const satellitestore* a, const satellitestore* b, int i) {
+    return !memcmp(&a->x[i], &b->x[i], sizeof(float)) &&
+        !memcmp(&a->y[i], &b->y[i], sizeof(float)) &&
+        !memcmp(&a->vx[i], &b->vx[i], sizeof(float)) &&
+        !memcmp(&a->vy[i], &b->vy[i], sizeof(float)) &&
+        !memcmp(&a->red[i], &b->red[i], sizeof(float)) &&
+        !memcmp(&a->green[i], &b->green[i], sizeof(float)) &&
+        !memcmp(&a->blue[i], &b->blue[i], sizeof(float));
+}
+
+color_f32 satelliteColor(const satellitestore* s, int i) {
+    color_f32 color = {.blue = s->blue[i], .green = s->green[i], .red = s->red[i]};
+    return color;
+}
+
+// --nbody adds gravity between the satellites themselves, integrated with
+// leapfrog at --substeps steps per frame (two kernel launches per step, so a
+// few hundred steps are a practical choice). Satellites have a mass of
+// --satellite-mass on average, relative to the black hole, and their mutual
+// gravity is softened by --softening pixels. Same model as the OpenMP backend.
+int nbodyMode = 0;
+#define NBODY_SOFTENING 2.0
+#define NBODY_MASS 1.0e-3
+double nbodySoftening = NBODY_SOFTENING;
+double nbodyMass = NBODY_MASS;
+int physicsSubsteps = PHYSICSUPDATESPERFRAME;
+
+// Work-group size of the nbody_force kernel, which is also the number of
+// satellites staged in local memory at a time
+#define NBODY_TILE 128
+
+// --render=bounds shades with the bit-exact shade_bounds kernel, which culls
+// the hit test and the nearest satellite search per BOUNDS_TILE x BOUNDS_TILE
+// work-group. Its candidate lists hold up to BOUNDS_CANDIDATES satellites.
+// --render=jfa first builds a nearest satellite map by jump flooding, passes
+// with steps 1, then JFA_FIRST_STEP, ..., 2, 1 and again 2, 1, and shades
+// with shade_jfa.
+typedef enum {
+    RENDER_FULL,
+    RENDER_BOUNDS,
+    RENDER_JFA,
+    RENDER_MODE_COUNT
+} rendermode;
+const char* renderModeNames[RENDER_MODE_COUNT] = { "full", "bounds", "jfa" };
+rendermode renderMode = RENDER_FULL;
+#define BOUNDS_TILE 16
+#define BOUNDS_CANDIDATES 256
+#define JFA_FIRST_STEP 1024     // half of the window's larger side, rounded up to a power of two
+
+// --bands=N shades and reads back every frame in N horizontal bands, so the
+// transfer of a band overlaps the shading of the next one. --band-benchmark
+// times a frame for 1, 2, 4, ... bands at startup.
+#define READBACK_BANDS 4
+#define BAND_BENCHMARK_FRAMES 20
+int readbackBands = READBACK_BANDS;
+int bandBenchmarkMode = 0;
+
+// --autotune times every legal work-group shape of the kernel that shades
+// the frame, for --render=full also with 1, 2 and 4 pixels per work-item,
+// and stores the fastest in TUNING_FILE under the device, driver version,
+// kernel and window size. Later runs on the same device use the stored
+// shape; without one they start from 32 x 32, shrunk to the device limits.
+#define TUNING_FILE "parallel.tune"
+#define AUTOTUNE_FRAMES 5
+#define AUTOTUNE_MAX_PIXELS 4
+int autotuneMode = 0;
+
+// --device=POLICY, or the OPENCL_DEVICE environment variable when the
+// option is not given, picks the device among all devices of all platforms,
+// which are listed at startup:
+//   auto         a discrete GPU (NVIDIA / AMD), else an Intel GPU, else any
+//                GPU, else an accelerator, else a CPU device (default)
+//   N            the device listed as [N]
+//   gpu, cpu, accelerator
+//                the first device of that type
+//   fastest      the device that shades a frame fastest in a micro-benchmark
+//                of the shade kernel with this run's satellites
+//   anything else: the first device whose name contains it
+#define OCL_MAX_PLATFORMS 8
+#define OCL_MAX_DEVICES 16
+#define DEVICE_BENCHMARK_FRAMES 3
+const char* devicePolicy = NULL;
+static cl_device_id OCL_devices[OCL_MAX_DEVICES];   // the listed devices
+static int OCL_deviceCount = 0;
+static int OCL_deviceIndex = 0;                      // of OCL_device
+
+// --split-devices=all|I,J,... shares every frame with the devices listed
+// as [I], [J], ... at startup (or all of them) in bands that follow their
+// measured speed, --render=full only. SPLIT_SMOOTHING is the weight of the
+// last frame's rate.
+#define SPLIT_SMOOTHING 0.5
+const char* splitPolicy = NULL;
+static int OCL_splitCount = 0;   // devices sharing a frame, 0 without --split-devices
+
+// Mass of satellite i relative to the black hole, for the N-body mode:
+// nbodyMass on average, spread evenly over [0.5, 1.5) times that by a hash
+// of the index so every backend and run gets the same masses.
+double satelliteMass(int i) {
+    unsigned int h = (unsigned int)i * 2654435761u;
+    h ^= h >> 16;
+    h *= 2246822519u;
+    h ^= h >> 13;
+    return nbodyMass * (0.5 + (h & 0xffffff) / (double)0x1000000);
+}
+
+// Parses all of 'text' as a decimal integer. Returns 0 if it is empty, has
+// anything left over or does not fit an int.
+int parseIntValue(const char* text, int* value) {
+    char* end;
+    errno = 0;
+    long v = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || v < INT_MIN || v > INT_MAX) return 0;
+    *value = (int)v;
+    return 1;
+}
+
+// Parses all of 'text' as a finite floating point number. Returns 0 if it
+// is empty or has anything left over.
+int parseDoubleValue(const char* text, double* value) {
+    char* end;
+    double v = strtod(text, &end);
+    if (end == text || *end != '\0' || !isfinite(v)) return 0;
+    *value = v;
+    return 1;
+}
+
+// Parses one "--name=value" command line option. Returns 0 if the option
+// is unknown or its value is invalid.
+int parseOption(const char* arg) {
+    if (strncmp(arg, "--satellites=", 13) == 0) {
+        return parseIntValue(arg + 13, &satelliteCount) &&
+            satelliteCount > 0 && satelliteCount <= INT_MAX - SIMD_WIDTH;
+    }
+    if (strcmp(arg, "--nbody") == 0) {
+        nbodyMode = 1;
+        return 1;
+    }
+    if (strncmp(arg, "--softening=", 12) == 0) {
+        return parseDoubleValue(arg + 12, &nbodySoftening) && nbodySoftening >= 0.0;
+    }
+    if (strncmp(arg, "--satellite-mass=", 17) == 0) {
+        return parseDoubleValue(arg + 17, &nbodyMass) && nbodyMass >= 0.0;
+    }
+    if (strncmp(arg, "--substeps=", 11) == 0) {
+        return parseIntValue(arg + 11, &physicsSubsteps) && physicsSubsteps > 0;
+    }
+    if (strncmp(arg, "--device=", 9) == 0) {
+        devicePolicy = arg + 9;
+        return arg[9] != '\0';
+    }
+    if (strncmp(arg, "--split-devices=", 16) == 0) {
+        splitPolicy = arg + 16;
+        return strcmp(splitPolicy, "all") == 0 ||
+            (*splitPolicy && strspn(splitPolicy, "0123456789,") == strlen(splitPolicy));
+    }
+    if (strcmp(arg, "--generic-shade") == 0) {
+        specializeShade = 0;
+        return 1;
+    }
+    if (strcmp(arg, "--no-kernel-cache") == 0) {
+        kernelCache = 0;
+        return 1;
+    }
+    if (strncmp(arg, "--bands=", 8) == 0) {
+        return parseIntValue(arg + 8, &readbackBands) && readbackBands > 0;
+    }
+    if (strcmp(arg, "--zero-copy") == 0) {
+        zeroCopy = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--autotune") == 0) {
+        autotuneMode = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--band-benchmark") == 0) {
+        bandBenchmarkMode = 1;
+        return 1;
+    }
+    if (strncmp(arg, "--render=", 9) == 0) {
+        for (int m = 0; m < RENDER_MODE_COUNT; ++m) {
+            if (strcmp(arg + 9, renderModeNames[m]) == 0) {
+                renderMode = (rendermode)m;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    return 0;
+}
 
 ////////////////////////////////////////////////
-//   ¤¤     NVIDIA PICKER AS GPU     ¤¤       //
+//   ¤¤     OPENCL DEVICE PICKER     ¤¤       //
 ////////////////////////////////////////////////
-// --- OpenCL device picker (prefer NVIDIA GPU) ---
+// physics constants are shared with the kernel file through build options
+static void OCL_composeBuildOptions(char* options, size_t size) {
+    int optionsLen = snprintf(options, size,
+        "-DDELTATIME=%d -DPHYSICSUPDATESPERFRAME=%d -DGRAVITY=%ff -DNBODY_TILE=%d"
+        " -DBOUNDS_TILE=%d -DBOUNDS_CANDIDATES=%d",
+        DELTATIME, PHYSICSUPDATESPERFRAME, GRAVITY, NBODY_TILE, BOUNDS_TILE, BOUNDS_CANDIDATES);
+    if (specializeShade) {
+        // the radii as hexadecimal floats, so the kernel compares against
+        // exactly the values the arguments would carry
+        snprintf(options + optionsLen, size - optionsLen,
+            " -DSHADE_SAT_COUNT=%d -DSHADE_WIDTH=%d -DSHADE_HEIGHT=%d -DSHADE_BH_R2=%af -DSHADE_SAT_R2=%af",
+            satelliteCount, WINDOW_WIDTH, WINDOW_HEIGHT,
+            (double)(BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS), (double)(SATELLITE_RADIUS * SATELLITE_RADIUS));
+    }
+}
+
+static const char* OCL_deviceTypeName(cl_device_type type) {
+    return type & CL_DEVICE_TYPE_GPU ? "GPU" :
+        type & CL_DEVICE_TYPE_CPU ? "CPU" :
+        type & CL_DEVICE_TYPE_ACCELERATOR ? "ACCEL" : "OTHER";
+}
+
+// Index of the first of the 'count' devices of 'type' whose platform vendor
+// contains one of 'vendors' (NULL terminated, NULL for any vendor), -1 if none
+static int OCL_findDevice(const cl_platform_id* platforms, const cl_device_id* devices, int count,
+    cl_device_type type, const char* const* vendors) {
+    for (int d = 0; d < count; ++d) {
+        cl_device_type dtype = 0;
+        char vendor[256] = { 0 };
+        clGetDeviceInfo(devices[d], CL_DEVICE_TYPE, sizeof(dtype), &dtype, NULL);
+        clGetPlatformInfo(platforms[d], CL_PLATFORM_VENDOR, sizeof(vendor), vendor, NULL);
+        if (!(dtype & type)) continue;
+        if (!vendors) return d;
+        for (int v = 0; vendors[v]; ++v) {
+            if (strstr(vendor, vendors[v])) return d;
+        }
+    }
+    return -1;
+}
+
+// --device=fastest: milliseconds per frame of the shade kernel on 'device',
+// the best of DEVICE_BENCHMARK_FRAMES after a warm-up, with this run's
+// satellites and build options. The runtime picks the work-group size, so
+// every device runs its own default. INFINITY if the device fails.
+static double OCL_benchmarkDevice(cl_device_id device, const char* source, size_t sourceLen, const char* options) {
+    cl_int err;
+    double best = INFINITY;
+    cl_command_queue queue = NULL;
+    cl_program program = NULL;
+    cl_kernel kernel = NULL;
+    cl_mem buffers[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+    cl_context context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (err != CL_SUCCESS) return INFINITY;
+
+    const cl_queue_properties props[] = { CL_QUEUE_PROPERTIES, 0, 0 };
+    queue = clCreateCommandQueueWithProperties(context, device, props, &err);
+    if (err == CL_SUCCESS) program = clCreateProgramWithSource(context, 1, &source, &sourceLen, &err);
+    if (err == CL_SUCCESS) err = clBuildProgram(program, 1, &device, options, NULL, NULL);
+    if (err == CL_SUCCESS) kernel = clCreateKernel(program, "shade", &err);
+    if (err == CL_SUCCESS) buffers[0] = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(unsigned char) * 4 * SIZE, NULL, &err);
+    float* state[5] = { satellites.x, satellites.y, satellites.red, satellites.green, satellites.blue };
+    for (int b = 0; b < 5 && err == CL_SUCCESS; ++b) {
+        buffers[1 + b] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            satellites.capacity * sizeof(float), state[b], &err);
+    }
+    if (err == CL_SUCCESS) {
+        float bh_r2 = BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS;
+        float sat_r2 = SATELLITE_RADIUS * SATELLITE_RADIUS;
+        int width = WINDOW_WIDTH;
+        int height = WINDOW_HEIGHT;
+        int mx = WINDOW_WIDTH / 2;
+        int my = WINDOW_HEIGHT / 2;
+        int perItem = 1;
+        int firstRow = 0;
+        int failed = 0;
+        for (int a = 0; a < 6; ++a) {
+            failed |= clSetKernelArg(kernel, a, sizeof(cl_mem), &buffers[a]) != CL_SUCCESS;
+        }
+        failed |= clSetKernelArg(kernel, 6, sizeof(satelliteCount), &satelliteCount) != CL_SUCCESS;
+        failed |= clSetKernelArg(kernel, 7, sizeof(width), &width) != CL_SUCCESS;
+        failed |= clSetKernelArg(kernel, 8, sizeof(height), &height) != CL_SUCCESS;
+        failed |= clSetKernelArg(kernel, 9, sizeof(bh_r2), &bh_r2) != CL_SUCCESS;
+        failed |= clSetKernelArg(kernel, 10, sizeof(sat_r2), &sat_r2) != CL_SUCCESS;
+        failed |= clSetKernelArg(kernel, 11, sizeof(mx), &mx) != CL_SUCCESS;
+        failed |= clSetKernelArg(kernel, 12, sizeof(my), &my) != CL_SUCCESS;
+        failed |= clSetKernelArg(kernel, 13, sizeof(perItem), &perItem) != CL_SUCCESS;
+        failed |= clSetKernelArg(kernel, 14, sizeof(firstRow), &firstRow) != CL_SUCCESS;
+
+        size_t global[2] = { WINDOW_WIDTH, WINDOW_HEIGHT };
+        for (int f = 0; f <= DEVICE_BENCHMARK_FRAMES && !failed; ++f) {
+            Uint64 start = SDL_GetPerformanceCounter();
+            failed = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, NULL, 0, NULL, NULL) != CL_SUCCESS ||
+                clFinish(queue) != CL_SUCCESS;
+            double ms = (double)(SDL_GetPerformanceCounter() - start) * 1e3 / SDL_GetPerformanceFrequency();
+            if (!failed && f > 0 && ms < best) best = ms;
+        }
+        if (failed) best = INFINITY;
+    }
+
+    for (int b = 0; b < 6; ++b) {
+        if (buffers[b]) clReleaseMemObject(buffers[b]);
+    }
+    if (kernel)  clReleaseKernel(kernel);
+    if (program) clReleaseProgram(program);
+    if (queue)   clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+    return best;
+}
+
 static void OCL_pickDevice(void)
 {
+    const char* policy = devicePolicy ? devicePolicy : getenv("OPENCL_DEVICE");
+    if (!policy || !*policy) policy = "auto";
+
     cl_uint nplat = 0;
     CL_CHECK(clGetPlatformIDs(0, NULL, &nplat));
     if (nplat == 0) {
@@ -153,68 +757,100 @@ static void OCL_pickDevice(void)
         exit(1);
     }
 
-    cl_platform_id plats[4];
-    if (nplat > 4) nplat = 4;
+    cl_platform_id plats[OCL_MAX_PLATFORMS];
+    if (nplat > OCL_MAX_PLATFORMS) nplat = OCL_MAX_PLATFORMS;
     CL_CHECK(clGetPlatformIDs(nplat, plats, NULL));
 
-    cl_platform_id discretePlat = NULL;
-    cl_device_id   discreteDev = NULL;
-    cl_platform_id integratedPlat = NULL;
-    cl_device_id   integratedDev = NULL;
-
-    // PASS 1: look for a *discrete* GPU (NVIDIA / AMD)
-    for (cl_uint p = 0; p < nplat && !discreteDev; ++p) {
-        char vendor[256] = { 0 };
-        clGetPlatformInfo(plats[p], CL_PLATFORM_VENDOR,
-            sizeof(vendor), vendor, NULL);
-
-        if (strstr(vendor, "NVIDIA") ||
-            strstr(vendor, "AMD") ||
-            strstr(vendor, "Advanced Micro Devices")) {
-
-            cl_device_id dev = NULL;
-            if (clGetDeviceIDs(plats[p], CL_DEVICE_TYPE_GPU,
-                1, &dev, NULL) == CL_SUCCESS) {
-                discretePlat = plats[p];
-                discreteDev = dev;
-            }
+    // every device of every platform, CPUs and accelerators included
+    cl_platform_id devPlats[OCL_MAX_DEVICES];
+    cl_device_id   devs[OCL_MAX_DEVICES];
+    int ndev = 0;
+    for (cl_uint p = 0; p < nplat && ndev < OCL_MAX_DEVICES; ++p) {
+        cl_uint n = 0;
+        if (clGetDeviceIDs(plats[p], CL_DEVICE_TYPE_ALL, OCL_MAX_DEVICES - ndev, devs + ndev, &n) != CL_SUCCESS) {
+            continue;
+        }
+        if (n > (cl_uint)(OCL_MAX_DEVICES - ndev)) n = OCL_MAX_DEVICES - ndev;
+        for (cl_uint d = 0; d < n; ++d) {
+            devPlats[ndev + d] = plats[p];
         }
+        ndev += n;
+    }
+    if (ndev == 0) {
+        fprintf(stderr, "No OpenCL devices found.\n");
+        exit(1);
     }
 
-    // PASS 2: if no discrete GPU, look for an *integrated* GPU (Intel)
-    if (!discreteDev) {
-        for (cl_uint p = 0; p < nplat && !integratedDev; ++p) {
-            char vendor[256] = { 0 };
-            clGetPlatformInfo(plats[p], CL_PLATFORM_VENDOR,
-                sizeof(vendor), vendor, NULL);
+    printf("OpenCL devices:\n");
+    for (int d = 0; d < ndev; ++d) {
+        char name[256] = { 0 };
+        char vendor[256] = { 0 };
+        cl_device_type dtype = 0;
+        clGetDeviceInfo(devs[d], CL_DEVICE_NAME, sizeof(name), name, NULL);
+        clGetDeviceInfo(devs[d], CL_DEVICE_TYPE, sizeof(dtype), &dtype, NULL);
+        clGetPlatformInfo(devPlats[d], CL_PLATFORM_VENDOR, sizeof(vendor), vendor, NULL);
+        printf("  [%d] %s | type: %s | vendor: %s\n", d, name, OCL_deviceTypeName(dtype), vendor);
+    }
 
-            if (strstr(vendor, "Intel")) {
-                cl_device_id dev = NULL;
-                if (clGetDeviceIDs(plats[p], CL_DEVICE_TYPE_GPU,
-                    1, &dev, NULL) == CL_SUCCESS) {
-                    integratedPlat = plats[p];
-                    integratedDev = dev;
-                }
+    int chosen = -1;
+    char* end = NULL;
+    long index = strtol(policy, &end, 10);
+    if (end != policy && *end == '\0') {
+        if (index >= 0 && index < ndev) chosen = (int)index;
+    } else if (strcmp(policy, "auto") == 0) {
+        static const char* const discrete[] = { "NVIDIA", "AMD", "Advanced Micro Devices", NULL };
+        static const char* const integrated[] = { "Intel", NULL };
+        chosen = OCL_findDevice(devPlats, devs, ndev, CL_DEVICE_TYPE_GPU, discrete);
+        if (chosen < 0) chosen = OCL_findDevice(devPlats, devs, ndev, CL_DEVICE_TYPE_GPU, integrated);
+        if (chosen < 0) chosen = OCL_findDevice(devPlats, devs, ndev, CL_DEVICE_TYPE_GPU, NULL);
+        if (chosen < 0) chosen = OCL_findDevice(devPlats, devs, ndev, CL_DEVICE_TYPE_ACCELERATOR, NULL);
+        if (chosen < 0) chosen = OCL_findDevice(devPlats, devs, ndev, CL_DEVICE_TYPE_CPU, NULL);
+    } else if (strcmp(policy, "gpu") == 0) {
+        chosen = OCL_findDevice(devPlats, devs, ndev, CL_DEVICE_TYPE_GPU, NULL);
+    } else if (strcmp(policy, "cpu") == 0) {
+        chosen = OCL_findDevice(devPlats, devs, ndev, CL_DEVICE_TYPE_CPU, NULL);
+    } else if (strcmp(policy, "accelerator") == 0) {
+        chosen = OCL_findDevice(devPlats, devs, ndev, CL_DEVICE_TYPE_ACCELERATOR, NULL);
+    } else if (strcmp(policy, "fastest") == 0) {
+        size_t srcLen = 0;
+        const char* src = OCL_loadKernelSource("parallel.cl", &srcLen);
+        if (!src) { fprintf(stderr, "Could not load parallel.cl\n"); exit(1); }
+        char options[512];
+        OCL_composeBuildOptions(options, sizeof(options));
+        double best = INFINITY;
+        printf("Device benchmark, shade kernel, best of %d frames:\n", DEVICE_BENCHMARK_FRAMES);
+        for (int d = 0; d < ndev; ++d) {
+            double ms = OCL_benchmarkDevice(devs[d], src, srcLen, options);
+            if (ms < INFINITY) {
+                printf("  [%d] %.3f ms\n", d, ms);
+            } else {
+                printf("  [%d] failed\n", d);
+            }
+            if (ms < best) {
+                best = ms;
+                chosen = d;
             }
         }
+    } else {
+        for (int d = 0; d < ndev && chosen < 0; ++d) {
+            char name[256] = { 0 };
+            clGetDeviceInfo(devs[d], CL_DEVICE_NAME, sizeof(name), name, NULL);
+            if (strstr(name, policy)) chosen = d;
+        }
     }
-
-    // Decide which one we finally use
-    if (discreteDev) {
-        OCL_platform = discretePlat;
-        OCL_device = discreteDev;
-    }
-    else if (integratedDev) {
-        OCL_platform = integratedPlat;
-        OCL_device = integratedDev;
-    }
-    else {
-        fprintf(stderr,
-            "No GPU OpenCL device found (no discrete or integrated GPU).\n");
+    if (chosen < 0) {
+        fprintf(stderr, "No OpenCL device matches the device policy '%s'.\n", policy);
         exit(1);
     }
+    OCL_platform = devPlats[chosen];
+    OCL_device = devs[chosen];
+    for (int d = 0; d < ndev; ++d) {
+        OCL_devices[d] = devs[d];
+    }
+    OCL_deviceCount = ndev;
+    OCL_deviceIndex = chosen;
 
-    // Optional: print what we picked (handy for debugging/report)
+    // print what we picked (handy for debugging/report)
     char platName[256] = { 0 };
     char platVendor[256] = { 0 };
     char devName[256] = { 0 };
@@ -226,74 +862,211 @@ static void OCL_pickDevice(void)
     clGetDeviceInfo(OCL_device, CL_DEVICE_TYPE, sizeof(dtype), &dtype, NULL);
 
     printf("OpenCL platform: %s | vendor: %s\n", platName, platVendor);
-    printf("OpenCL device  : %s | type: %s\n",
-        devName,
-        (dtype == CL_DEVICE_TYPE_GPU ? "GPU" :
-            dtype == CL_DEVICE_TYPE_CPU ? "CPU" :
-            dtype == CL_DEVICE_TYPE_ACCELERATOR ? "ACCEL" : "OTHER"));
+    printf("OpenCL device  : [%d] %s | type: %s | policy: %s\n",
+        chosen, devName, OCL_deviceTypeName(dtype), policy);
 }
 
 
 
 
+static void bandBenchmark(void);
+static void selectWorkGroup(void);
+static void splitInit(const char* source, size_t sourceLen, const char* options);
+
 void init(){
+    Uint64 startupStart = SDL_GetPerformanceCounter();
+
     // Pick device first
     OCL_pickDevice();
 
     cl_int err;
     // Context + queue
-    const cl_queue_properties props[] = { CL_QUEUE_PROPERTIES, 0, 0 };
+    // the N-body mode and the multi-device split time their commands with
+    // profiling events
+    const cl_queue_properties props[] = { CL_QUEUE_PROPERTIES,
+        nbodyMode || splitPolicy ? CL_QUEUE_PROFILING_ENABLE : 0, 0 };
+    const cl_queue_properties transferProps[] = { CL_QUEUE_PROPERTIES, 0, 0 };
     OCL_context = clCreateContext(NULL, 1, &OCL_device, NULL, NULL, &err); 
     CL_CHECK(err);
     OCL_queue = clCreateCommandQueueWithProperties(OCL_context, OCL_device, props, &err); 
     CL_CHECK(err);
+    OCL_queueTransfer = clCreateCommandQueueWithProperties(OCL_context, OCL_device, transferProps, &err);
+    CL_CHECK(err);
 
 
     // Program + kernel
+    Uint64 programStart = SDL_GetPerformanceCounter();
     size_t OCL_srcLen = 0;
     char* OCL_src = OCL_loadKernelSource("parallel.cl", &OCL_srcLen);
     if (!OCL_src) { fprintf(stderr, "Could not load parallel.cl\n"); exit(1); }
-    const char* srcs[] = { OCL_src };
-    const size_t lens[] = { OCL_srcLen };
-    OCL_program = clCreateProgramWithSource(OCL_context, 1, srcs, lens, &err);
-    CL_CHECK(err);
 
-    err = clBuildProgram(OCL_program, 1, &OCL_device, NULL, NULL, NULL); // build from kernel file
-    if (err != CL_SUCCESS) {
-        size_t logSize = 0; 
-        clGetProgramBuildInfo(OCL_program, OCL_device, CL_PROGRAM_BUILD_LOG, 0, NULL, &logSize);
-        char* log = (char*)malloc(logSize + 1);
-        clGetProgramBuildInfo(OCL_program, OCL_device, CL_PROGRAM_BUILD_LOG, logSize, log, NULL);
-        log[logSize] = '\0'; 
-        fprintf(stderr, "Build failed:\n%s\n", log); free(log);
-        CL_CHECK(err);
-    }
+    char OCL_buildOptions[512];
+    OCL_composeBuildOptions(OCL_buildOptions, sizeof(OCL_buildOptions));
+
+    int cached = 0;
+    OCL_program = OCL_buildProgram(OCL_context, OCL_device, OCL_src, OCL_srcLen, OCL_buildOptions, &cached);
+    printf("OpenCL program: %s in %.1f ms\n", cached ? "loaded from kernel cache" : "built from source",
+        (double)(SDL_GetPerformanceCounter() - programStart) * 1e3 / SDL_GetPerformanceFrequency());
     OCL_kernel = clCreateKernel(OCL_program, "shade", &err); CL_CHECK(err);
+    OCL_kernelPhysics = clCreateKernel(OCL_program, "physics", &err); CL_CHECK(err);
+    OCL_kernelNbodyLoad = clCreateKernel(OCL_program, "nbody_load", &err); CL_CHECK(err);
+    OCL_kernelNbodyStore = clCreateKernel(OCL_program, "nbody_store", &err); CL_CHECK(err);
+    OCL_kernelNbodyDrift = clCreateKernel(OCL_program, "nbody_drift", &err); CL_CHECK(err);
+    OCL_kernelNbodyForce = clCreateKernel(OCL_program, "nbody_force", &err); CL_CHECK(err);
+    OCL_kernelShadeBounds = clCreateKernel(OCL_program, "shade_bounds", &err); CL_CHECK(err);
+    OCL_kernelJfaClear = clCreateKernel(OCL_program, "jfa_clear", &err); CL_CHECK(err);
+    OCL_kernelJfaSeed = clCreateKernel(OCL_program, "jfa_seed", &err); CL_CHECK(err);
+    OCL_kernelJfaStep = clCreateKernel(OCL_program, "jfa_step", &err); CL_CHECK(err);
+    OCL_kernelShadeJfa = clCreateKernel(OCL_program, "shade_jfa", &err); CL_CHECK(err);
+    if (specializeShade) {
+        printf("Shade kernels specialized for %d satellites\n", satelliteCount);
+    }
+    if (renderMode == RENDER_BOUNDS) {
+        printf("Render: bounds, %d x %d work-groups\n", BOUNDS_TILE, BOUNDS_TILE);
+    }
+    if (renderMode == RENDER_JFA) {
+        printf("Render: jump flooding nearest satellite map\n");
+    }
+
+    cl_device_fp_config fp64 = 0;
+    clGetDeviceInfo(OCL_device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64), &fp64, NULL);
+    if (!fp64) {
+        printf("Device has no double precision, physics runs in float\n");
+    }
 
     // Buffers
-    // pixels: write directly into host memory
-    OCL_bufPixels = clCreateBuffer(OCL_context, CL_MEM_WRITE_ONLY, sizeof(unsigned char) * 4 * SIZE,NULL, &err);
-    CL_CHECK(err);
+    // pixels: two frames in flight, each read back into a host buffer of its
+    // own, or mapped with --zero-copy
+    if (splitPolicy && zeroCopy && renderMode == RENDER_FULL) {
+        printf("--split-devices reads the bands back, --zero-copy is ignored\n");
+        zeroCopy = 0;
+    }
+    cl_mem_flags pixelFlags = CL_MEM_WRITE_ONLY | (zeroCopy ? CL_MEM_ALLOC_HOST_PTR : 0);
+    for (int b = 0; b < 2; ++b) {
+        OCL_bufPixels[b] = clCreateBuffer(OCL_context, pixelFlags, sizeof(unsigned char) * 4 * SIZE, NULL, &err);
+        CL_CHECK(err);
+    }
+    OCL_hostPixels[0] = pixels;
+    if (!zeroCopy) {
+        OCL_hostPixels[1] = (color_u8*)malloc(sizeof(color_u8) * SIZE);
+    }
 
-    OCL_bufPosX = clCreateBuffer(OCL_context, CL_MEM_READ_ONLY, SATELLITE_COUNT * sizeof(float), NULL, &err); CL_CHECK(err);
-    OCL_bufPosY = clCreateBuffer(OCL_context, CL_MEM_READ_ONLY, SATELLITE_COUNT * sizeof(float), NULL, &err); CL_CHECK(err);
-    OCL_bufIdR = clCreateBuffer(OCL_context, CL_MEM_READ_ONLY, SATELLITE_COUNT * sizeof(float), NULL, &err); CL_CHECK(err);
-    OCL_bufIdG = clCreateBuffer(OCL_context, CL_MEM_READ_ONLY, SATELLITE_COUNT * sizeof(float), NULL, &err); CL_CHECK(err);
-    OCL_bufIdB = clCreateBuffer(OCL_context, CL_MEM_READ_ONLY, SATELLITE_COUNT * sizeof(float), NULL, &err); CL_CHECK(err);
+    // satellite state lives on the device; buffers include the padding satellites
+    size_t stateBytes = satellites.capacity * sizeof(float);
+    OCL_bufPosX = clCreateBuffer(OCL_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, stateBytes, satellites.x, &err); CL_CHECK(err);
+    OCL_bufPosY = clCreateBuffer(OCL_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, stateBytes, satellites.y, &err); CL_CHECK(err);
+    OCL_bufVelX = clCreateBuffer(OCL_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, stateBytes, satellites.vx, &err); CL_CHECK(err);
+    OCL_bufVelY = clCreateBuffer(OCL_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, stateBytes, satellites.vy, &err); CL_CHECK(err);
+    OCL_bufIdR = clCreateBuffer(OCL_context, CL_MEM_READ_ONLY, satelliteCount * sizeof(float), NULL, &err); CL_CHECK(err);
+    OCL_bufIdG = clCreateBuffer(OCL_context, CL_MEM_READ_ONLY, satelliteCount * sizeof(float), NULL, &err); CL_CHECK(err);
+    OCL_bufIdB = clCreateBuffer(OCL_context, CL_MEM_READ_ONLY, satelliteCount * sizeof(float), NULL, &err); CL_CHECK(err);
 
     // Upload constant identifier colors once
-    float OCL_hostIdR[SATELLITE_COUNT];
-    float OCL_hostIdG[SATELLITE_COUNT];
-    float OCL_hostIdB[SATELLITE_COUNT];
+    // (the satellite store is already SoA, so its arrays are copied as is)
+    size_t idBytes = satelliteCount * sizeof(float);
+    CL_CHECK(clEnqueueWriteBuffer(OCL_queue, OCL_bufIdR, CL_TRUE, 0, idBytes, satellites.red, 0, NULL, NULL));
+    CL_CHECK(clEnqueueWriteBuffer(OCL_queue, OCL_bufIdG, CL_TRUE, 0, idBytes, satellites.green, 0, NULL, NULL));
+    CL_CHECK(clEnqueueWriteBuffer(OCL_queue, OCL_bufIdB, CL_TRUE, 0, idBytes, satellites.blue, 0, NULL, NULL));
+
+    // physics arguments that never change
+    int capacity = satellites.capacity;
+    CL_CHECK(clSetKernelArg(OCL_kernelPhysics, 0, sizeof(cl_mem), &OCL_bufPosX));
+    CL_CHECK(clSetKernelArg(OCL_kernelPhysics, 1, sizeof(cl_mem), &OCL_bufPosY));
+    CL_CHECK(clSetKernelArg(OCL_kernelPhysics, 2, sizeof(cl_mem), &OCL_bufVelX));
+    CL_CHECK(clSetKernelArg(OCL_kernelPhysics, 3, sizeof(cl_mem), &OCL_bufVelY));
+    CL_CHECK(clSetKernelArg(OCL_kernelPhysics, 4, sizeof(capacity), &capacity));
+
+    // shade arguments that never change; shade, shade_bounds and shade_jfa
+    // take the same first arguments. enqueueFrame() sets the pixel buffer,
+    // the mouse position and the nearest satellite map.
+    {
+        float bh_r2 = BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS;
+        float sat_r2 = SATELLITE_RADIUS * SATELLITE_RADIUS;
+        int   width = WINDOW_WIDTH;
+        int   height = WINDOW_HEIGHT;
+        cl_kernel shadeKernels[3] = { OCL_kernel, OCL_kernelShadeBounds, OCL_kernelShadeJfa };
+        for (int k = 0; k < 3; ++k) {
+            CL_CHECK(clSetKernelArg(shadeKernels[k], 1, sizeof(cl_mem), &OCL_bufPosX));
+            CL_CHECK(clSetKernelArg(shadeKernels[k], 2, sizeof(cl_mem), &OCL_bufPosY));
+            CL_CHECK(clSetKernelArg(shadeKernels[k], 3, sizeof(cl_mem), &OCL_bufIdR));
+            CL_CHECK(clSetKernelArg(shadeKernels[k], 4, sizeof(cl_mem), &OCL_bufIdG));
+            CL_CHECK(clSetKernelArg(shadeKernels[k], 5, sizeof(cl_mem), &OCL_bufIdB));
+            CL_CHECK(clSetKernelArg(shadeKernels[k], 6, sizeof(satelliteCount), &satelliteCount));
+            CL_CHECK(clSetKernelArg(shadeKernels[k], 7, sizeof(width), &width));
+            CL_CHECK(clSetKernelArg(shadeKernels[k], 8, sizeof(height), &height));
+            CL_CHECK(clSetKernelArg(shadeKernels[k], 9, sizeof(bh_r2), &bh_r2));
+            CL_CHECK(clSetKernelArg(shadeKernels[k], 10, sizeof(sat_r2), &sat_r2));
+        }
+        // shade writes whole frames
+        int firstRow = 0;
+        CL_CHECK(clSetKernelArg(OCL_kernel, 14, sizeof(firstRow), &firstRow));
+    }
 
-    for (int j = 0; j < SATELLITE_COUNT; ++j) {
-        OCL_hostIdR[j] = satellites[j].identifier.red;
-        OCL_hostIdG[j] = satellites[j].identifier.green;
-        OCL_hostIdB[j] = satellites[j].identifier.blue;
+    if (renderMode == RENDER_JFA) {
+        int width = WINDOW_WIDTH;
+        int height = WINDOW_HEIGHT;
+        OCL_bufJfaMap[0] = clCreateBuffer(OCL_context, CL_MEM_READ_WRITE, sizeof(cl_int) * SIZE, NULL, &err); CL_CHECK(err);
+        OCL_bufJfaMap[1] = clCreateBuffer(OCL_context, CL_MEM_READ_WRITE, sizeof(cl_int) * SIZE, NULL, &err); CL_CHECK(err);
+        OCL_bufJfaNext = clCreateBuffer(OCL_context, CL_MEM_READ_WRITE, sizeof(cl_int) * satelliteCount, NULL, &err); CL_CHECK(err);
+        CL_CHECK(clSetKernelArg(OCL_kernelJfaSeed, 0, sizeof(cl_mem), &OCL_bufPosX));
+        CL_CHECK(clSetKernelArg(OCL_kernelJfaSeed, 1, sizeof(cl_mem), &OCL_bufPosY));
+        CL_CHECK(clSetKernelArg(OCL_kernelJfaSeed, 2, sizeof(int), &satelliteCount));
+        CL_CHECK(clSetKernelArg(OCL_kernelJfaSeed, 4, sizeof(cl_mem), &OCL_bufJfaNext));
+        CL_CHECK(clSetKernelArg(OCL_kernelJfaSeed, 5, sizeof(int), &width));
+        CL_CHECK(clSetKernelArg(OCL_kernelJfaSeed, 6, sizeof(int), &height));
+        CL_CHECK(clSetKernelArg(OCL_kernelJfaStep, 2, sizeof(cl_mem), &OCL_bufPosX));
+        CL_CHECK(clSetKernelArg(OCL_kernelJfaStep, 3, sizeof(cl_mem), &OCL_bufPosY));
+        CL_CHECK(clSetKernelArg(OCL_kernelJfaStep, 4, sizeof(cl_mem), &OCL_bufJfaNext));
+        CL_CHECK(clSetKernelArg(OCL_kernelJfaStep, 5, sizeof(int), &width));
+        CL_CHECK(clSetKernelArg(OCL_kernelJfaStep, 6, sizeof(int), &height));
+        CL_CHECK(clSetKernelArg(OCL_kernelShadeJfa, 14, sizeof(cl_mem), &OCL_bufJfaNext));
+    }
+
+    if (nbodyMode) {
+        printf("N-body mode: %d sub-steps per frame, softening %g, mean mass %g\n",
+            physicsSubsteps, nbodySoftening, nbodyMass);
+
+        // the kernels' 'real' is double exactly when the device has fp64
+        size_t realBytes = satelliteCount * (fp64 ? sizeof(cl_double) : sizeof(cl_float));
+        OCL_bufNbodyX = clCreateBuffer(OCL_context, CL_MEM_READ_WRITE, realBytes, NULL, &err); CL_CHECK(err);
+        OCL_bufNbodyY = clCreateBuffer(OCL_context, CL_MEM_READ_WRITE, realBytes, NULL, &err); CL_CHECK(err);
+        OCL_bufNbodyVX = clCreateBuffer(OCL_context, CL_MEM_READ_WRITE, realBytes, NULL, &err); CL_CHECK(err);
+        OCL_bufNbodyVY = clCreateBuffer(OCL_context, CL_MEM_READ_WRITE, realBytes, NULL, &err); CL_CHECK(err);
+        OCL_bufNbodyAX = clCreateBuffer(OCL_context, CL_MEM_READ_WRITE, realBytes, NULL, &err); CL_CHECK(err);
+        OCL_bufNbodyAY = clCreateBuffer(OCL_context, CL_MEM_READ_WRITE, realBytes, NULL, &err); CL_CHECK(err);
+
+        float* mass = (float*)malloc(satelliteCount * sizeof(float));
+        for (int i = 0; i < satelliteCount; ++i) {
+            mass[i] = (float)satelliteMass(i);
+        }
+        OCL_bufMass = clCreateBuffer(OCL_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            satelliteCount * sizeof(float), mass, &err); CL_CHECK(err);
+        free(mass);
+
+        // every argument except the mouse position and the kick flag is fixed
+        float softening = (float)nbodySoftening;
+        cl_mem floatState[4] = { OCL_bufPosX, OCL_bufPosY, OCL_bufVelX, OCL_bufVelY };
+        cl_mem realState[6] = { OCL_bufNbodyX, OCL_bufNbodyY, OCL_bufNbodyVX, OCL_bufNbodyVY,
+            OCL_bufNbodyAX, OCL_bufNbodyAY };
+        for (int a = 0; a < 4; ++a) {
+            CL_CHECK(clSetKernelArg(OCL_kernelNbodyLoad, a, sizeof(cl_mem), &floatState[a]));
+            CL_CHECK(clSetKernelArg(OCL_kernelNbodyLoad, 4 + a, sizeof(cl_mem), &realState[a]));
+            CL_CHECK(clSetKernelArg(OCL_kernelNbodyStore, a, sizeof(cl_mem), &floatState[a]));
+            CL_CHECK(clSetKernelArg(OCL_kernelNbodyStore, 4 + a, sizeof(cl_mem), &realState[a]));
+        }
+        CL_CHECK(clSetKernelArg(OCL_kernelNbodyLoad, 8, sizeof(int), &satelliteCount));
+        CL_CHECK(clSetKernelArg(OCL_kernelNbodyStore, 8, sizeof(int), &satelliteCount));
+        for (int a = 0; a < 6; ++a) {
+            CL_CHECK(clSetKernelArg(OCL_kernelNbodyDrift, a, sizeof(cl_mem), &realState[a]));
+            CL_CHECK(clSetKernelArg(OCL_kernelNbodyForce, a, sizeof(cl_mem), &realState[a]));
+        }
+        CL_CHECK(clSetKernelArg(OCL_kernelNbodyDrift, 6, sizeof(int), &satelliteCount));
+        CL_CHECK(clSetKernelArg(OCL_kernelNbodyDrift, 7, sizeof(int), &physicsSubsteps));
+        CL_CHECK(clSetKernelArg(OCL_kernelNbodyForce, 6, sizeof(cl_mem), &OCL_bufMass));
+        CL_CHECK(clSetKernelArg(OCL_kernelNbodyForce, 7, sizeof(int), &satelliteCount));
+        CL_CHECK(clSetKernelArg(OCL_kernelNbodyForce, 10, sizeof(float), &softening));
+        CL_CHECK(clSetKernelArg(OCL_kernelNbodyForce, 11, sizeof(int), &physicsSubsteps));
     }
-    CL_CHECK(clEnqueueWriteBuffer(OCL_queue, OCL_bufIdR, CL_TRUE, 0, sizeof(OCL_hostIdR), OCL_hostIdR, 0, NULL, NULL));
-    CL_CHECK(clEnqueueWriteBuffer(OCL_queue, OCL_bufIdG, CL_TRUE, 0, sizeof(OCL_hostIdG), OCL_hostIdG, 0, NULL, NULL));
-    CL_CHECK(clEnqueueWriteBuffer(OCL_queue, OCL_bufIdB, CL_TRUE, 0, sizeof(OCL_hostIdB), OCL_hostIdB, 0, NULL, NULL));
 
     // print WG preference
     size_t pref = 0, maxWG = 0;
@@ -302,80 +1075,99 @@ void init(){
     clGetKernelWorkGroupInfo(OCL_kernel, OCL_device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(pref), &pref, NULL);
     clGetKernelWorkGroupInfo(OCL_kernel, OCL_device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(maxWG), &maxWG, NULL);
     printf("Preferred WG multiple: %zu | Kernel Max WG size: %zu | Device max WG size: %zu \n", pref, maxWG, devMaxWG);
+    selectWorkGroup();
+    splitInit(OCL_src, OCL_srcLen, OCL_buildOptions);
+    if (OCL_splitCount) {
+        printf("Readback: one band per device\n");
+    } else if (zeroCopy) {
+        printf("Readback: zero-copy, mapped host-visible pixel buffers\n");
+    } else {
+        printf("Readback: %d bands\n", readbackBands);
+    }
+    printf("OpenCL startup: %.1f ms\n",
+        (double)(SDL_GetPerformanceCounter() - startupStart) * 1e3 / SDL_GetPerformanceFrequency());
+
+    if (bandBenchmarkMode) {
+        bandBenchmark();
+    }
 }
 
 
 
-// ## You are asked to make this code parallel ##
-// Physics engine loop. (This is called once a frame before graphics engine)
-// Moves the satellites based on gravity
-// This is done multiple times in a frame because the Euler integration
-// is not accurate enough to be done only once
-void parallelPhysicsEngine(void) {
+// One frame of the N-body mode: physicsSubsteps leapfrog steps on the
+// device, then the result is stored to the float buffers the shade kernel
+// reads. The first and last command are kept as profiling events, and the
+// throughput is reported once the frame is presented.
+static void nbodyPhysicsEngine(int mx, int my) {
 
-    int tmpMousePosX = mousePosX;
-    int tmpMousePosY = mousePosY;
+    size_t global = (size_t)satelliteCount;
+    size_t local = NBODY_TILE;
+    size_t forceGlobal = (global + NBODY_TILE - 1) / NBODY_TILE * NBODY_TILE;
+    int kick = 0;
+    cl_event* events = OCL_nbodyEvents[OCL_pixelSlot];
 
-    // double precision required for accumulation inside this routine,
-    // but float storage is ok outside these loops.
-    doublevector tmpPosition[SATELLITE_COUNT];
-    doublevector tmpVelocity[SATELLITE_COUNT];
+    CL_CHECK(clSetKernelArg(OCL_kernelNbodyForce, 8, sizeof(mx), &mx));
+    CL_CHECK(clSetKernelArg(OCL_kernelNbodyForce, 9, sizeof(my), &my));
+    CL_CHECK(clEnqueueNDRangeKernel(OCL_queue, OCL_kernelNbodyLoad, 1, NULL, &global, NULL, 0, NULL, &events[0]));
 
-    // Copy in (float -> double) once
-    for (int idx = 0; idx < SATELLITE_COUNT; ++idx) {
-        tmpPosition[idx].x = satellites[idx].position.x;
-        tmpPosition[idx].y = satellites[idx].position.y;
-        tmpVelocity[idx].x = satellites[idx].velocity.x;
-        tmpVelocity[idx].y = satellites[idx].velocity.y;
+    // starting accelerations without a kick, then the steps
+    CL_CHECK(clSetKernelArg(OCL_kernelNbodyForce, 12, sizeof(kick), &kick));
+    CL_CHECK(clEnqueueNDRangeKernel(OCL_queue, OCL_kernelNbodyForce, 1, NULL, &forceGlobal, &local, 0, NULL, NULL));
+    kick = 1;
+    CL_CHECK(clSetKernelArg(OCL_kernelNbodyForce, 12, sizeof(kick), &kick));
+    for (int step = 0; step < physicsSubsteps; ++step) {
+        CL_CHECK(clEnqueueNDRangeKernel(OCL_queue, OCL_kernelNbodyDrift, 1, NULL, &global, NULL, 0, NULL, NULL));
+        CL_CHECK(clEnqueueNDRangeKernel(OCL_queue, OCL_kernelNbodyForce, 1, NULL, &forceGlobal, &local, 0, NULL, NULL));
     }
 
-    const double dt = (double)DELTATIME / (double)PHYSICSUPDATESPERFRAME;
-
-    int i;
-#pragma omp parallel for schedule(static)
-    for (i = 0; i < SATELLITE_COUNT; ++i) {
-
-        // Work in registers to avoid false sharing
-        double x = tmpPosition[i].x;
-        double y = tmpPosition[i].y;
-        double vx = tmpVelocity[i].x;
-        double vy = tmpVelocity[i].y;
-
-        int physicsUpdateIndex;
-        for (physicsUpdateIndex = 0;
-            physicsUpdateIndex < PHYSICSUPDATESPERFRAME;
-            ++physicsUpdateIndex)
-        {
-            double dx = x - tmpMousePosX;
-            double dy = y - tmpMousePosY;
-            double d2 = dx * dx + dy * dy;
+    CL_CHECK(clEnqueueNDRangeKernel(OCL_queue, OCL_kernelNbodyStore, 1, NULL, &global, NULL, 0, NULL, &events[1]));
+}
 
-            double invd = 1.0 / sqrt(d2);
-            double invd2 = invd * invd;
+// Prints the throughput of the N-body steps of pixel buffer b's frame, which
+// has completed, counting N * (N - 1) interactions per force evaluation like
+// the OpenMP backend
+static void nbodyReport(int b) {
+    cl_event* events = OCL_nbodyEvents[b];
+    if (!events[0]) return;
+    cl_ulong start = 0, end = 0;
+    CL_CHECK(clGetEventProfilingInfo(events[0], CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL));
+    CL_CHECK(clGetEventProfilingInfo(events[1], CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL));
+    clReleaseEvent(events[0]);
+    clReleaseEvent(events[1]);
+    events[0] = events[1] = NULL;
+
+    double seconds = (end - start) * 1e-9;
+    double pairs = (double)satelliteCount * (satelliteCount - 1.0) * (physicsSubsteps + 1);
+    printf("N-body: %.3e pair interactions/s\n", pairs / seconds);
+}
 
-            double ax = (GRAVITY * dx) * (invd * invd2);
-            double ay = (GRAVITY * dy) * (invd * invd2);
+// ## You are asked to make this code parallel ##
+// Physics engine loop. (This is called once a frame before graphics engine)
+// Moves the satellites based on gravity
+// Runs the 'physics' kernel on the device. The satellite state never leaves
+// the device, except in the first frames where compute() checks it against
+// sequentialPhysicsEngine.
+void parallelPhysicsEngine(void) {
 
-            vx -= ax * dt;
-            vy -= ay * dt;
+    int mx = mousePosX;
+    int my = mousePosY;
 
-            x += vx * dt;
-            y += vy * dt;
-        }
+    if (nbodyMode) {
+        nbodyPhysicsEngine(mx, my);
+    } else {
+        CL_CHECK(clSetKernelArg(OCL_kernelPhysics, 5, sizeof(mx), &mx));
+        CL_CHECK(clSetKernelArg(OCL_kernelPhysics, 6, sizeof(my), &my));
 
-        // Single write-back per satellite
-        tmpPosition[i].x = x;
-        tmpPosition[i].y = y;
-        tmpVelocity[i].x = vx;
-        tmpVelocity[i].y = vy;
+        size_t global = (size_t)satellites.capacity;
+        CL_CHECK(clEnqueueNDRangeKernel(OCL_queue, OCL_kernelPhysics, 1, NULL, &global, NULL, 0, NULL, NULL));
     }
 
-    // Copy back into float storage once
-    for (int idx2 = 0; idx2 < SATELLITE_COUNT; ++idx2) {
-        satellites[idx2].position.x = (float)tmpPosition[idx2].x;
-        satellites[idx2].position.y = (float)tmpPosition[idx2].y;
-        satellites[idx2].velocity.x = (float)tmpVelocity[idx2].x;
-        satellites[idx2].velocity.y = (float)tmpVelocity[idx2].y;
+    if (frameNumber < 2) {
+        size_t stateBytes = satellites.capacity * sizeof(float);
+        CL_CHECK(clEnqueueReadBuffer(OCL_queue, OCL_bufPosX, CL_FALSE, 0, stateBytes, satellites.x, 0, NULL, NULL));
+        CL_CHECK(clEnqueueReadBuffer(OCL_queue, OCL_bufPosY, CL_FALSE, 0, stateBytes, satellites.y, 0, NULL, NULL));
+        CL_CHECK(clEnqueueReadBuffer(OCL_queue, OCL_bufVelX, CL_FALSE, 0, stateBytes, satellites.vx, 0, NULL, NULL));
+        CL_CHECK(clEnqueueReadBuffer(OCL_queue, OCL_bufVelY, CL_TRUE, 0, stateBytes, satellites.vy, 0, NULL, NULL));
     }
 }
 
@@ -430,7 +1222,7 @@ void parallelPhysicsEngine(void) {
             int hitsSatellite = 0;
 
             int j;
-            for (j = 0; j < SATELLITE_COUNT; ++j) {
+            for (j = 0; j < satelliteCount; ++j) {
 
                 float dx = px - satellites[j].position.x;
                 float dy = py - satellites[j].position.y;
@@ -474,58 +1266,635 @@ void parallelPhysicsEngine(void) {
 
 
 
-void parallelGraphicsEngine(void) {
+// Enqueues one jfa_step pass from map 'in' to the other map
+static void jfaPass(int in, int step, const size_t* global, const size_t* local) {
+    CL_CHECK(clSetKernelArg(OCL_kernelJfaStep, 0, sizeof(cl_mem), &OCL_bufJfaMap[in]));
+    CL_CHECK(clSetKernelArg(OCL_kernelJfaStep, 1, sizeof(cl_mem), &OCL_bufJfaMap[1 - in]));
+    CL_CHECK(clSetKernelArg(OCL_kernelJfaStep, 7, sizeof(step), &step));
+    CL_CHECK(clEnqueueNDRangeKernel(OCL_queue, OCL_kernelJfaStep, 2, NULL, global, local, 0, NULL, NULL));
+}
 
-    // prepare host SoA arrays each frame
-    float OCL_hostPosX[SATELLITE_COUNT];
-    float OCL_hostPosY[SATELLITE_COUNT];
-
-    // write satellites to device
-    for (int j = 0; j < SATELLITE_COUNT; ++j) {
-        OCL_hostPosX[j] = satellites[j].position.x;
-        OCL_hostPosY[j] = satellites[j].position.y;
-    }
-
-    CL_CHECK(clEnqueueWriteBuffer(OCL_queue, OCL_bufPosX, CL_FALSE, 0, sizeof(OCL_hostPosX), OCL_hostPosX, 0, NULL, NULL));
-    CL_CHECK(clEnqueueWriteBuffer(OCL_queue, OCL_bufPosY, CL_FALSE, 0, sizeof(OCL_hostPosY), OCL_hostPosY, 0, NULL, NULL));
-
-
-    // locals (not macros) so we can take addresses safely
-    float bh_r2 = BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS;
-    float sat_r2 = SATELLITE_RADIUS * SATELLITE_RADIUS;
-    int   mx = mousePosX;
-    int   my = mousePosY;
-    int   satCount = SATELLITE_COUNT;
-    int   width = WINDOW_WIDTH;
-    int   height = WINDOW_HEIGHT;
-
-    // set kernel args
-    int arg = 0;
-    CL_CHECK(clSetKernelArg(OCL_kernel, arg++, sizeof(cl_mem), &OCL_bufPixels));
-    CL_CHECK(clSetKernelArg(OCL_kernel, arg++, sizeof(cl_mem), &OCL_bufPosX));
-    CL_CHECK(clSetKernelArg(OCL_kernel, arg++, sizeof(cl_mem), &OCL_bufPosY));
-    CL_CHECK(clSetKernelArg(OCL_kernel, arg++, sizeof(cl_mem), &OCL_bufIdR));
-    CL_CHECK(clSetKernelArg(OCL_kernel, arg++, sizeof(cl_mem), &OCL_bufIdG));
-    CL_CHECK(clSetKernelArg(OCL_kernel, arg++, sizeof(cl_mem), &OCL_bufIdB));
-    CL_CHECK(clSetKernelArg(OCL_kernel, arg++, sizeof(satCount), &satCount));
-    CL_CHECK(clSetKernelArg(OCL_kernel, arg++, sizeof(width), &width));
-    CL_CHECK(clSetKernelArg(OCL_kernel, arg++, sizeof(height), &height));
-    CL_CHECK(clSetKernelArg(OCL_kernel, arg++, sizeof(bh_r2), &bh_r2));
-    CL_CHECK(clSetKernelArg(OCL_kernel, arg++, sizeof(sat_r2), &sat_r2));
-    CL_CHECK(clSetKernelArg(OCL_kernel, arg++, sizeof(mx), &mx));
-    CL_CHECK(clSetKernelArg(OCL_kernel, arg++, sizeof(my), &my));
-
-    // global dims rounded up to multiples of WG
-    size_t local[2] = { OCL_wgSizeX, OCL_wgSizeY };
-    size_t g0 = ((size_t)WINDOW_WIDTH + OCL_wgSizeX - 1) / OCL_wgSizeX * OCL_wgSizeX;
-    size_t g1 = ((size_t)WINDOW_HEIGHT + OCL_wgSizeY - 1) / OCL_wgSizeY * OCL_wgSizeY;
+// Enqueues seeding and all jump flooding passes over the shading grid,
+// returns the map buffer that will hold the result
+static cl_mem jfaNearestMap(const size_t* global, const size_t* local) {
+    int size = SIZE;
+    size_t clearGlobal = SIZE;
+    CL_CHECK(clSetKernelArg(OCL_kernelJfaClear, 0, sizeof(cl_mem), &OCL_bufJfaMap[0]));
+    CL_CHECK(clSetKernelArg(OCL_kernelJfaClear, 1, sizeof(size), &size));
+    CL_CHECK(clEnqueueNDRangeKernel(OCL_queue, OCL_kernelJfaClear, 1, NULL, &clearGlobal, NULL, 0, NULL, NULL));
+
+    size_t seedGlobal = (size_t)satelliteCount;
+    CL_CHECK(clSetKernelArg(OCL_kernelJfaSeed, 3, sizeof(cl_mem), &OCL_bufJfaMap[0]));
+    CL_CHECK(clEnqueueNDRangeKernel(OCL_queue, OCL_kernelJfaSeed, 1, NULL, &seedGlobal, NULL, 0, NULL, NULL));
+
+    int current = 0;
+    jfaPass(current, 1, global, local);
+    current = 1 - current;
+    for (int step = JFA_FIRST_STEP; step >= 1; step /= 2) {
+        jfaPass(current, step, global, local);
+        current = 1 - current;
+    }
+    for (int step = 2; step >= 1; step /= 2) {
+        jfaPass(current, step, global, local);
+        current = 1 - current;
+    }
+    return OCL_bufJfaMap[current];
+}
+
+// Enqueues the shading of one frame into pixel buffer 'slot' and its
+// readback on the transfer queue, in 'bands' horizontal bands: every band
+// is shaded by a launch with a global offset, and read back as soon as its
+// launch completes while the next band is shaded. OCL_pixelsRead[slot] is
+// then the last band's readback, which the in-order transfer queue
+// completes after all the others. With --zero-copy the buffer is mapped
+// once the last band is shaded instead.
+static void enqueueFrame(int slot, int mx, int my, int bands) {
+
+    // satellite positions are already on the device, written by the physics kernel
+
+    // global dims rounded up to multiples of WG; a shade work-group covers
+    // OCL_pixelsPerItem times its width
+    size_t wgX = renderMode == RENDER_BOUNDS ? BOUNDS_TILE : OCL_wgSizeX;
+    size_t wgY = renderMode == RENDER_BOUNDS ? BOUNDS_TILE : OCL_wgSizeY;
+    size_t span = wgX * (renderMode == RENDER_FULL ? OCL_pixelsPerItem : 1);
+    size_t local[2] = { wgX, wgY };
+    size_t g0 = ((size_t)WINDOW_WIDTH + span - 1) / span * wgX;
+    size_t g1 = ((size_t)WINDOW_HEIGHT + wgY - 1) / wgY * wgY;
     size_t global[2] = { g0, g1 };
 
-    // launch
-    CL_CHECK(clEnqueueNDRangeKernel(OCL_queue, OCL_kernel, 2, NULL, global, local, 0, NULL, NULL));
-    CL_CHECK(clFinish(OCL_queue));
+    // shade, shade_bounds and shade_jfa take the same first arguments
+    cl_kernel kernel = OCL_kernel;
+    if (renderMode == RENDER_BOUNDS) kernel = OCL_kernelShadeBounds;
+    if (renderMode == RENDER_JFA) kernel = OCL_kernelShadeJfa;
+
+    // per-frame kernel args, init() set the others
+    CL_CHECK(clSetKernelArg(kernel, 0, sizeof(cl_mem), &OCL_bufPixels[slot]));
+    CL_CHECK(clSetKernelArg(kernel, 11, sizeof(mx), &mx));
+    CL_CHECK(clSetKernelArg(kernel, 12, sizeof(my), &my));
+    if (renderMode == RENDER_JFA) {
+        cl_mem map = jfaNearestMap(global, local);
+        CL_CHECK(clSetKernelArg(kernel, 13, sizeof(cl_mem), &map));
+    }
+
+    // bands are whole rows of work-groups
+    const int groupRows = (int)(g1 / wgY);
+    if (bands > groupRows) bands = groupRows;
+
+    if (OCL_mappedPixels[slot]) {
+        CL_CHECK(clEnqueueUnmapMemObject(OCL_queue, OCL_bufPixels[slot], OCL_mappedPixels[slot], 0, NULL, NULL));
+        OCL_mappedPixels[slot] = NULL;
+    }
+
+    // the first band waits until the buffer's previous frame has been read back
+    cl_event previous = OCL_pixelsRead[slot];
+    OCL_pixelsRead[slot] = NULL;
+    for (int band = 0; band < bands; ++band) {
+        size_t y0 = (size_t)(groupRows * band / bands) * wgY;
+        size_t y1 = (size_t)(groupRows * (band + 1) / bands) * wgY;
+        size_t offset[2] = { 0, y0 };
+        size_t bandGlobal[2] = { g0, y1 - y0 };
+        cl_uint waits = band == 0 && previous ? 1 : 0;
+        cl_event shaded;
+        CL_CHECK(clEnqueueNDRangeKernel(OCL_queue, kernel, 2, offset, bandGlobal, local,
+            waits, waits ? &previous : NULL, &shaded));
+
+        if (y1 > WINDOW_HEIGHT) y1 = WINDOW_HEIGHT;
+        size_t rowBytes = sizeof(unsigned char) * 4 * WINDOW_WIDTH;
+        if (zeroCopy) {
+            if (band == bands - 1) {
+                cl_int err;
+                OCL_mappedPixels[slot] = (color_u8*)clEnqueueMapBuffer(OCL_queueTransfer, OCL_bufPixels[slot], CL_FALSE,
+                    CL_MAP_READ, 0, sizeof(unsigned char) * 4 * SIZE, 1, &shaded, &OCL_pixelsRead[slot], &err);
+                CL_CHECK(err);
+            }
+        } else {
+            if (OCL_pixelsRead[slot]) clReleaseEvent(OCL_pixelsRead[slot]);
+            CL_CHECK(clEnqueueReadBuffer(OCL_queueTransfer, OCL_bufPixels[slot], CL_FALSE, y0 * rowBytes, (y1 - y0) * rowBytes,
+                OCL_hostPixels[slot] + y0 * WINDOW_WIDTH, 1, &shaded, &OCL_pixelsRead[slot]));
+        }
+        clReleaseEvent(shaded);
+    }
+    if (previous) clReleaseEvent(previous);
+    CL_CHECK(clFlush(OCL_queue));
+    CL_CHECK(clFlush(OCL_queueTransfer));
+}
+
+// --band-benchmark: latency of shading and reading back one frame for
+// 1, 2, 4, ... bands, each averaged over BAND_BENCHMARK_FRAMES frames
+static void bandBenchmark(void) {
+    const int groupRows = (int)(WINDOW_HEIGHT / (renderMode == RENDER_BOUNDS ? BOUNDS_TILE : OCL_wgSizeY));
+    printf("Banded readback, shade + readback latency per frame:\n");
+    for (int bands = 1; bands <= groupRows; bands *= 2) {
+        enqueueFrame(0, WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2, bands); // warm-up
+        CL_CHECK(clWaitForEvents(1, &OCL_pixelsRead[0]));
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int f = 0; f < BAND_BENCHMARK_FRAMES; ++f) {
+            enqueueFrame(0, WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2, bands);
+            CL_CHECK(clWaitForEvents(1, &OCL_pixelsRead[0]));
+        }
+        double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        printf("  %2d bands: %.3f ms\n", bands, seconds * 1e3 / BAND_BENCHMARK_FRAMES);
+    }
+}
+
+////////////////////////////////////////////////
+//   ¤¤      WORK-GROUP TUNING        ¤¤      //
+////////////////////////////////////////////////
+// Every line of TUNING_FILE is
+//   <device>|<driver version>|<kernel>|<width>x<height><TAB><x> <y> <pixels per work-item> <ms per frame>
+
+// Sets the shade work-group shape and the shade kernel's pixels per work-item
+static void OCL_setWorkGroup(size_t x, size_t y, int perItem) {
+    OCL_wgSizeX = x;
+    OCL_wgSizeY = y;
+    OCL_pixelsPerItem = perItem;
+    CL_CHECK(clSetKernelArg(OCL_kernel, 13, sizeof(perItem), &perItem));
+}
+
+static void OCL_tuningKey(const char* kernelName, char* key, size_t keySize) {
+    char device[256] = { 0 };
+    char driver[256] = { 0 };
+    clGetDeviceInfo(OCL_device, CL_DEVICE_NAME, sizeof(device), device, NULL);
+    clGetDeviceInfo(OCL_device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+    snprintf(key, keySize, "%s|%s|%s|%dx%d", device, driver, kernelName, WINDOW_WIDTH, WINDOW_HEIGHT);
+}
+
+// Reads the stored shape for 'key', returns 0 if there is none
+static int OCL_loadTuning(const char* key, size_t* x, size_t* y, int* perItem) {
+    FILE* f = fopen(TUNING_FILE, "r");
+    if (!f) return 0;
+    char line[1024];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), f)) {
+        char* tab = strrchr(line, '\t');
+        unsigned int tx, ty;
+        int tp;
+        if (!tab) continue;
+        *tab = '\0';
+        if (strcmp(line, key) == 0 && sscanf(tab + 1, "%u %u %d", &tx, &ty, &tp) == 3) {
+            *x = tx;
+            *y = ty;
+            *perItem = tp;
+            found = 1;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// Replaces the line of 'key' in the tuning file, or appends one
+static void OCL_storeTuning(const char* key, size_t x, size_t y, int perItem, double ms) {
+    char* kept = NULL;
+    size_t keptLen = 0;
+    const size_t keyLen = strlen(key);
+    FILE* f = fopen(TUNING_FILE, "r");
+    if (f) {
+        char line[1024];
+        while (fgets(line, sizeof(line), f)) {
+            const char* tab = strrchr(line, '\t');
+            size_t n = strlen(line);
+            if (tab && (size_t)(tab - line) == keyLen && strncmp(line, key, keyLen) == 0) continue;
+            kept = (char*)realloc(kept, keptLen + n);
+            memcpy(kept + keptLen, line, n);
+            keptLen += n;
+        }
+        fclose(f);
+    }
+    f = fopen(TUNING_FILE, "w");
+    if (!f) {
+        fprintf(stderr, "Could not write %s\n", TUNING_FILE);
+        free(kept);
+        return;
+    }
+    if (keptLen) fwrite(kept, 1, keptLen, f);
+    fprintf(f, "%s\t%u %u %d %.3f\n", key, (unsigned int)x, (unsigned int)y, perItem, ms);
+    fclose(f);
+    free(kept);
+}
+
+// Whether the device can launch the shape: within the kernels' work-group
+// size and the device's per-dimension limits, and at most one work-group
+// wide in pixels
+static int OCL_workGroupLegal(size_t x, size_t y, int perItem, size_t maxGroup, const size_t* maxItems) {
+    return x * y <= maxGroup && x <= maxItems[0] && y <= maxItems[1] &&
+        perItem >= 1 && perItem <= AUTOTUNE_MAX_PIXELS && x * perItem <= WINDOW_WIDTH && y <= WINDOW_HEIGHT &&
+        (perItem == 1 || renderMode == RENDER_FULL);
+}
 
-    CL_CHECK(clEnqueueReadBuffer(OCL_queue, OCL_bufPixels, CL_TRUE, 0, sizeof(unsigned char) * 4 * SIZE, pixels, 0, NULL, NULL));
+// --autotune: times one frame (shading and readback, the best of
+// AUTOTUNE_FRAMES) for power of two shapes of at least 16 work-items and
+// returns the fastest
+static double autotuneWorkGroup(const char* kernelName, size_t maxGroup, const size_t* maxItems,
+    size_t* bestX, size_t* bestY, int* bestPerItem) {
+    const int maxPerItem = renderMode == RENDER_FULL ? AUTOTUNE_MAX_PIXELS : 1;
+    double bestMs = INFINITY;
+    printf("Autotuning %s work-groups, best of %d frames:\n", kernelName, AUTOTUNE_FRAMES);
+    for (size_t x = 1; x <= 256; x *= 2) {
+        for (size_t y = 1; y <= 64; y *= 2) {
+            for (int perItem = 1; perItem <= maxPerItem; perItem *= 2) {
+                if (x * y < 16 || !OCL_workGroupLegal(x, y, perItem, maxGroup, maxItems)) continue;
+                OCL_setWorkGroup(x, y, perItem);
+                enqueueFrame(0, WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2, 1); // warm-up
+                CL_CHECK(clWaitForEvents(1, &OCL_pixelsRead[0]));
+                double ms = INFINITY;
+                for (int f = 0; f < AUTOTUNE_FRAMES; ++f) {
+                    Uint64 start = SDL_GetPerformanceCounter();
+                    enqueueFrame(0, WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2, 1);
+                    CL_CHECK(clWaitForEvents(1, &OCL_pixelsRead[0]));
+                    double frameMs = (double)(SDL_GetPerformanceCounter() - start) * 1e3 / SDL_GetPerformanceFrequency();
+                    if (frameMs < ms) ms = frameMs;
+                }
+                printf("  %3zu x %2zu, %d pixels per work-item: %.3f ms\n", x, y, perItem, ms);
+                if (ms < bestMs) {
+                    bestMs = ms;
+                    *bestX = x;
+                    *bestY = y;
+                    *bestPerItem = perItem;
+                }
+            }
+        }
+    }
+    return bestMs;
+}
+
+// Picks the shade work-group shape: autotuned with --autotune, else the
+// stored one for this device, else 32 x 32 halved until the device
+// accepts it. --render=bounds always uses BOUNDS_TILE x BOUNDS_TILE.
+static void selectWorkGroup(void) {
+    if (renderMode == RENDER_BOUNDS) {
+        OCL_setWorkGroup(BOUNDS_TILE, BOUNDS_TILE, 1);
+        printf("Work-group: %d x %d, fixed by --render=bounds\n", BOUNDS_TILE, BOUNDS_TILE);
+        return;
+    }
+
+    // the jump flooding passes run with the same shape as shade_jfa
+    cl_kernel kernel = renderMode == RENDER_JFA ? OCL_kernelShadeJfa : OCL_kernel;
+    const char* kernelName = renderMode == RENDER_JFA ? "shade_jfa" : "shade";
+    size_t maxGroup = 0;
+    size_t maxItems[3] = { 0, 0, 0 };
+    clGetKernelWorkGroupInfo(kernel, OCL_device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(maxGroup), &maxGroup, NULL);
+    if (renderMode == RENDER_JFA) {
+        size_t stepGroup = 0;
+        clGetKernelWorkGroupInfo(OCL_kernelJfaStep, OCL_device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(stepGroup), &stepGroup, NULL);
+        if (stepGroup < maxGroup) maxGroup = stepGroup;
+    }
+    clGetDeviceInfo(OCL_device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItems), maxItems, NULL);
+
+    char key[1024];
+    OCL_tuningKey(kernelName, key, sizeof(key));
+    size_t x = OCL_wgSizeX;
+    size_t y = OCL_wgSizeY;
+    int perItem = 1;
+    const char* origin = "default";
+    if (autotuneMode) {
+        double ms = autotuneWorkGroup(kernelName, maxGroup, maxItems, &x, &y, &perItem);
+        if (ms < INFINITY) {
+            OCL_storeTuning(key, x, y, perItem, ms);
+            origin = "autotuned, stored in " TUNING_FILE;
+        }
+    } else if (OCL_loadTuning(key, &x, &y, &perItem) && OCL_workGroupLegal(x, y, perItem, maxGroup, maxItems)) {
+        origin = "tuned, from " TUNING_FILE;
+    } else {
+        x = OCL_wgSizeX;
+        y = OCL_wgSizeY;
+        perItem = 1;
+    }
+    while (!OCL_workGroupLegal(x, y, perItem, maxGroup, maxItems) && y > 1) y /= 2;
+    while (!OCL_workGroupLegal(x, y, perItem, maxGroup, maxItems) && x > 1) x /= 2;
+    OCL_setWorkGroup(x, y, perItem);
+    printf("Work-group: %zu x %zu, %d pixels per work-item (%s)\n", x, y, perItem, origin);
+}
+
+////////////////////////////////////////////////
+//   ¤¤      MULTI-DEVICE FRAMES      ¤¤      //
+////////////////////////////////////////////////
+// With --split-devices every frame is shaded in horizontal bands, one per
+// device. The --device device runs the physics and shades the top band;
+// every other device has a context, queue, program and buffers of its own
+// and gets the satellite positions through the host once the physics is
+// done: events cannot cross contexts, so the other devices' position
+// writes wait for a user event of their own, which a callback completes
+// when the positions have been read. The host never waits for the physics.
+// Each device reads its band back into the frame's host buffer. The other
+// devices' pixel buffers hold only their band (the shade kernel's first
+// row argument) and grow in steps of SPLIT_BUFFER_ROWS when a band
+// outgrows them.
+// When a frame is presented, the kernel times of its bands update every
+// device's rows per millisecond, and the next frame to be enqueued is split
+// in proportion to them.
+typedef struct {
+    int              index;       // in the device list printed at startup
+    cl_device_id     device;
+    cl_context       context;
+    cl_command_queue queue;       // shading, and the readback on the other devices
+    cl_command_queue transfer;    // readback
+    cl_program       program;
+    cl_kernel        kernel;      // shade
+    cl_mem           pixels;      // band, the other devices only
+    int              pixelRows;   // rows 'pixels' holds
+    cl_mem           posX, posY, idR, idG, idB;
+    cl_event         shaded[2];   // per pixel slot
+    cl_event         read[2];
+    cl_event         positions[2]; // user event, the positions of the slot are on the host
+    int              rows[2];     // rows of the band per pixel slot
+    int              y0, y1;      // band of the next frame
+    double           rate;        // rows per millisecond
+    int              measured;
+} splitdevice;
+static splitdevice OCL_split[OCL_MAX_DEVICES];
+#define SPLIT_BUFFER_ROWS 64
+static float*      OCL_splitPosX[2] = { NULL, NULL };  // positions for the other devices, per pixel slot
+static float*      OCL_splitPosY[2] = { NULL, NULL };
+
+// Splits the rows between the devices in proportion to their rates, in
+// whole work-group rows of the first device and at least one each. The
+// last band may reach past the window.
+static void splitAssign(void) {
+    const int quantum = (int)OCL_wgSizeY;
+    const int groups = (WINDOW_HEIGHT + quantum - 1) / quantum;
+    double total = 0.0;
+    for (int d = 0; d < OCL_splitCount; ++d) {
+        total += OCL_split[d].rate;
+    }
+    double sum = 0.0;
+    int start = 0;
+    for (int d = 0; d < OCL_splitCount; ++d) {
+        sum += OCL_split[d].rate;
+        int end = d == OCL_splitCount - 1 ? groups : (int)(groups * sum / total + 0.5);
+        if (end < start + 1) end = start + 1;
+        if (end > groups - (OCL_splitCount - 1 - d)) end = groups - (OCL_splitCount - 1 - d);
+        OCL_split[d].y0 = start * quantum;
+        OCL_split[d].y1 = end * quantum;
+        start = end;
+    }
+}
+
+// Sets up the devices of --split-devices, the --device device first
+static void splitInit(const char* source, size_t sourceLen, const char* options) {
+    if (!splitPolicy) return;
+    if (renderMode != RENDER_FULL) {
+        printf("--split-devices needs --render=full, shading on one device\n");
+        return;
+    }
+
+    int indices[OCL_MAX_DEVICES];
+    int count = 0;
+    indices[count++] = OCL_deviceIndex;
+    if (strcmp(splitPolicy, "all") == 0) {
+        for (int d = 0; d < OCL_deviceCount; ++d) {
+            if (d != OCL_deviceIndex) indices[count++] = d;
+        }
+    } else {
+        // parseOption() accepted only digits and commas
+        const char* p = splitPolicy;
+        while (*p) {
+            if (*p == ',') {
+                ++p;
+                continue;
+            }
+            char* end = NULL;
+            long index = strtol(p, &end, 10);
+            if (index < 0 || index >= OCL_deviceCount) {
+                fprintf(stderr, "No OpenCL device [%ld] for --split-devices=%s\n", index, splitPolicy);
+                exit(1);
+            }
+            int listed = 0;
+            for (int d = 0; d < count; ++d) {
+                listed |= indices[d] == index;
+            }
+            if (!listed) indices[count++] = (int)index;
+            p = end;
+        }
+    }
+    const int groups = (WINDOW_HEIGHT + (int)OCL_wgSizeY - 1) / (int)OCL_wgSizeY;
+    if (count > groups) count = groups;
+    if (count < 2) {
+        printf("--split-devices: no other device, shading on one device\n");
+        return;
+    }
+
+    cl_int err;
+    const size_t posBytes = satelliteCount * sizeof(float);
+    for (int s = 0; s < 2; ++s) {
+        OCL_splitPosX[s] = (float*)malloc(posBytes);
+        OCL_splitPosY[s] = (float*)malloc(posBytes);
+    }
+    for (int d = 0; d < count; ++d) {
+        splitdevice* dev = &OCL_split[d];
+        dev->index = indices[d];
+        dev->device = OCL_devices[indices[d]];
+        dev->rate = 1.0;
+        if (d == 0) {
+            dev->context = OCL_context;
+            dev->queue = OCL_queue;
+            dev->transfer = OCL_queueTransfer;
+            dev->program = OCL_program;
+            dev->posX = OCL_bufPosX;
+            dev->posY = OCL_bufPosY;
+            dev->idR = OCL_bufIdR;
+            dev->idG = OCL_bufIdG;
+            dev->idB = OCL_bufIdB;
+        } else {
+            const cl_queue_properties props[] = { CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0 };
+            int cached = 0;
+            dev->context = clCreateContext(NULL, 1, &dev->device, NULL, NULL, &err); CL_CHECK(err);
+            dev->queue = clCreateCommandQueueWithProperties(dev->context, dev->device, props, &err); CL_CHECK(err);
+            dev->transfer = dev->queue;
+            dev->program = OCL_buildProgram(dev->context, dev->device, source, sourceLen, options, &cached);
+            dev->posX = clCreateBuffer(dev->context, CL_MEM_READ_ONLY, posBytes, NULL, &err); CL_CHECK(err);
+            dev->posY = clCreateBuffer(dev->context, CL_MEM_READ_ONLY, posBytes, NULL, &err); CL_CHECK(err);
+            dev->idR = clCreateBuffer(dev->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, posBytes, satellites.red, &err); CL_CHECK(err);
+            dev->idG = clCreateBuffer(dev->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, posBytes, satellites.green, &err); CL_CHECK(err);
+            dev->idB = clCreateBuffer(dev->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, posBytes, satellites.blue, &err); CL_CHECK(err);
+        }
+
+        // an own shade kernel object; the others take one pixel per
+        // work-item and leave the work-group size to their runtime
+        float bh_r2 = BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS;
+        float sat_r2 = SATELLITE_RADIUS * SATELLITE_RADIUS;
+        int   width = WINDOW_WIDTH;
+        int   height = WINDOW_HEIGHT;
+        int   perItem = d == 0 ? OCL_pixelsPerItem : 1;
+        int   firstRow = 0;
+        dev->kernel = clCreateKernel(dev->program, "shade", &err); CL_CHECK(err);
+        CL_CHECK(clSetKernelArg(dev->kernel, 1, sizeof(cl_mem), &dev->posX));
+        CL_CHECK(clSetKernelArg(dev->kernel, 2, sizeof(cl_mem), &dev->posY));
+        CL_CHECK(clSetKernelArg(dev->kernel, 3, sizeof(cl_mem), &dev->idR));
+        CL_CHECK(clSetKernelArg(dev->kernel, 4, sizeof(cl_mem), &dev->idG));
+        CL_CHECK(clSetKernelArg(dev->kernel, 5, sizeof(cl_mem), &dev->idB));
+        CL_CHECK(clSetKernelArg(dev->kernel, 6, sizeof(satelliteCount), &satelliteCount));
+        CL_CHECK(clSetKernelArg(dev->kernel, 7, sizeof(width), &width));
+        CL_CHECK(clSetKernelArg(dev->kernel, 8, sizeof(height), &height));
+        CL_CHECK(clSetKernelArg(dev->kernel, 9, sizeof(bh_r2), &bh_r2));
+        CL_CHECK(clSetKernelArg(dev->kernel, 10, sizeof(sat_r2), &sat_r2));
+        CL_CHECK(clSetKernelArg(dev->kernel, 13, sizeof(perItem), &perItem));
+        CL_CHECK(clSetKernelArg(dev->kernel, 14, sizeof(firstRow), &firstRow));
+
+        char name[256] = { 0 };
+        clGetDeviceInfo(dev->device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+        printf("Split device [%d] %s\n", dev->index, name);
+    }
+    OCL_splitCount = count;
+    splitAssign();
+}
+
+// Completes the other devices' position events of pixel slot 'slot' once
+// its positions are on the host, or fails them with the read's error.
+// Runs on a thread of the OpenCL runtime.
+static void CL_CALLBACK splitPositionsRead(cl_event event, cl_int status, void* slot) {
+    const int s = (int)(size_t)slot;
+    for (int d = 1; d < OCL_splitCount; ++d) {
+        clSetUserEventStatus(OCL_split[d].positions[s], status);
+    }
+    clReleaseEvent(event);
+}
+
+// Makes the pixel buffer of 'dev' hold at least 'rows' rows. Commands still
+// queued on a replaced buffer keep it alive until they finish.
+static void splitReserveRows(splitdevice* dev, int rows) {
+    if (dev->pixels && rows <= dev->pixelRows) return;
+    cl_int err;
+    int capacity = (rows + SPLIT_BUFFER_ROWS - 1) / SPLIT_BUFFER_ROWS * SPLIT_BUFFER_ROWS;
+    if (capacity > WINDOW_HEIGHT) capacity = WINDOW_HEIGHT;
+    if (dev->pixels) clReleaseMemObject(dev->pixels);
+    dev->pixels = clCreateBuffer(dev->context, CL_MEM_WRITE_ONLY,
+        sizeof(unsigned char) * 4 * WINDOW_WIDTH * capacity, NULL, &err);
+    CL_CHECK(err);
+    dev->pixelRows = capacity;
+}
+
+// Enqueues the bands of one frame into pixel slot 'slot' on all devices
+static void splitFrame(int slot, int mx, int my) {
+    const size_t rowBytes = sizeof(unsigned char) * 4 * WINDOW_WIDTH;
+    const size_t posBytes = satelliteCount * sizeof(float);
+    cl_int err;
+
+    // positions for the other devices, read once the physics is done
+    cl_event posRead;
+    CL_CHECK(clEnqueueReadBuffer(OCL_queue, OCL_bufPosX, CL_FALSE, 0, posBytes, OCL_splitPosX[slot], 0, NULL, NULL));
+    CL_CHECK(clEnqueueReadBuffer(OCL_queue, OCL_bufPosY, CL_FALSE, 0, posBytes, OCL_splitPosY[slot], 0, NULL, &posRead));
+
+    for (int d = 0; d < OCL_splitCount; ++d) {
+        splitdevice* dev = &OCL_split[d];
+        const int y0 = dev->y0;
+        const int y1 = dev->y1 < WINDOW_HEIGHT ? dev->y1 : WINDOW_HEIGHT;
+        if (d > 0) splitReserveRows(dev, y1 - y0);
+        cl_mem target = d == 0 ? OCL_bufPixels[slot] : dev->pixels;
+        size_t offset[2] = { 0, (size_t)y0 };
+        cl_event previous = dev->read[slot];
+        if (dev->shaded[slot]) clReleaseEvent(dev->shaded[slot]);
+
+        if (d == 0) {
+            // the first band waits until the buffer's previous frame has been read back
+            size_t span = OCL_wgSizeX * OCL_pixelsPerItem;
+            size_t local[2] = { OCL_wgSizeX, OCL_wgSizeY };
+            size_t global[2] = { ((size_t)WINDOW_WIDTH + span - 1) / span * OCL_wgSizeX, (size_t)(dev->y1 - y0) };
+            CL_CHECK(clSetKernelArg(dev->kernel, 0, sizeof(cl_mem), &target));
+            CL_CHECK(clSetKernelArg(dev->kernel, 11, sizeof(mx), &mx));
+            CL_CHECK(clSetKernelArg(dev->kernel, 12, sizeof(my), &my));
+            CL_CHECK(clEnqueueNDRangeKernel(dev->queue, dev->kernel, 2, offset, global, local,
+                previous ? 1 : 0, previous ? &previous : NULL, &dev->shaded[slot]));
+        } else {
+            size_t global[2] = { WINDOW_WIDTH, (size_t)(y1 - y0) };
+            if (dev->positions[slot]) clReleaseEvent(dev->positions[slot]);
+            dev->positions[slot] = clCreateUserEvent(dev->context, &err);
+            CL_CHECK(err);
+            CL_CHECK(clEnqueueWriteBuffer(dev->queue, dev->posX, CL_FALSE, 0, posBytes, OCL_splitPosX[slot], 1, &dev->positions[slot], NULL));
+            CL_CHECK(clEnqueueWriteBuffer(dev->queue, dev->posY, CL_FALSE, 0, posBytes, OCL_splitPosY[slot], 0, NULL, NULL));
+            CL_CHECK(clSetKernelArg(dev->kernel, 0, sizeof(cl_mem), &target));
+            CL_CHECK(clSetKernelArg(dev->kernel, 11, sizeof(mx), &mx));
+            CL_CHECK(clSetKernelArg(dev->kernel, 12, sizeof(my), &my));
+            CL_CHECK(clSetKernelArg(dev->kernel, 14, sizeof(y0), &y0));
+            CL_CHECK(clEnqueueNDRangeKernel(dev->queue, dev->kernel, 2, offset, global, NULL, 0, NULL, &dev->shaded[slot]));
+        }
+        // the first device's buffer holds the whole frame, the others' only the band
+        size_t source = d == 0 ? y0 * rowBytes : 0;
+        CL_CHECK(clEnqueueReadBuffer(dev->transfer, target, CL_FALSE, source, (y1 - y0) * rowBytes,
+            OCL_hostPixels[slot] + y0 * WINDOW_WIDTH, 1, &dev->shaded[slot], &dev->read[slot]));
+        if (previous) clReleaseEvent(previous);
+        dev->rows[slot] = y1 - y0;
+        CL_CHECK(clFlush(dev->queue));
+        CL_CHECK(clFlush(dev->transfer));
+    }
+
+    // the callback may run at once, so it is set when all position events exist
+    CL_CHECK(clSetEventCallback(posRead, CL_COMPLETE, splitPositionsRead, (void*)(size_t)slot));
+}
+
+// Waits for all bands of the frame in pixel slot 'present', then updates
+// the devices' rates from the kernel times of its bands and splits the
+// next frame by them
+static void splitPresent(int present) {
+    printf("Split:");
+    for (int d = 0; d < OCL_splitCount; ++d) {
+        splitdevice* dev = &OCL_split[d];
+        cl_ulong start = 0, end = 0;
+        CL_CHECK(clWaitForEvents(1, &dev->read[present]));
+        clGetEventProfilingInfo(dev->shaded[present], CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+        clGetEventProfilingInfo(dev->shaded[present], CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+        double ms = (double)(end - start) * 1e-6;
+        if (ms > 0.0) {
+            double rate = dev->rows[present] / ms;
+            dev->rate = dev->measured ? SPLIT_SMOOTHING * rate + (1.0 - SPLIT_SMOOTHING) * dev->rate : rate;
+            dev->measured = 1;
+        }
+        printf(" [%d] %d rows %.3f ms", dev->index, dev->rows[present], ms);
+    }
+    printf("\n");
+    splitAssign();
+}
+
+static void splitDestroy(void) {
+    for (int d = 0; d < OCL_splitCount; ++d) {
+        splitdevice* dev = &OCL_split[d];
+        if (d > 0) clFinish(dev->queue);
+        for (int s = 0; s < 2; ++s) {
+            if (dev->shaded[s]) clReleaseEvent(dev->shaded[s]);
+            if (dev->read[s])   clReleaseEvent(dev->read[s]);
+            if (dev->positions[s]) clReleaseEvent(dev->positions[s]);
+        }
+        if (dev->kernel) clReleaseKernel(dev->kernel);
+        if (d == 0) continue; // the --device device's objects are released by destroy()
+        if (dev->pixels) clReleaseMemObject(dev->pixels);
+        clReleaseMemObject(dev->posX);
+        clReleaseMemObject(dev->posY);
+        clReleaseMemObject(dev->idR);
+        clReleaseMemObject(dev->idG);
+        clReleaseMemObject(dev->idB);
+        clReleaseProgram(dev->program);
+        clReleaseCommandQueue(dev->queue);
+        clReleaseContext(dev->context);
+    }
+    for (int s = 0; s < 2; ++s) {
+        free(OCL_splitPosX[s]);
+        free(OCL_splitPosY[s]);
+    }
+    OCL_splitCount = 0;
+}
+
+void parallelGraphicsEngine(void) {
+
+    const int slot = OCL_pixelSlot;
+    if (OCL_splitCount) {
+        splitFrame(slot, mousePosX, mousePosY);
+    } else {
+        enqueueFrame(slot, mousePosX, mousePosY, readbackBands);
+    }
+
+    // The host waits only for the frame render() presents next: the previous
+    // one, or this one in the first frames, which compute() checks against
+    // sequentialGraphicsEngine
+    int present = frameNumber < 2 ? slot : 1 - slot;
+    if (OCL_splitCount) {
+        splitPresent(present);
+    } else if (OCL_pixelsRead[present]) {
+        CL_CHECK(clWaitForEvents(1, &OCL_pixelsRead[present]));
+    }
+    pixels = zeroCopy ? OCL_mappedPixels[present] : OCL_hostPixels[present];
+    if (nbodyMode) {
+        nbodyReport(present);
+    }
+    OCL_pixelSlot = 1 - slot;
 }
 
 
@@ -533,15 +1902,55 @@ void parallelGraphicsEngine(void) {
 
 // ## You may add your own destrcution routines here ##
 void destroy() {
-    if (OCL_bufPixels) clReleaseMemObject(OCL_bufPixels);
+    if (OCL_queue)         clFinish(OCL_queue);
+    if (OCL_queueTransfer) clFinish(OCL_queueTransfer);
+    splitDestroy();
+    for (int b = 0; b < 2; ++b) {
+        if (OCL_mappedPixels[b]) {
+            clEnqueueUnmapMemObject(OCL_queue, OCL_bufPixels[b], OCL_mappedPixels[b], 0, NULL, NULL);
+            clFinish(OCL_queue);
+        }
+        if (OCL_pixelsRead[b])     clReleaseEvent(OCL_pixelsRead[b]);
+        if (OCL_nbodyEvents[b][0]) clReleaseEvent(OCL_nbodyEvents[b][0]);
+        if (OCL_nbodyEvents[b][1]) clReleaseEvent(OCL_nbodyEvents[b][1]);
+        if (OCL_bufPixels[b])      clReleaseMemObject(OCL_bufPixels[b]);
+    }
+    // fixedDestroy() frees 'pixels'
+    if (OCL_hostPixels[0]) {
+        pixels = OCL_hostPixels[0];
+        free(OCL_hostPixels[1]);
+    }
     if (OCL_bufPosX)   clReleaseMemObject(OCL_bufPosX);
     if (OCL_bufPosY)   clReleaseMemObject(OCL_bufPosY);
+    if (OCL_bufVelX)   clReleaseMemObject(OCL_bufVelX);
+    if (OCL_bufVelY)   clReleaseMemObject(OCL_bufVelY);
     if (OCL_bufIdR)    clReleaseMemObject(OCL_bufIdR);
     if (OCL_bufIdG)    clReleaseMemObject(OCL_bufIdG);
     if (OCL_bufIdB)    clReleaseMemObject(OCL_bufIdB);
+    if (OCL_bufNbodyX)  clReleaseMemObject(OCL_bufNbodyX);
+    if (OCL_bufNbodyY)  clReleaseMemObject(OCL_bufNbodyY);
+    if (OCL_bufNbodyVX) clReleaseMemObject(OCL_bufNbodyVX);
+    if (OCL_bufNbodyVY) clReleaseMemObject(OCL_bufNbodyVY);
+    if (OCL_bufNbodyAX) clReleaseMemObject(OCL_bufNbodyAX);
+    if (OCL_bufNbodyAY) clReleaseMemObject(OCL_bufNbodyAY);
+    if (OCL_bufMass)    clReleaseMemObject(OCL_bufMass);
+    if (OCL_bufJfaMap[0]) clReleaseMemObject(OCL_bufJfaMap[0]);
+    if (OCL_bufJfaMap[1]) clReleaseMemObject(OCL_bufJfaMap[1]);
+    if (OCL_bufJfaNext)   clReleaseMemObject(OCL_bufJfaNext);
     if (OCL_kernel)    clReleaseKernel(OCL_kernel);
+    if (OCL_kernelPhysics) clReleaseKernel(OCL_kernelPhysics);
+    if (OCL_kernelNbodyLoad)  clReleaseKernel(OCL_kernelNbodyLoad);
+    if (OCL_kernelNbodyStore) clReleaseKernel(OCL_kernelNbodyStore);
+    if (OCL_kernelNbodyDrift) clReleaseKernel(OCL_kernelNbodyDrift);
+    if (OCL_kernelNbodyForce) clReleaseKernel(OCL_kernelNbodyForce);
+    if (OCL_kernelShadeBounds) clReleaseKernel(OCL_kernelShadeBounds);
+    if (OCL_kernelJfaClear) clReleaseKernel(OCL_kernelJfaClear);
+    if (OCL_kernelJfaSeed)  clReleaseKernel(OCL_kernelJfaSeed);
+    if (OCL_kernelJfaStep)  clReleaseKernel(OCL_kernelJfaStep);
+    if (OCL_kernelShadeJfa) clReleaseKernel(OCL_kernelShadeJfa);
     if (OCL_program)   clReleaseProgram(OCL_program);
     if (OCL_queue)     clReleaseCommandQueue(OCL_queue);
+    if (OCL_queueTransfer) clReleaseCommandQueue(OCL_queueTransfer);
     if (OCL_context)   clReleaseContext(OCL_context);
 }
 
@@ -594,9 +2003,9 @@ void sequentialGraphicsEngine(){
       int hitsSatellite = 0;
 
       // First Graphics satellite loop: Find the closest satellite.
-      for(int j = 0; j < SATELLITE_COUNT; ++j){
-         floatvector difference = {.x = pixel.x - satellites[j].position.x,
-                                   .y = pixel.y - satellites[j].position.y};
+      for(int j = 0; j < satelliteCount; ++j){
+         floatvector difference = {.x = pixel.x - satellites.x[j],
+                                   .y = pixel.y - satellites.y[j]};
          float distance = sqrt(difference.x * difference.x +
                                difference.y * difference.y);
 
@@ -611,27 +2020,27 @@ void sequentialGraphicsEngine(){
             weights += weight;
             if(distance < shortestDistance){
                shortestDistance = distance;
-               renderColor = satellites[j].identifier;
+               renderColor = satelliteColor(&satellites, j);
             }
          }
       }
 
       // Second graphics loop: Calculate the color based on distance to every satellite.
       if (!hitsSatellite) {
-         for(int j = 0; j < SATELLITE_COUNT; ++j){
-            floatvector difference = {.x = pixel.x - satellites[j].position.x,
-                                      .y = pixel.y - satellites[j].position.y};
+         for(int j = 0; j < satelliteCount; ++j){
+            floatvector difference = {.x = pixel.x - satellites.x[j],
+                                      .y = pixel.y - satellites.y[j]};
             float dist2 = (difference.x * difference.x +
                            difference.y * difference.y);
             float weight = 1.0f/(dist2* dist2);
 
-            renderColor.red += (satellites[j].identifier.red *
+            renderColor.red += (satellites.red[j] *
                                 weight /weights) * 3.0f;
 
-            renderColor.green += (satellites[j].identifier.green *
+            renderColor.green += (satellites.green[j] *
                                   weight / weights) * 3.0f;
 
-            renderColor.blue += (satellites[j].identifier.blue *
+            renderColor.blue += (satellites.blue[j] *
                                  weight / weights) * 3.0f;
          }
       }
@@ -641,18 +2050,18 @@ void sequentialGraphicsEngine(){
     }
 }
 
-void sequentialPhysicsEngine(satellite *s){
+void sequentialPhysicsEngine(satellitestore *s){
 
    // double precision required for accumulation inside this routine,
    // but float storage is ok outside these loops.
-   doublevector tmpPosition[SATELLITE_COUNT];
-   doublevector tmpVelocity[SATELLITE_COUNT];
-
-   for (int i = 0; i < SATELLITE_COUNT; ++i) {
-       tmpPosition[i].x = s[i].position.x;
-       tmpPosition[i].y = s[i].position.y;
-       tmpVelocity[i].x = s[i].velocity.x;
-       tmpVelocity[i].y = s[i].velocity.y;
+   doublevector* tmpPosition = (doublevector*)alignedMalloc(sizeof(doublevector) * satelliteCount);
+   doublevector* tmpVelocity = (doublevector*)alignedMalloc(sizeof(doublevector) * satelliteCount);
+
+   for (int i = 0; i < satelliteCount; ++i) {
+       tmpPosition[i].x = s->x[i];
+       tmpPosition[i].y = s->y[i];
+       tmpVelocity[i].x = s->vx[i];
+       tmpVelocity[i].y = s->vy[i];
    }
 
    // Physics iteration loop
@@ -661,7 +2070,7 @@ void sequentialPhysicsEngine(satellite *s){
       ++physicsUpdateIndex){
 
        // Physics satellite loop
-      for(int i = 0; i < SATELLITE_COUNT; ++i){
+      for(int i = 0; i < satelliteCount; ++i){
 
          // Distance to the blackhole
          // (bit ugly code because C-struct cannot have member functions)
@@ -696,12 +2105,15 @@ void sequentialPhysicsEngine(satellite *s){
    // double precision required for accumulation inside this routine,
    // but float storage is ok outside these loops.
    // copy back the float storage.
-   for (int i = 0; i < SATELLITE_COUNT; ++i) {
-       s[i].position.x = tmpPosition[i].x;
-       s[i].position.y = tmpPosition[i].y;
-       s[i].velocity.x = tmpVelocity[i].x;
-       s[i].velocity.y = tmpVelocity[i].y;
+   for (int i = 0; i < satelliteCount; ++i) {
+       s->x[i] = tmpPosition[i].x;
+       s->y[i] = tmpPosition[i].y;
+       s->vx[i] = tmpVelocity[i].x;
+       s->vy[i] = tmpVelocity[i].y;
    }
+
+   alignedFree(tmpPosition);
+   alignedFree(tmpVelocity);
 }
 
 // Just some value that barely passes for OpenCL example program
@@ -736,8 +2148,8 @@ void compute(void){
 
    // Error check during first frames
    if (frameNumber < 2) {
-      memcpy(backupSatelites, satellites, sizeof(satellite) * SATELLITE_COUNT);
-      sequentialPhysicsEngine(backupSatelites);
+      satelliteStoreCopy(&backupSatelites, &satellites);
+      sequentialPhysicsEngine(&backupSatelites);
       mousePosX = HORIZONTAL_CENTER;
       mousePosY = VERTICAL_CENTER;
    } else {
@@ -749,8 +2161,8 @@ void compute(void){
    }
    parallelPhysicsEngine();
    if (frameNumber < 2) {
-      for (int i = 0; i < SATELLITE_COUNT; i++) {
-         if (memcmp (&satellites[i], &backupSatelites[i], sizeof(satellite))) {
+      for (int i = 0; i < satelliteCount; i++) {
+         if (!satelliteStoreEqual(&satellites, &backupSatelites, i)) {
             printf("Incorrect satellite data of satellite: %d\n", i);
             getchar();
          }
@@ -811,14 +2223,14 @@ void fixedInit(unsigned int seed){
    // Init pixel buffer which is used for error checking
    correctPixels = (color_u8*)malloc(sizeof(color_u8) * SIZE);
 
-   backupSatelites = (satellite*)malloc(sizeof(satellite) * SATELLITE_COUNT);
+   satelliteStoreAlloc(&backupSatelites, satelliteCount);
 
 
    // Init satellites buffer which are moving in the space
-   satellites = (satellite*)malloc(sizeof(satellite) * SATELLITE_COUNT);
+   satelliteStoreAlloc(&satellites, satelliteCount);
 
    // Create random satellites
-   for(int i = 0; i < SATELLITE_COUNT; ++i){
+   for(int i = 0; i < satelliteCount; ++i){
 
       // Random reddish color
       color_f32 id = {.red = randomNumber(0.f, 0.15f) + 0.1f,
@@ -830,7 +2242,7 @@ void fixedInit(unsigned int seed){
                               .y = VERTICAL_CENTER - randomNumber(50, 320) };
       initialPosition.x = (i / 2 % 2 == 0) ?
          initialPosition.x : WINDOW_WIDTH - initialPosition.x;
-      initialPosition.y = (i < SATELLITE_COUNT / 2) ?
+      initialPosition.y = (i < satelliteCount / 2) ?
          initialPosition.y : WINDOW_HEIGHT - initialPosition.y;
 
       // Randomize velocity tangential to the balck hole
@@ -848,9 +2260,13 @@ void fixedInit(unsigned int seed){
          initialVelocity.y = -initialVelocity.y;
       }
 
-      satellite tmpSatelite = {.identifier = id, .position = initialPosition,
-                              .velocity = initialVelocity};
-      satellites[i] = tmpSatelite;
+      satellites.red[i] = id.red;
+      satellites.green[i] = id.green;
+      satellites.blue[i] = id.blue;
+      satellites.x[i] = initialPosition.x;
+      satellites.y[i] = initialPosition.y;
+      satellites.vx[i] = initialVelocity.x;
+      satellites.vy[i] = initialVelocity.y;
    }
 }
 
@@ -860,7 +2276,8 @@ void fixedDestroy(void){
 
    free(pixels);
    free(correctPixels);
-   free(satellites);
+   satelliteStoreFree(&satellites);
+   satelliteStoreFree(&backupSatelites);
 
    if(seed != 0){
      printf("Used seed: %i\n", seed);
@@ -882,10 +2299,19 @@ void render(void){
 // Inits render window and starts mainloop
 int main(int argc, char** argv){
 
-   if(argc > 1){
-     seed = atoi(argv[1]);
-     printf("Using seed: %i\n", seed);
+   // Usage: parallel [seed] [--option=value ...]
+   for(int a = 1; a < argc; ++a){
+     if(strncmp(argv[a], "--", 2) == 0){
+       if(!parseOption(argv[a])){
+         fprintf(stderr, "Unknown or invalid option: %s\n", argv[a]);
+         return 1;
+       }
+     } else {
+       seed = atoi(argv[a]);
+       printf("Using seed: %i\n", seed);
+     }
    }
+   printf("Satellite count: %d\n", satelliteCount);
 
    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_TIMER);
    win = SDL_CreateWindow(
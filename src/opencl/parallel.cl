@@ -6,32 +6,246 @@
                       Ashfak Nehal:         MdAshfakHaider.nehal@tuni.fi
 */
 
-__kernel void shade(
-    // --global makes mamory shared between multi threads to read/write
-    __global uchar4* k_out_pixels,        // a vector (1D Array) of 4 unsigned bytes (B, G, R, A)
-    __global const float* k_sat_pos_x,    // SoA Sat Pos X
-    __global const float* k_sat_pos_y,    // SoA Sat Pos Y
-    __global const float* k_id_r,         // SoA Sat R
-    __global const float* k_id_g,         // SoA Sat G
-    __global const float* k_id_b,         // SoA Sat B
-    const int             k_sat_count,    // SAT Count
-    const int             k_width,        // Image Size X
-    const int             k_height,       // Image Size Y
-    const float           k_bh_r2,        // BLACK_HOLE_RADIUS^2
-    const float           k_sat_r2,       // SATELLITE_RADIUS^2
+// DELTATIME, PHYSICSUPDATESPERFRAME, GRAVITY and NBODY_TILE come from the host as build options (-D).
+
+// Physics runs in double precision when the device supports it, like the
+// host engines. Devices without cl_khr_fp64 fall back to float, which is
+// less accurate and will not pass the bitwise check against the host.
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double real;
+#else
+typedef float real;
+#endif
+
+// The expressions below must round exactly like sequentialPhysicsEngine
+#pragma OPENCL FP_CONTRACT OFF
+
+// The shade kernels take the satellite count, the window size and the
+// squared radii as arguments. A specialized build defines them as
+// SHADE_SAT_COUNT, SHADE_WIDTH, SHADE_HEIGHT, SHADE_BH_R2 and SHADE_SAT_R2
+// instead, so the bounds of the loops and the constants are known to the
+// compiler and the satellite loops are unrolled. The arguments stay in the
+// signatures, so the host sets them the same way for both builds.
+#ifdef SHADE_SAT_COUNT
+#define K_SAT_COUNT SHADE_SAT_COUNT
+#define K_WIDTH SHADE_WIDTH
+#define K_HEIGHT SHADE_HEIGHT
+#define K_BH_R2 SHADE_BH_R2
+#define K_SAT_R2 SHADE_SAT_R2
+#define SHADE_UNROLL _Pragma("unroll 8")
+#else
+#define K_SAT_COUNT k_sat_count
+#define K_WIDTH k_width
+#define K_HEIGHT k_height
+#define K_BH_R2 k_bh_r2
+#define K_SAT_R2 k_sat_r2
+#define SHADE_UNROLL
+#endif
+
+// One work-item per satellite. Positions and velocities stay in device
+// buffers between frames; the shade kernel reads the positions directly.
+__kernel void physics(
+    __global float*       k_pos_x,        // SoA Sat Pos X (also read by shade)
+    __global float*       k_pos_y,        // SoA Sat Pos Y (also read by shade)
+    __global float*       k_vel_x,        // SoA Sat Velocity X
+    __global float*       k_vel_y,        // SoA Sat Velocity Y
+    const int             k_sat_count,    // SAT Count (including padding)
     const int             k_mouse_x,      // black hole center X
     const int             k_mouse_y)      // black hole center Y
 {
+    const int k_i = get_global_id(0);
+    if (k_i >= k_sat_count) return;
 
-    // each thread, shades one pixel with k_x and k_y:
-    const int   k_x = get_global_id(0); //global X index of a work-item
-    const int   k_y = get_global_id(1); //global Y index of a work-item
+    // float storage between frames, double accumulation inside
+    real k_x = k_pos_x[k_i];
+    real k_y = k_pos_y[k_i];
+    real k_vx = k_vel_x[k_i];
+    real k_vy = k_vel_y[k_i];
+
+    for (int k_step = 0; k_step < PHYSICSUPDATESPERFRAME; ++k_step) {
+        // Same expressions as sequentialPhysicsEngine
+        real k_dx = k_x - (real)k_mouse_x;
+        real k_dy = k_y - (real)k_mouse_y;
+        real k_d2 = k_dx * k_dx + k_dy * k_dy;
+        real k_dist = sqrt(k_d2);
+
+        real k_acc = (real)GRAVITY / k_d2;
+        k_vx -= k_acc * (k_dx / k_dist) * (real)DELTATIME / (real)PHYSICSUPDATESPERFRAME;
+        k_vy -= k_acc * (k_dy / k_dist) * (real)DELTATIME / (real)PHYSICSUPDATESPERFRAME;
+
+        k_x += k_vx * (real)DELTATIME / (real)PHYSICSUPDATESPERFRAME;
+        k_y += k_vy * (real)DELTATIME / (real)PHYSICSUPDATESPERFRAME;
+    }
+
+    k_pos_x[k_i] = (float)k_x;
+    k_pos_y[k_i] = (float)k_y;
+    k_vel_x[k_i] = (float)k_vx;
+    k_vel_y[k_i] = (float)k_vy;
+}
 
+// N-body mode: kick-drift-kick leapfrog under the black hole and the
+// satellites' mutual gravity. The all-pairs force needs every position of
+// the previous drift, so a step is split into nbody_drift and nbody_force
+// launches. The state is kept in 'real' precision buffers during a frame;
+// nbody_load and nbody_store convert from and to the float buffers that
+// the shade kernel and the host use.
+
+__kernel void nbody_load(
+    __global const float* k_pos_x,
+    __global const float* k_pos_y,
+    __global const float* k_vel_x,
+    __global const float* k_vel_y,
+    __global real*        k_nx,
+    __global real*        k_ny,
+    __global real*        k_nvx,
+    __global real*        k_nvy,
+    const int             k_sat_count)
+{
+    const int k_i = get_global_id(0);
+    if (k_i >= k_sat_count) return;
+    k_nx[k_i] = k_pos_x[k_i];
+    k_ny[k_i] = k_pos_y[k_i];
+    k_nvx[k_i] = k_vel_x[k_i];
+    k_nvy[k_i] = k_vel_y[k_i];
+}
+
+__kernel void nbody_store(
+    __global float*       k_pos_x,
+    __global float*       k_pos_y,
+    __global float*       k_vel_x,
+    __global float*       k_vel_y,
+    __global const real*  k_nx,
+    __global const real*  k_ny,
+    __global const real*  k_nvx,
+    __global const real*  k_nvy,
+    const int             k_sat_count)
+{
+    const int k_i = get_global_id(0);
+    if (k_i >= k_sat_count) return;
+    k_pos_x[k_i] = (float)k_nx[k_i];
+    k_pos_y[k_i] = (float)k_ny[k_i];
+    k_vel_x[k_i] = (float)k_nvx[k_i];
+    k_vel_y[k_i] = (float)k_nvy[k_i];
+}
+
+// Opening half kick and drift of a step
+__kernel void nbody_drift(
+    __global real*        k_nx,
+    __global real*        k_ny,
+    __global real*        k_nvx,
+    __global real*        k_nvy,
+    __global const real*  k_nax,
+    __global const real*  k_nay,
+    const int             k_sat_count,
+    const int             k_steps)        // steps per frame
+{
+    const int k_i = get_global_id(0);
+    if (k_i >= k_sat_count) return;
+    const real k_h = (real)DELTATIME / (real)k_steps;
+    k_nvx[k_i] += k_nax[k_i] * ((real)0.5 * k_h);
+    k_nvy[k_i] += k_nay[k_i] * ((real)0.5 * k_h);
+    k_nx[k_i] += k_nvx[k_i] * k_h;
+    k_ny[k_i] += k_nvy[k_i] * k_h;
+}
+
+// Accelerations at the current positions and the closing half kick (none
+// when k_kick is 0, which is used to start a frame). One work-item per
+// satellite; the work-group stages NBODY_TILE satellites at a time in local
+// memory, so each position is read from global memory once per work-group
+// instead of once per work-item. Satellite pairs are evaluated from both
+// sides, as sharing them between work-items would need atomics.
+__kernel __attribute__((reqd_work_group_size(NBODY_TILE, 1, 1)))
+void nbody_force(
+    __global const real*  k_nx,
+    __global const real*  k_ny,
+    __global real*        k_nvx,
+    __global real*        k_nvy,
+    __global real*        k_nax,
+    __global real*        k_nay,
+    __global const float* k_mass,         // satellite masses relative to the black hole
+    const int             k_sat_count,    // real satellites, the NDRange is rounded up to NBODY_TILE
+    const int             k_mouse_x,      // black hole center X
+    const int             k_mouse_y,      // black hole center Y
+    const float           k_softening,    // softening length in pixels
+    const int             k_steps,        // steps per frame
+    const int             k_kick)         // apply the closing half kick
+{
+    __local real k_tile_x[NBODY_TILE];
+    __local real k_tile_y[NBODY_TILE];
+    __local real k_tile_m[NBODY_TILE];
+
+    const int k_i = get_global_id(0);
+    const int k_l = get_local_id(0);
+    const int k_valid = k_i < k_sat_count;
+    const real k_eps2 = (real)k_softening * (real)k_softening;
+
+    real k_x = k_valid ? k_nx[k_i] : (real)0;
+    real k_y = k_valid ? k_ny[k_i] : (real)0;
+    real k_ax = 0, k_ay = 0;
+
+    for (int k_tile = 0; k_tile < k_sat_count; k_tile += NBODY_TILE) {
+        // every work-item loads one satellite of the tile, past the end zero mass
+        const int k_load = k_tile + k_l;
+        k_tile_x[k_l] = k_load < k_sat_count ? k_nx[k_load] : (real)0;
+        k_tile_y[k_l] = k_load < k_sat_count ? k_ny[k_load] : (real)0;
+        k_tile_m[k_l] = k_load < k_sat_count ? (real)k_mass[k_load] : (real)0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (int k_t = 0; k_t < NBODY_TILE; ++k_t) {
+            if (k_tile + k_t == k_i) continue;
+            real k_dx = k_tile_x[k_t] - k_x;
+            real k_dy = k_tile_y[k_t] - k_y;
+            real k_invd = (real)1 / sqrt(k_dx * k_dx + k_dy * k_dy + k_eps2);
+            real k_s = k_tile_m[k_t] * k_invd * k_invd * k_invd;
+            k_ax += k_dx * k_s;
+            k_ay += k_dy * k_s;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (!k_valid) return;
+
+    // black hole, as in the physics kernel
+    real k_dx = k_x - (real)k_mouse_x;
+    real k_dy = k_y - (real)k_mouse_y;
+    real k_invd = (real)1 / sqrt(k_dx * k_dx + k_dy * k_dy);
+    real k_bh = (real)GRAVITY * k_invd * k_invd * k_invd;
+    k_ax = (real)GRAVITY * k_ax - k_dx * k_bh;
+    k_ay = (real)GRAVITY * k_ay - k_dy * k_bh;
+
+    k_nax[k_i] = k_ax;
+    k_nay[k_i] = k_ay;
+    if (k_kick) {
+        const real k_h = (real)DELTATIME / (real)k_steps;
+        k_nvx[k_i] += k_ax * ((real)0.5 * k_h);
+        k_nvy[k_i] += k_ay * ((real)0.5 * k_h);
+    }
+}
+
+// Shades pixel (k_x, k_y), the body of the shade kernel
+void shade_pixel(
+    __global uchar4* k_out_pixels,
+    __global const float* k_sat_pos_x,
+    __global const float* k_sat_pos_y,
+    __global const float* k_id_r,
+    __global const float* k_id_g,
+    __global const float* k_id_b,
+    const int             k_sat_count,
+    const int             k_width,
+    const int             k_height,
+    const float           k_bh_r2,
+    const float           k_sat_r2,
+    const int             k_mouse_x,
+    const int             k_mouse_y,
+    const int             k_x,
+    const int             k_y,
+    const int             k_first_row)
+{
     // as we round up the window to wg size in .c , now some threads are outside the window, so must be exited.
-    if (k_x >= k_width || k_y >= k_height) return;
+    if (k_x >= K_WIDTH || k_y >= K_HEIGHT) return;
 
     // k_out_pixels is 1D, but the image is 2D, so we make y=ax+b to make linear y (k_idx)
-    const int   k_idx = k_y * k_width + k_x;
+    const int   k_idx = (k_y - k_first_row) * K_WIDTH + k_x;
     const float k_px = (float)k_x;
     const float k_py = (float)k_y;
 
@@ -40,7 +254,7 @@ __kernel void shade(
     float k_dyBH = k_py - (float)k_mouse_y;
     float k_d2BH = k_dxBH * k_dxBH + k_dyBH * k_dyBH; // my pixel's distance to bh
 
-    if (k_d2BH < k_bh_r2) {
+    if (k_d2BH < K_BH_R2) {
         k_out_pixels[k_idx] = (uchar4)(0, 0, 0, 0);   // BGRA = black
         return;
     }
@@ -52,14 +266,15 @@ __kernel void shade(
     int   k_hit = 0;    // hit Flag
 
     // Single-pass satellite loop - same logic as BH shading
-    for (int k_j = 0; k_j < k_sat_count; ++k_j) {
+    SHADE_UNROLL
+    for (int k_j = 0; k_j < K_SAT_COUNT; ++k_j) {
         float k_dx = k_px - k_sat_pos_x[k_j];
         float k_dy = k_py - k_sat_pos_y[k_j];
         float k_d2 = k_dx * k_dx + k_dy * k_dy; // pixel's distance to any satellite
         
         // Satellite Coloring:
         // if inside a satellite:
-        if (k_d2 < k_sat_r2) {
+        if (k_d2 < K_SAT_R2) {
             k_out_pixels[k_idx] = (uchar4)(255, 255, 255, 0); // BGRA = white
             k_hit = 1;
             break; // eaten by BH
@@ -103,3 +318,372 @@ __kernel void shade(
         k_out_pixels[k_idx] = (uchar4)(k_ub, k_ug, k_ur, (uchar)0);
     }
 }
+
+__kernel void shade(
+    // --global makes mamory shared between multi threads to read/write
+    __global uchar4* k_out_pixels,        // a vector (1D Array) of 4 unsigned bytes (B, G, R, A)
+    __global const float* k_sat_pos_x,    // SoA Sat Pos X
+    __global const float* k_sat_pos_y,    // SoA Sat Pos Y
+    __global const float* k_id_r,         // SoA Sat R
+    __global const float* k_id_g,         // SoA Sat G
+    __global const float* k_id_b,         // SoA Sat B
+    const int             k_sat_count,    // SAT Count
+    const int             k_width,        // Image Size X
+    const int             k_height,       // Image Size Y
+    const float           k_bh_r2,        // BLACK_HOLE_RADIUS^2
+    const float           k_sat_r2,       // SATELLITE_RADIUS^2
+    const int             k_mouse_x,      // black hole center X
+    const int             k_mouse_y,      // black hole center Y
+    const int             k_pixels,       // pixels per work-item along X
+    const int             k_first_row)    // frame row of k_out_pixels[0], for buffers holding a band
+{
+    // each thread shades k_pixels pixels of its row, a work-group width
+    // apart, so neighbouring work-items still write neighbouring pixels.
+    // The work-group covers get_local_size(0) * k_pixels columns.
+    const int   k_w = (int)get_local_size(0);
+    const int   k_x = (int)get_group_id(0) * k_w * k_pixels + (int)get_local_id(0);
+    const int   k_y = get_global_id(1); //global Y index of a work-item
+
+    for (int k_p = 0; k_p < k_pixels; ++k_p) {
+        shade_pixel(k_out_pixels, k_sat_pos_x, k_sat_pos_y, k_id_r, k_id_g, k_id_b,
+            k_sat_count, k_width, k_height, k_bh_r2, k_sat_r2, k_mouse_x, k_mouse_y,
+            k_x + k_p * k_w, k_y, k_first_row);
+    }
+}
+
+// Bit-exact variant of shade for BOUNDS_TILE x BOUNDS_TILE work-groups.
+// The work-group first bounds the distance of every satellite to its pixel
+// rectangle and keeps, in index order, the satellites that may cover one of
+// its pixels and those that may be the nearest of one (closer than the
+// smallest farthest-corner distance). The per-pixel loops then sum the
+// weights of all satellites as before, but test hits and search the nearest
+// satellite only in these lists. Lists longer than BOUNDS_CANDIDATES fall
+// back to all satellites. BOUNDS_SLACK widens the bounds so float rounding
+// of the pixel distances can never make a culled satellite win.
+#define BOUNDS_GROUP (BOUNDS_TILE * BOUNDS_TILE)
+#define BOUNDS_SLACK 1.0001f
+
+__kernel __attribute__((reqd_work_group_size(BOUNDS_TILE, BOUNDS_TILE, 1)))
+void shade_bounds(
+    __global uchar4* k_out_pixels,
+    __global const float* k_sat_pos_x,
+    __global const float* k_sat_pos_y,
+    __global const float* k_id_r,
+    __global const float* k_id_g,
+    __global const float* k_id_b,
+    const int             k_sat_count,
+    const int             k_width,
+    const int             k_height,
+    const float           k_bh_r2,
+    const float           k_sat_r2,
+    const int             k_mouse_x,
+    const int             k_mouse_y)
+{
+    __local int k_nearest_bound;            // float bits, non-negative floats order like ints
+    __local int k_hit_count;
+    __local int k_near_count;
+    __local int k_hit_list[BOUNDS_CANDIDATES];
+    __local int k_near_list[BOUNDS_CANDIDATES];
+    __local int k_scan[BOUNDS_GROUP];
+
+    const int   k_x = get_global_id(0);
+    const int   k_y = get_global_id(1);
+    const int   k_l = get_local_id(1) * BOUNDS_TILE + get_local_id(0);
+    // tile corner from the global id, which includes a banded launch's offset
+    const float k_x0 = (float)(k_x - get_local_id(0));
+    const float k_y0 = (float)(k_y - get_local_id(1));
+    const float k_x1 = k_x0 + (float)(BOUNDS_TILE - 1);
+    const float k_y1 = k_y0 + (float)(BOUNDS_TILE - 1);
+
+    if (k_l == 0) {
+        k_nearest_bound = as_int(INFINITY);
+        k_hit_count = 0;
+        k_near_count = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // every pixel of the tile has a satellite within the smallest farthest-corner distance
+    float k_best = INFINITY;
+    for (int k_j = k_l; k_j < K_SAT_COUNT; k_j += BOUNDS_GROUP) {
+        float k_fx = fmax(fabs(k_sat_pos_x[k_j] - k_x0), fabs(k_sat_pos_x[k_j] - k_x1));
+        float k_fy = fmax(fabs(k_sat_pos_y[k_j] - k_y0), fabs(k_sat_pos_y[k_j] - k_y1));
+        k_best = fmin(k_best, k_fx * k_fx + k_fy * k_fy);
+    }
+    atomic_min(&k_nearest_bound, as_int(k_best));
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const float k_near_limit = as_float(k_nearest_bound) * BOUNDS_SLACK;
+    const float k_hit_limit = K_SAT_R2 * BOUNDS_SLACK;
+
+    // ordered compaction, BOUNDS_GROUP satellites at a time: an inclusive scan
+    // of the hit (low 16 bits) and nearest (high 16 bits) flags gives the slots
+    for (int k_base = 0; k_base < K_SAT_COUNT; k_base += BOUNDS_GROUP) {
+        const int k_j = k_base + k_l;
+        int k_flags = 0;
+        if (k_j < K_SAT_COUNT) {
+            float k_nx = fmax(fmax(k_x0 - k_sat_pos_x[k_j], k_sat_pos_x[k_j] - k_x1), 0.0f);
+            float k_ny = fmax(fmax(k_y0 - k_sat_pos_y[k_j], k_sat_pos_y[k_j] - k_y1), 0.0f);
+            float k_near2 = k_nx * k_nx + k_ny * k_ny;
+            k_flags = (k_near2 < k_hit_limit ? 1 : 0) | (k_near2 <= k_near_limit ? 0x10000 : 0);
+        }
+        k_scan[k_l] = k_flags;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (int k_off = 1; k_off < BOUNDS_GROUP; k_off <<= 1) {
+            int k_add = k_l >= k_off ? k_scan[k_l - k_off] : 0;
+            barrier(CLK_LOCAL_MEM_FENCE);
+            k_scan[k_l] += k_add;
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+        const int k_before = k_scan[k_l] - k_flags;
+        if (k_flags & 0xFFFF) {
+            int k_at = k_hit_count + (k_before & 0xFFFF);
+            if (k_at < BOUNDS_CANDIDATES) k_hit_list[k_at] = k_j;
+        }
+        if (k_flags >> 16) {
+            int k_at = k_near_count + (k_before >> 16);
+            if (k_at < BOUNDS_CANDIDATES) k_near_list[k_at] = k_j;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (k_l == BOUNDS_GROUP - 1) {
+            k_hit_count += k_scan[k_l] & 0xFFFF;
+            k_near_count += k_scan[k_l] >> 16;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (k_x >= K_WIDTH || k_y >= K_HEIGHT) return;
+
+    const int   k_idx = k_y * K_WIDTH + k_x;
+    const float k_px = (float)k_x;
+    const float k_py = (float)k_y;
+
+    float k_dxBH = k_px - (float)k_mouse_x;
+    float k_dyBH = k_py - (float)k_mouse_y;
+    float k_d2BH = k_dxBH * k_dxBH + k_dyBH * k_dyBH;
+    if (k_d2BH < K_BH_R2) {
+        k_out_pixels[k_idx] = (uchar4)(0, 0, 0, 0);
+        return;
+    }
+
+    // hit test over the candidates (or all satellites after an overflow)
+    const int k_hit_all = k_hit_count > BOUNDS_CANDIDATES;
+    const int k_hits = k_hit_all ? K_SAT_COUNT : k_hit_count;
+    for (int k_c = 0; k_c < k_hits; ++k_c) {
+        int k_j = k_hit_all ? k_c : k_hit_list[k_c];
+        float k_dx = k_px - k_sat_pos_x[k_j];
+        float k_dy = k_py - k_sat_pos_y[k_j];
+        float k_d2 = k_dx * k_dx + k_dy * k_dy;
+        if (k_d2 < K_SAT_R2) {
+            k_out_pixels[k_idx] = (uchar4)(255, 255, 255, 0);
+            return;
+        }
+    }
+
+    // weights of all satellites, in the same order and arithmetic as shade
+    float k_sumR = 0.0f, k_sumG = 0.0f, k_sumB = 0.0f;
+    float k_weights = 0.0f;
+    SHADE_UNROLL
+    for (int k_j = 0; k_j < K_SAT_COUNT; ++k_j) {
+        float k_dx = k_px - k_sat_pos_x[k_j];
+        float k_dy = k_py - k_sat_pos_y[k_j];
+        float k_d2 = k_dx * k_dx + k_dy * k_dy;
+        float k_inv = 1.0f / k_d2;
+        float k_w = k_inv * k_inv;
+        k_weights += k_w;
+        k_sumR += k_id_r[k_j] * k_w;
+        k_sumG += k_id_g[k_j] * k_w;
+        k_sumB += k_id_b[k_j] * k_w;
+    }
+
+    // nearest satellite among the candidates, first one wins ties like in shade
+    const int k_near_all = k_near_count > BOUNDS_CANDIDATES;
+    const int k_nears = k_near_all ? K_SAT_COUNT : k_near_count;
+    float k_shortestD2 = INFINITY;
+    float k_nR = 0.0f, k_nG = 0.0f, k_nB = 0.0f;
+    for (int k_c = 0; k_c < k_nears; ++k_c) {
+        int k_j = k_near_all ? k_c : k_near_list[k_c];
+        float k_dx = k_px - k_sat_pos_x[k_j];
+        float k_dy = k_py - k_sat_pos_y[k_j];
+        float k_d2 = k_dx * k_dx + k_dy * k_dy;
+        if (k_d2 < k_shortestD2) {
+            k_shortestD2 = k_d2;
+            k_nR = k_id_r[k_j];
+            k_nG = k_id_g[k_j];
+            k_nB = k_id_b[k_j];
+        }
+    }
+
+    float k_invW = 1.0f / k_weights;
+    float k_r = k_nR + 3.0f * (k_sumR * k_invW);
+    float k_g = k_nG + 3.0f * (k_sumG * k_invW);
+    float k_b = k_nB + 3.0f * (k_sumB * k_invW);
+    k_out_pixels[k_idx] = (uchar4)((uchar)(k_b * 255.0f), (uchar)(k_g * 255.0f), (uchar)(k_r * 255.0f), (uchar)0);
+}
+
+// Jump flooding: the nearest satellite of every pixel in O(P log P) work for
+// P pixels, independent of the satellite count. jfa_clear and jfa_seed let
+// every satellite seed its (border clamped) pixel; satellites on the same
+// pixel form a seed group, a list through k_next headed by the map entry.
+// jfa_step then runs with steps 1, JFA_FIRST_STEP, ..., 2, 1 and again 2, 1
+// (1+JFA+2), each pixel adopting the group with the nearest member among its
+// own and those of the 8 pixels k_step away. shade_jfa takes the nearest
+// satellite from the map, so its satellite loop only sums weights.
+__kernel void jfa_clear(
+    __global int* k_map,
+    const int     k_size)
+{
+    const int k_i = get_global_id(0);
+    if (k_i < k_size) k_map[k_i] = -1;
+}
+
+__kernel void jfa_seed(
+    __global const float* k_sat_pos_x,
+    __global const float* k_sat_pos_y,
+    const int             k_sat_count,
+    __global int*         k_map,
+    __global int*         k_next,
+    const int             k_width,
+    const int             k_height)
+{
+    const int k_j = get_global_id(0);
+    if (k_j >= k_sat_count) return;
+    const float k_x = k_sat_pos_x[k_j];
+    const float k_y = k_sat_pos_y[k_j];
+    if (isnan(k_x) || isnan(k_y)) {    // never the nearest
+        k_next[k_j] = -1;
+        return;
+    }
+    const int k_px = k_x < 0.5f ? 0 : k_x >= k_width - 0.5f ? k_width - 1 : (int)(k_x + 0.5f);
+    const int k_py = k_y < 0.5f ? 0 : k_y >= k_height - 0.5f ? k_height - 1 : (int)(k_y + 0.5f);
+    // push onto the pixel's group; the order is arbitrary, ties are broken by index
+    k_next[k_j] = atomic_xchg(&k_map[k_py * k_width + k_px], k_j);
+}
+
+// Nearest member of the seed group k_head, the lower index wins ties
+int jfa_group_nearest(
+    __global const float* k_sat_pos_x,
+    __global const float* k_sat_pos_y,
+    __global const int*   k_next,
+    int                   k_head,
+    float                 k_px,
+    float                 k_py,
+    float*                k_d2_out)
+{
+    int k_best = k_head;
+    float k_bestD2 = INFINITY;
+    for (int k_j = k_head; k_j >= 0; k_j = k_next[k_j]) {
+        float k_dx = k_px - k_sat_pos_x[k_j];
+        float k_dy = k_py - k_sat_pos_y[k_j];
+        float k_d2 = k_dx * k_dx + k_dy * k_dy;
+        if (k_d2 < k_bestD2 || (k_d2 == k_bestD2 && k_j < k_best)) {
+            k_bestD2 = k_d2;
+            k_best = k_j;
+        }
+    }
+    *k_d2_out = k_bestD2;
+    return k_best;
+}
+
+__kernel void jfa_step(
+    __global const int*   k_in,
+    __global int*         k_out,
+    __global const float* k_sat_pos_x,
+    __global const float* k_sat_pos_y,
+    __global const int*   k_next,
+    const int             k_width,
+    const int             k_height,
+    const int             k_step)
+{
+    const int k_x = get_global_id(0);
+    const int k_y = get_global_id(1);
+    if (k_x >= k_width || k_y >= k_height) return;
+    const float k_px = (float)k_x;
+    const float k_py = (float)k_y;
+
+    int k_bestHead = k_in[k_y * k_width + k_x];
+    int k_best = -1;
+    float k_bestD2 = INFINITY;
+    if (k_bestHead >= 0) {
+        k_best = jfa_group_nearest(k_sat_pos_x, k_sat_pos_y, k_next, k_bestHead, k_px, k_py, &k_bestD2);
+    }
+    for (int k_oy = -k_step; k_oy <= k_step; k_oy += k_step) {
+        int k_ny = k_y + k_oy;
+        if (k_ny < 0 || k_ny >= k_height) continue;
+        for (int k_ox = -k_step; k_ox <= k_step; k_ox += k_step) {
+            int k_nx = k_x + k_ox;
+            if (k_nx < 0 || k_nx >= k_width || (k_ox == 0 && k_oy == 0)) continue;
+            int k_head = k_in[k_ny * k_width + k_nx];
+            if (k_head < 0 || k_head == k_bestHead) continue;
+            float k_d2;
+            int k_s = jfa_group_nearest(k_sat_pos_x, k_sat_pos_y, k_next, k_head, k_px, k_py, &k_d2);
+            if (k_d2 < k_bestD2 || (k_d2 == k_bestD2 && k_s < k_best)) {
+                k_bestHead = k_head;
+                k_best = k_s;
+                k_bestD2 = k_d2;
+            }
+        }
+    }
+    k_out[k_y * k_width + k_x] = k_bestHead;
+}
+
+__kernel void shade_jfa(
+    __global uchar4* k_out_pixels,
+    __global const float* k_sat_pos_x,
+    __global const float* k_sat_pos_y,
+    __global const float* k_id_r,
+    __global const float* k_id_g,
+    __global const float* k_id_b,
+    const int             k_sat_count,
+    const int             k_width,
+    const int             k_height,
+    const float           k_bh_r2,
+    const float           k_sat_r2,
+    const int             k_mouse_x,
+    const int             k_mouse_y,
+    __global const int*   k_map,          // seed group head of the nearest satellite
+    __global const int*   k_next)
+{
+    const int   k_x = get_global_id(0);
+    const int   k_y = get_global_id(1);
+    if (k_x >= K_WIDTH || k_y >= K_HEIGHT) return;
+
+    const int   k_idx = k_y * K_WIDTH + k_x;
+    const float k_px = (float)k_x;
+    const float k_py = (float)k_y;
+
+    float k_dxBH = k_px - (float)k_mouse_x;
+    float k_dyBH = k_py - (float)k_mouse_y;
+    if (k_dxBH * k_dxBH + k_dyBH * k_dyBH < K_BH_R2) {
+        k_out_pixels[k_idx] = (uchar4)(0, 0, 0, 0);
+        return;
+    }
+
+    float k_nearestD2 = INFINITY;
+    int k_nearest = 0;
+    if (k_map[k_idx] >= 0) {
+        k_nearest = jfa_group_nearest(k_sat_pos_x, k_sat_pos_y, k_next, k_map[k_idx], k_px, k_py, &k_nearestD2);
+    }
+    if (k_nearestD2 < K_SAT_R2) {
+        k_out_pixels[k_idx] = (uchar4)(255, 255, 255, 0);
+        return;
+    }
+
+    float k_sumR = 0.0f, k_sumG = 0.0f, k_sumB = 0.0f;
+    float k_weights = 0.0f;
+    SHADE_UNROLL
+    for (int k_j = 0; k_j < K_SAT_COUNT; ++k_j) {
+        float k_dx = k_px - k_sat_pos_x[k_j];
+        float k_dy = k_py - k_sat_pos_y[k_j];
+        float k_inv = 1.0f / (k_dx * k_dx + k_dy * k_dy);
+        float k_w = k_inv * k_inv;
+        k_weights += k_w;
+        k_sumR += k_id_r[k_j] * k_w;
+        k_sumG += k_id_g[k_j] * k_w;
+        k_sumB += k_id_b[k_j] * k_w;
+    }
+
+    float k_invW = 1.0f / k_weights;
+    float k_r = k_id_r[k_nearest] + 3.0f * (k_sumR * k_invW);
+    float k_g = k_id_g[k_nearest] + 3.0f * (k_sumG * k_invW);
+    float k_b = k_id_b[k_nearest] + 3.0f * (k_sumB * k_invW);
+    k_out_pixels[k_idx] = (uchar4)((uchar)(k_b * 255.0f), (uchar)(k_g * 255.0f), (uchar)(k_r * 255.0f), (uchar)0);
+}
@@ -19,6 +19,31 @@
 #include <math.h> // INFINITY
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h> // INT_MAX
+#include <errno.h> // ERANGE
+#include <omp.h> // omp_get_wtime
+#ifdef _WIN32
+#include <malloc.h> // _aligned_malloc
+#endif
+
+// x86 intrinsics for the explicit SIMD paths. Functions using them are
+// compiled for their instruction set with SIMD_TARGET_* and only called
+// after a runtime CPU check, so the rest of the program stays portable.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h> // __cpuid, _xgetbv
+#endif
+#endif
+
+#if defined(SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define SIMD_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define SIMD_TARGET_AVX2
+#define SIMD_TARGET_AVX512
+#endif
 
 int mousePosX;
 int mousePosY;
@@ -28,232 +53,4659 @@ int mousePosY;
 #define WINDOW_WIDTH  1920
 #define SIZE WINDOW_WIDTH*WINDOW_HEIGHT
 
-// The number of satellites can be changed to see how it affects performance.
+// Default number of satellites. It can be changed with --satellites=N at
+// startup to see how it affects performance.
 // Benchmarks must be run with the original number of satellites
 #define SATELLITE_COUNT 64
 
-// These are used to control the satellite movement
-#define SATELLITE_RADIUS 3.16f
-#define MAX_VELOCITY 0.1f
-#define GRAVITY 1.0f
-#define DELTATIME 32
-#define PHYSICSUPDATESPERFRAME 100000
-#define BLACK_HOLE_RADIUS 4.5f
+// Alignment of heap buffers used by the simulation (one cache line)
+#define MEMORY_ALIGNMENT 64
+
+// Satellite arrays are padded to a multiple of this many floats (one
+// 512-bit vector), so SIMD loops over satellites need no remainder handling
+#define SIMD_WIDTH 16
+
+// Position of the unused padding satellites, far outside the window
+#define PADDING_POSITION 1.0e6f
+
+// Satellites advanced together by the physics engine (one 512-bit vector
+// or two 256-bit vectors of doubles). Divides SIMD_WIDTH.
+#define PHYSICS_LANES 8
+
+// These are used to control the satellite movement
+#define SATELLITE_RADIUS 3.16f
+#define MAX_VELOCITY 0.1f
+#define GRAVITY 1.0f
+#define DELTATIME 32
+#define PHYSICSUPDATESPERFRAME 100000 // default sub-steps, see --substeps
+#define BLACK_HOLE_RADIUS 4.5f
+
+
+
+// Stores 2D data like the coordinates
+typedef struct{
+   float x;
+   float y;
+} floatvector;
+
+// Stores 2D data like the coordinates
+typedef struct{
+   double x;
+   double y;
+} doublevector;
+
+// Each float may vary from 0.0f ... 1.0f
+typedef struct{
+   float blue;
+   float green;
+   float red;
+} color_f32;
+
+// Stores rendered colors. Each value may vary from 0 ... 255
+typedef struct{
+   uint8_t blue;
+   uint8_t green;
+   uint8_t red;
+   uint8_t reserved;
+} color_u8;
+
+// Stores the satellite data, which fly around black hole in the space.
+// Structure of arrays: every array holds 'capacity' aligned floats, of which
+// the first 'count' are real satellites and the rest is padding.
+typedef struct{
+   float* x;
+   float* y;
+   float* vx;
+   float* vy;
+   float* red;
+   float* green;
+   float* blue;
+   int count;
+   int capacity;
+} satellitestore;
+
+// Pixel buffer which is rendered to the screen
+color_u8* pixels;
+
+// Pixel buffer which is used for error checking
+color_u8* correctPixels;
+
+// Buffer for all satellites in the space
+satellitestore satellites;
+satellitestore backupSatelites;
+
+// The satellites and pixels the graphics engine works on. They are
+// 'satellites' and 'pixels' unless --pipeline shades a snapshot of the
+// satellites into a buffer of its own while the physics engine moves on.
+const satellitestore* shadeSatellites = &satellites;
+color_u8* shadePixels;
+
+// Number of satellites in the space, decided at startup
+int satelliteCount = SATELLITE_COUNT;
+
+// Instruction sets of the explicit SIMD paths, in increasing order
+typedef enum{
+   SIMD_SCALAR,
+   SIMD_AVX2,
+   SIMD_AVX512
+} simdlevel;
+
+const char* simdLevelNames[] = { "scalar", "avx2", "avx512" };
+
+// Requested with --simd=auto|scalar|avx2|avx512 (-1 is auto).
+// simdLevel is the path actually used, resolved in init().
+int simdRequest = -1;
+simdlevel simdLevel = SIMD_SCALAR;
+
+// --physics-precision=exact (default) evaluates the same double precision
+// expressions as sequentialPhysicsEngine, so the bitwise check in compute()
+// holds. =fast uses one reciprocal square root per step and fused
+// multiply-adds; results then match the sequential engine only to within
+// float rounding of the stored state, and the check may report differences.
+int physicsExact = 1;
+
+// Time integrators of the physics engine
+typedef enum{
+   INTEGRATOR_EULER,
+   INTEGRATOR_LEAPFROG,
+   INTEGRATOR_YOSHIDA4,
+   INTEGRATOR_RK4,
+   INTEGRATOR_COUNT
+} integratorkind;
+
+const char* integratorNames[] = { "euler", "leapfrog", "yoshida4", "rk4" };
+const int integratorForceEvaluations[] = { 1, 1, 3, 4 };
+
+// --integrator=euler|leapfrog|yoshida4|rk4 and --substeps=N (steps per frame).
+// Only Euler with PHYSICSUPDATESPERFRAME sub-steps reproduces
+// sequentialPhysicsEngine; anything else is expected to fail the check in
+// compute(). The symplectic and higher order integrators reach the same
+// trajectory error with far fewer steps, see --accuracy-report.
+integratorkind integrator = INTEGRATOR_EULER;
+int physicsSubsteps = PHYSICSUPDATESPERFRAME;
+
+// --adaptive=ETA replaces the fixed sub-steps by per-satellite steps of
+// ETA times the local orbital time scale (0 = off), see advanceSatelliteAdaptive
+double adaptiveEta = 0.0;
+#define ADAPTIVE_MAX_STEPS (10 * PHYSICSUPDATESPERFRAME)
+#define ADAPTIVE_CHUNK 4
+
+// --kepler propagates every satellite analytically along its two-body orbit
+// instead of integrating, see advanceSatelliteKepler
+int keplerPropagation = 0;
+#define KEPLER_MAX_ITERATIONS 50
+#define KEPLER_TOLERANCE 1.0e-13
+
+// --nbody adds gravity between the satellites themselves, integrated with
+// leapfrog at --substeps steps per frame (the all-pairs force is O(N^2) per
+// step, so a few hundred steps are a practical choice). Satellites have a
+// mass of --satellite-mass on average, relative to the black hole, and
+// their mutual gravity is softened by --softening pixels.
+int nbodyMode = 0;
+int nbodyBenchmark = 0;
+#define NBODY_SOFTENING 2.0
+#define NBODY_MASS 1.0e-3
+double nbodySoftening = NBODY_SOFTENING;
+double nbodyMass = NBODY_MASS;
+
+// Satellites per tile of the all-pairs force kernel
+#define NBODY_TILE 64
+
+// --nbody-solver=direct|barneshut|pm picks how the mutual gravity is
+// computed: the exact all-pairs sum, a Barnes-Hut quadtree approximation
+// that is O(N log N) and accurate to roughly theta^2 (see --theta), or a
+// particle-mesh solver whose cost is O(N) plus FFTs of the grid and whose
+// resolution is one grid cell (see --pm-grid)
+typedef enum{NBODY_DIRECT, NBODY_BARNESHUT, NBODY_PM, NBODY_SOLVER_COUNT} nbodysolver;
+const char* nbodySolverNames[NBODY_SOLVER_COUNT] = {"direct", "barneshut", "pm"};
+nbodysolver nbodySolver = NBODY_DIRECT;
+#define BH_THETA 0.5
+double nbodyTheta = BH_THETA;
+
+// Quadtree depth (16 bits per axis in the Morton codes), satellites per leaf,
+// radix sort digit size and the scheduling chunk of the tree walks
+#define BH_LEVELS 16
+#define BH_LEAF_SIZE 16
+#define BH_RADIX 256
+#define BH_WALK_CHUNK 64
+
+// Particle-mesh grid: --pm-grid cells per side (a power of two) over a square
+// PM_DOMAIN pixels wide around the window center
+#define PM_GRID 256
+#define PM_DOMAIN (2.0 * WINDOW_WIDTH)
+int pmGridSize = PM_GRID;
+
+// Mass deposit strip height and transpose block size of the PM solver
+#define PM_STRIP_ROWS 4
+#define PM_TRANSPOSE_BLOCK 16
+
+// Particle-mesh grid and its FFT work arrays. The FFTs run on a grid padded
+// to twice the size in each direction, so the convolution is not periodic.
+typedef struct{
+    int size;               // cells per side of the satellite domain
+    int padded;             // 2 * size
+    double cell;            // cell edge length in pixels
+    double x0;              // domain corner
+    double y0;
+    double* aRe;            // padded x padded, row layout
+    double* aIm;
+    double* bRe;            // padded x padded, transposed layout
+    double* bIm;
+    double* greenRe;        // transformed Green's function, transposed layout
+    double* greenIm;
+    double* fx;             // size x size grid accelerations
+    double* fy;
+    double* cosTable;       // padded / 2 twiddle factors
+    double* sinTable;
+    int* bitrev;            // padded bit reversed indices
+    int strips;             // size / PM_STRIP_ROWS
+    int* sorted;            // satellites bucketed by strip
+    int* stripStart;        // strips + 1 offsets into sorted
+    int* stripHistogram;    // strip counters per thread
+} pmgrid;
+
+// --nbody-benchmark limits
+#define NBODY_BENCHMARK_DIRECT_MAX 16384
+#define NBODY_BENCHMARK_SAMPLES 256
+
+// Quadtree node: a square cell holding the sorted satellites [begin, end).
+// Children of a node are stored next to each other.
+typedef struct{
+    double cx;      // center of mass
+    double cy;
+    double mass;
+    double size;    // cell edge length
+    int begin;
+    int end;
+    int child;      // first child, -1 for leaves
+    int children;
+} bhnode;
+
+// Barnes-Hut quadtree and its work arrays, rebuilt every force evaluation
+typedef struct{
+    unsigned int* code;     // Morton codes, sorted
+    unsigned int* codeTmp;
+    int* order;             // satellite index of each sorted position
+    int* orderTmp;
+    double* x;              // satellites in sorted order
+    double* y;
+    double* mass;
+    bhnode* nodes;          // breadth first, levelStart[l] is the first node of level l
+    int nodeCapacity;
+    int levelStart[BH_LEVELS + 2];
+    int levels;
+    int* histogram;         // BH_RADIX counters per thread
+    double* bounds;         // partial bounding boxes, 4 per thread
+    double minX;
+    double minY;
+    double extent;
+} bhtree;
+
+// Double precision satellite state for the N-body mode. Arrays hold
+// tiles * NBODY_TILE entries; padding has zero mass and sits far away.
+typedef struct{
+    double* x;
+    double* y;
+    double* vx;
+    double* vy;
+    double* ax;
+    double* ay;
+    double* mass;
+    int count;
+    int tiles;
+    bhtree tree;
+    pmgrid* pm;         // only with the particle-mesh solver
+} nbodystate;
+
+nbodystate nbody; // allocated in init() with --nbody
+
+// --accuracy-report prints integrator errors against a reference at startup
+int accuracyReport = 0;
+#define ACCURACY_REPORT_FRAMES 10
+#define ACCURACY_REPORT_SATELLITES 1024
+#define ACCURACY_REFERENCE_SUBSTEPS 100000
+
+// Rendering of the pixels, selected with --render
+typedef enum {
+    RENDER_FULL,    // every pixel visits every satellite
+    RENDER_BINNED,  // pixel tiles visit the satellites of nearby grid bins
+    RENDER_BOUNDS,  // bit-exact, hit test and nearest search culled per tile
+    RENDER_JFA,     // nearest satellites from a jump-flooding map
+    RENDER_TREE,    // near satellites exactly, far quadtree clusters as a far field
+    RENDER_MODE_COUNT
+} rendermode;
+const char* renderModeNames[RENDER_MODE_COUNT] = { "full", "binned", "bounds", "jfa", "tree" };
+rendermode renderMode = RENDER_FULL;
+
+// Binned rendering sorts the satellites into square bins each frame. A
+// RENDER_TILE x RENDER_TILE pixel tile visits bins ring by ring around its
+// own bin until the satellites left out can change no color channel by more
+// than renderErrorBudget levels. errorCheck allows ALLOWED_ERROR (10); the
+// default leaves one level for truncation and one for float rounding.
+#define RENDER_TILE 16
+#define RENDER_BIN_OCCUPANCY 4      // mean satellites per bin when choosing the bin size
+#define RENDER_ERROR_BUDGET 8.0
+#define RENDER_MAX_RINGS (WINDOW_WIDTH / RENDER_TILE + 1)
+double renderErrorBudget = RENDER_ERROR_BUDGET;
+
+// Satellites visited by one tile, in ascending satellite index so that
+// nearest-satellite ties are resolved like in the full render. The gather
+// marks them in a bitmap which is then scanned in order.
+typedef struct{
+    satellitestore sats;        // positions and colors, no velocities
+    uint64_t* marked;           // one bit per satellite, cleared by the scan
+} rendercandidates;
+
+typedef struct{
+    int* sorted;                // satellite indices in bin order
+    rendercandidates* candidates; // one per thread
+    int* binOf;                 // bin of each satellite
+    int* binStart;              // first sorted satellite of each bin, bins + 1 entries
+    int* binFill;               // scatter cursors
+    int* binTable;              // summed-area table of the bin counts, (binsX + 1) * (binsY + 1)
+    int binSize;
+    int binsX;
+    int binsY;
+    float colorRange;           // largest spread of a color channel over the satellites
+} renderbins;
+
+renderbins renderBins; // allocated in init() with --render=binned
+
+// Bounds rendering keeps the weighted color sum over all satellites but
+// tests hits and searches the nearest satellite only among the satellites
+// that can cover a pixel of the tile, or be closer to one than the
+// satellite with the smallest farthest-corner distance. The bounds are
+// widened by RENDER_BOUNDS_SLACK so float rounding of the pixel distances
+// can never make a culled satellite win.
+#define RENDER_BOUNDS_SLACK 1.0001f
+
+typedef struct{
+    int* hit;           // satellites closer than SATELLITE_RADIUS to the tile
+    int* nearest;       // nearest satellite candidates, ascending index
+    int hitCount;
+    int nearestCount;
+} tilecandidates;
+
+tilecandidates* boundsCandidates; // one per thread, allocated in init() with --render=bounds
+
+// Jump-flooding rendering finds the nearest satellite of every pixel with
+// O(P log P) work for P pixels, independent of the satellite count: every
+// satellite seeds its pixel (satellites outside the window seed the border),
+// then passes with steps JFA_FIRST_STEP, ..., 2, 1 let each pixel adopt the
+// nearest seed among its own and those of the 8 pixels 'step' away. A step 1
+// pass before and two with steps 2 and 1 after them (1+JFA+2) repair most of
+// the pixels plain JFA gets wrong; the rest, a few dozen per frame with
+// 10^4 satellites, grow with the satellite density. The shading loop then
+// only accumulates weights.
+// Satellites rounding to the same pixel form a seed group, a list in
+// ascending index order headed by the map entry, so none of them is lost.
+#define JFA_FIRST_STEP 1024     // half of the window's larger side, rounded up to a power of two
+int* jfaMap[2];                 // seed group head per pixel, ping-pong, allocated in init() with --render=jfa
+int* jfaNext;                   // next satellite of the same seed group, -1 ends it
+
+// Tree rendering splits the weighted color sum of every RENDER_TILE x
+// RENDER_TILE tile. A quadtree of the satellites is built each frame
+// (bhTreeBuild). Clusters that appear smaller than renderTheta radians from
+// the tile, counting the tile's own size, and that cannot hold the nearest
+// satellite of any of its pixels are summed into a far field: second order
+// Taylor expansions about the tile center of their weights and color sums,
+// each taken at the cluster's weight or color center. The other satellites
+// are shaded exactly by the row shaders, so hits and nearest satellites are
+// exact. The error falls with renderTheta; 0 shades every tile exactly.
+#define RENDER_THETA 0.3
+double renderTheta = RENDER_THETA;
+
+// Far field of the satellites left out of a tile. For channel q (weight,
+// red, green, blue) the sum of color times weight over these satellites at
+// pixel (x + u, y + v) is c[q][0] + c[q][1] u + c[q][2] v + c[q][3] u^2 +
+// c[q][4] u v + c[q][5] v^2.
+typedef struct{
+    float x;
+    float y;
+    float c[4][6];
+} farfield;
+
+// Weight and color moments of a quadtree node
+typedef struct{
+    float minX;             // bounding box of the satellites
+    float minY;
+    float maxX;
+    float maxY;
+    float radius;           // farthest box corner from the weight center
+    float m[4];             // satellite count and color sums
+    float cx[4];            // weight and color centers
+    float cy[4];
+} rendermoments;
+
+typedef struct{
+    bhtree tree;
+    double* x;                  // satellite positions clamped around the window, the tree input
+    double* y;
+    rendermoments* moments;     // one per tree node
+    int momentCapacity;
+    rendercandidates* candidates; // one per thread
+} rendertree;
+
+rendertree renderTree; // allocated in init() with --render=tree
+
+// The full render shades SCHED_TILE_WIDTH x SCHED_TILE_HEIGHT pixel tiles.
+// Every thread starts with a contiguous band of tiles in its deque, takes
+// tiles from the front and, once its own deque is empty, steals from the
+// back of the others'. With more than SCHED_SATELLITE_BLOCK satellites a
+// tile is shaded in passes over blocks of that many, which stay in L1,
+// keeping every pixel's sums in a per-thread tileaccumulator in between;
+// the sums see the satellites in the same order, so the result does not
+// change. --render-schedule=rows restores the static split of the rows,
+// and --busy-report prints how long every thread shaded each frame.
+#define SCHED_TILE_WIDTH 64
+#define SCHED_TILE_HEIGHT 8
+#define SCHED_TILE_PIXELS (SCHED_TILE_WIDTH * SCHED_TILE_HEIGHT)
+#define SCHED_SATELLITE_BLOCK 256   // 5 floats each, 5 kB
+#if WINDOW_WIDTH % SCHED_TILE_WIDTH || WINDOW_HEIGHT % SCHED_TILE_HEIGHT || SCHED_TILE_WIDTH % SIMD_WIDTH
+#error The window must split into whole scheduler tiles of whole vectors
+#endif
+
+typedef enum{SCHEDULE_ROWS, SCHEDULE_STEAL, SCHEDULE_COUNT} renderschedule;
+const char* renderScheduleNames[SCHEDULE_COUNT] = {"rows", "steal"};
+renderschedule renderSchedule = SCHEDULE_STEAL;
+int busyReport = 0;
+
+// Tiles [next, end) of one thread. The owner takes 'next', thieves 'end - 1'.
+typedef struct{
+    omp_lock_t lock;
+    int next;
+    int end;
+    double busy;                // seconds spent shading in this frame
+    char padding[MEMORY_ALIGNMENT]; // keeps the threads' deques on separate cache lines
+} tiledeque;
+
+// Pixel sums of a tile between satellite blocks. The scalar shader keeps
+// the nearest satellite's index, the vector shaders its color and their
+// hit masks.
+typedef struct{
+    float sumR[SCHED_TILE_PIXELS];
+    float sumG[SCHED_TILE_PIXELS];
+    float sumB[SCHED_TILE_PIXELS];
+    float weights[SCHED_TILE_PIXELS];
+    float shortestD2[SCHED_TILE_PIXELS];
+    float nearR[SCHED_TILE_PIXELS];
+    float nearG[SCHED_TILE_PIXELS];
+    float nearB[SCHED_TILE_PIXELS];
+    float hits[SCHED_TILE_PIXELS];          // scalar: 0 or 1, AVX2: lane masks
+    int nearest[SCHED_TILE_PIXELS];
+    unsigned short hitMasks[SCHED_TILE_PIXELS / 16]; // AVX-512
+} tileaccumulator;
+
+tiledeque* tileDeques;              // one per thread, allocated in init()
+tileaccumulator* tileAccumulators;  // one per thread
+
+// With --pipeline the physics and graphics engines run on worker threads
+// with OpenMP teams of their own: while the graphics team shades frame N
+// from a snapshot of the satellites, the physics team already moves them
+// to frame N+1 and render() presents frame N-1. The pixels rotate through
+// PIPELINE_BUFFERS buffers, one presented, one being shaded and one free.
+// The first PIPELINE_FIRST_FRAME frames, which compute() checks against
+// the sequential engines, run in sequence.
+#define PIPELINE_FIRST_FRAME 2
+#define PIPELINE_BUFFERS 3
+#define PIPELINE_HISTORY 4  // frames of physics start times kept for the latency
+
+typedef struct{
+    SDL_Thread* thread;
+    SDL_sem* start;
+    SDL_sem* done;
+    void (*job)(void);
+    int threads;        // size of the stage's OpenMP team
+    int pending;        // started, not yet waited for
+    int quit;
+    double seconds;     // duration of the last job
+} pipelinestage;
+
+int pipelineMode = 0;
+int pipelinePhysicsThreads = 0;     // 0: half of the threads
+int pipelineFrame = 0;              // frames passed to the graphics engine
+
+// Heap allocation aligned to MEMORY_ALIGNMENT. Exits if out of memory.
+void* alignedMalloc(size_t bytes) {
+    void* ptr = NULL;
+#ifdef _WIN32
+    ptr = _aligned_malloc(bytes, MEMORY_ALIGNMENT);
+#else
+    if (posix_memalign(&ptr, MEMORY_ALIGNMENT, bytes) != 0) ptr = NULL;
+#endif
+    if (!ptr) {
+        fprintf(stderr, "Failed to allocate %zu bytes\n", bytes);
+        exit(1);
+    }
+    return ptr;
+}
+
+// Releases memory from alignedMalloc()
+void alignedFree(void* ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+// Allocates the arrays of a satellite store. Padding satellites are parked
+// far away with zero velocity and color, so they can be advanced by the
+// physics like real ones and never dominate a pixel.
+void satelliteStoreAlloc(satellitestore* s, int count) {
+    s->count = count;
+    s->capacity = (count + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    size_t bytes = sizeof(float) * s->capacity;
+    s->x = (float*)alignedMalloc(bytes);
+    s->y = (float*)alignedMalloc(bytes);
+    s->vx = (float*)alignedMalloc(bytes);
+    s->vy = (float*)alignedMalloc(bytes);
+    s->red = (float*)alignedMalloc(bytes);
+    s->green = (float*)alignedMalloc(bytes);
+    s->blue = (float*)alignedMalloc(bytes);
+    for (int i = count; i < s->capacity; ++i) {
+        s->x[i] = PADDING_POSITION;
+        s->y[i] = PADDING_POSITION;
+        s->vx[i] = s->vy[i] = 0.f;
+        s->red[i] = s->green[i] = s->blue[i] = 0.f;
+    }
+}
+
+void satelliteStoreFree(satellitestore* s) {
+    alignedFree(s->x);
+    alignedFree(s->y);
+    alignedFree(s->vx);
+    alignedFree(s->vy);
+    alignedFree(s->red);
+    alignedFree(s->green);
+    alignedFree(s->blue);
+}
+
+// Copies all satellites, including padding. Both stores have the same capacity.
+void satelliteStoreCopy(satellitestore* dst, const satellitestore* src) {
+    size_t bytes = sizeof(float) * src->capacity;
+    memcpy(dst->x, src->x, bytes);
+    memcpy(dst->y, src->y, bytes);
+    memcpy(dst->vx, src->vx, bytes);
+    memcpy(dst->vy, src->vy, bytes);
+    memcpy(dst->red, src->red, bytes);
+    memcpy(dst->green, src->green, bytes);
+    memcpy(dst->blue, src->blue, bytes);
+}
+
+// Bitwise comparison of satellite i in two stores
+int satelliteStoreEqual(const satellitestore* a, const satellitestore* b, int i) {
+    return !memcmp(&a->x[i], &b->x[i], sizeof(float)) &&
+        !memcmp(&a->y[i], &b->y[i], sizeof(float)) &&
+        !memcmp(&a->vx[i], &b->vx[i], sizeof(float)) &&
+        !memcmp(&a->vy[i], &b->vy[i], sizeof(float)) &&
+        !memcmp(&a->red[i], &b->red[i], sizeof(float)) &&
+        !memcmp(&a->green[i], &b->green[i], sizeof(float)) &&
+        !memcmp(&a->blue[i], &b->blue[i], sizeof(float));
+}
+
+color_f32 satelliteColor(const satellitestore* s, int i) {
+    color_f32 color = {.blue = s->blue[i], .green = s->green[i], .red = s->red[i]};
+    return color;
+}
+
+// Parses all of 'text' as a decimal integer. Returns 0 if it is empty, has
+// anything left over or does not fit an int.
+int parseIntValue(const char* text, int* value) {
+    char* end;
+    errno = 0;
+    long v = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || v < INT_MIN || v > INT_MAX) return 0;
+    *value = (int)v;
+    return 1;
+}
+
+// Parses all of 'text' as a finite floating point number. Returns 0 if it
+// is empty or has anything left over.
+int parseDoubleValue(const char* text, double* value) {
+    char* end;
+    double v = strtod(text, &end);
+    if (end == text || *end != '\0' || !isfinite(v)) return 0;
+    *value = v;
+    return 1;
+}
+
+// Parses one "--name=value" command line option. Returns 0 if the option
+// is unknown or its value is invalid.
+int parseOption(const char* arg) {
+    if (strncmp(arg, "--satellites=", 13) == 0) {
+        return parseIntValue(arg + 13, &satelliteCount) &&
+            satelliteCount > 0 && satelliteCount <= INT_MAX - SIMD_WIDTH;
+    }
+    if (strcmp(arg, "--physics-precision=exact") == 0 || strcmp(arg, "--physics-precision=fast") == 0) {
+        physicsExact = strcmp(arg, "--physics-precision=exact") == 0;
+        return 1;
+    }
+    if (strncmp(arg, "--substeps=", 11) == 0) {
+        return parseIntValue(arg + 11, &physicsSubsteps) && physicsSubsteps > 0;
+    }
+    if (strncmp(arg, "--adaptive=", 11) == 0) {
+        return parseDoubleValue(arg + 11, &adaptiveEta) && adaptiveEta >= 0.0;
+    }
+    if (strcmp(arg, "--kepler") == 0) {
+        keplerPropagation = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--nbody") == 0) {
+        nbodyMode = 1;
+        return 1;
+    }
+    if (strncmp(arg, "--nbody-solver=", 15) == 0) {
+        for (int k = 0; k < NBODY_SOLVER_COUNT; ++k) {
+            if (strcmp(arg + 15, nbodySolverNames[k]) == 0) {
+                nbodySolver = (nbodysolver)k;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (strncmp(arg, "--theta=", 8) == 0) {
+        return parseDoubleValue(arg + 8, &nbodyTheta) && nbodyTheta >= 0.0;
+    }
+    if (strncmp(arg, "--pm-grid=", 10) == 0) {
+        return parseIntValue(arg + 10, &pmGridSize) &&
+            pmGridSize >= 16 && pmGridSize <= 4096 && (pmGridSize & (pmGridSize - 1)) == 0;
+    }
+    if (strcmp(arg, "--nbody-benchmark") == 0) {
+        nbodyBenchmark = 1;
+        return 1;
+    }
+    if (strncmp(arg, "--softening=", 12) == 0) {
+        return parseDoubleValue(arg + 12, &nbodySoftening) && nbodySoftening >= 0.0;
+    }
+    if (strncmp(arg, "--satellite-mass=", 17) == 0) {
+        return parseDoubleValue(arg + 17, &nbodyMass) && nbodyMass >= 0.0;
+    }
+    if (strncmp(arg, "--render=", 9) == 0) {
+        for (int k = 0; k < RENDER_MODE_COUNT; ++k) {
+            if (strcmp(arg + 9, renderModeNames[k]) == 0) {
+                renderMode = (rendermode)k;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (strncmp(arg, "--render-error=", 15) == 0) {
+        return parseDoubleValue(arg + 15, &renderErrorBudget) && renderErrorBudget > 0.0;
+    }
+    if (strncmp(arg, "--render-schedule=", 18) == 0) {
+        for (int k = 0; k < SCHEDULE_COUNT; ++k) {
+            if (strcmp(arg + 18, renderScheduleNames[k]) == 0) {
+                renderSchedule = (renderschedule)k;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (strcmp(arg, "--pipeline") == 0) {
+        pipelineMode = 1;
+        return 1;
+    }
+    if (strncmp(arg, "--pipeline=", 11) == 0) {
+        pipelineMode = 1;
+        return parseIntValue(arg + 11, &pipelinePhysicsThreads) && pipelinePhysicsThreads >= 1;
+    }
+    if (strcmp(arg, "--busy-report") == 0) {
+        busyReport = 1;
+        return 1;
+    }
+    if (strncmp(arg, "--render-theta=", 15) == 0) {
+        return parseDoubleValue(arg + 15, &renderTheta) && renderTheta >= 0.0 && renderTheta < 1.0;
+    }
+    if (strcmp(arg, "--accuracy-report") == 0) {
+        accuracyReport = 1;
+        return 1;
+    }
+    if (strncmp(arg, "--integrator=", 13) == 0) {
+        for (int kind = 0; kind < INTEGRATOR_COUNT; ++kind) {
+            if (strcmp(arg + 13, integratorNames[kind]) == 0) {
+                integrator = (integratorkind)kind;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (strncmp(arg, "--simd=", 7) == 0) {
+        const char* value = arg + 7;
+        if (strcmp(value, "auto") == 0) {
+            simdRequest = -1;
+            return 1;
+        }
+        for (int level = SIMD_SCALAR; level <= SIMD_AVX512; ++level) {
+            if (strcmp(value, simdLevelNames[level]) == 0) {
+                simdRequest = level;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Highest SIMD level supported by both the CPU and the OS
+simdlevel detectSimdLevel(void) {
+#if defined(SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SIMD_AVX2;
+#elif defined(SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    int fma = (info[2] >> 12) & 1;
+    int osxsave = (info[2] >> 27) & 1;
+    if (maxLeaf >= 7 && osxsave) {
+        // XCR0: the OS must save the YMM (bits 1-2) and ZMM (bits 5-7) state
+        unsigned long long xcr0 = _xgetbv(0);
+        __cpuidex(info, 7, 0);
+        int avx2 = (info[1] >> 5) & 1;
+        int avx512f = (info[1] >> 16) & 1;
+        if (avx512f && (xcr0 & 0xE6) == 0xE6) return SIMD_AVX512;
+        if (avx2 && fma && (xcr0 & 0x6) == 0x6) return SIMD_AVX2;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+
+
+// Defined with the physics engine below
+void integratorAccuracyReport(void);
+void nbodyStateAlloc(nbodystate* s, int count);
+void nbodyStateFree(nbodystate* s);
+void bhTreeAlloc(bhtree* tree, int count);
+void bhTreeFree(bhtree* tree);
+void pmAlloc(pmgrid* pm, int gridSize, int count);
+void pmFree(pmgrid* pm);
+void nbodyThroughputBenchmark(void);
+void renderBinsAlloc(renderbins* rb);
+void renderBinsFree(renderbins* rb);
+void boundsCandidatesAlloc(void);
+void boundsCandidatesFree(void);
+void renderTreeAlloc(rendertree* rt);
+void renderTreeFree(rendertree* rt);
+void tileSchedulerAlloc(void);
+void tileSchedulerFree(void);
+void pipelineAlloc(void);
+void pipelineFree(void);
+
+void init(){
+    simdlevel supported = detectSimdLevel();
+    simdLevel = supported;
+    if (simdRequest >= 0) {
+        if ((simdlevel)simdRequest > supported) {
+            printf("SIMD level %s is not supported by this CPU\n", simdLevelNames[simdRequest]);
+        } else {
+            simdLevel = (simdlevel)simdRequest;
+        }
+    }
+    printf("SIMD level: %s\n", simdLevelNames[simdLevel]);
+    if (nbodyMode) {
+        printf("Integrator: leapfrog with satellite-satellite gravity, %d sub-steps per frame, softening %g, mean mass %g\n",
+            physicsSubsteps, nbodySoftening, nbodyMass);
+        printf("N-body solver: %s", nbodySolverNames[nbodySolver]);
+        if (nbodySolver == NBODY_BARNESHUT) printf(", theta %g", nbodyTheta);
+        if (nbodySolver == NBODY_PM) printf(", %d x %d grid", pmGridSize, pmGridSize);
+        printf("\n");
+        nbodyStateAlloc(&nbody, satellites.count);
+        if (nbodySolver == NBODY_PM) {
+            nbody.pm = (pmgrid*)malloc(sizeof(pmgrid));
+            pmAlloc(nbody.pm, pmGridSize, satellites.count);
+        }
+    } else if (keplerPropagation) {
+        printf("Integrator: analytic Kepler propagation, %s fallback\n", integratorNames[integrator]);
+    } else if (adaptiveEta > 0.0) {
+        printf("Integrator: %s, adaptive steps with eta %g\n", integratorNames[integrator], adaptiveEta);
+    } else {
+        printf("Integrator: %s, %d sub-steps per frame\n", integratorNames[integrator], physicsSubsteps);
+    }
+    if (renderMode == RENDER_BINNED) {
+        renderBinsAlloc(&renderBins);
+        printf("Render: binned, %d x %d bins of %d pixels, error budget %g\n",
+            renderBins.binsX, renderBins.binsY, renderBins.binSize, renderErrorBudget);
+    }
+    if (renderMode == RENDER_BOUNDS) {
+        boundsCandidatesAlloc();
+        printf("Render: bounds, %d x %d pixel tiles\n", RENDER_TILE, RENDER_TILE);
+    }
+    if (renderMode == RENDER_JFA) {
+        jfaMap[0] = (int*)alignedMalloc(sizeof(int) * SIZE);
+        jfaMap[1] = (int*)alignedMalloc(sizeof(int) * SIZE);
+        jfaNext = (int*)malloc(sizeof(int) * satellites.count);
+        printf("Render: jump flooding nearest satellite map\n");
+    }
+    if (renderMode == RENDER_FULL) {
+        tileSchedulerAlloc();
+        if (renderSchedule == SCHEDULE_STEAL) {
+            printf("Render: %d x %d pixel tiles, work stealing, %d satellite blocks\n",
+                SCHED_TILE_WIDTH, SCHED_TILE_HEIGHT, SCHED_SATELLITE_BLOCK);
+        }
+    }
+    if (pipelineMode) {
+        pipelineAlloc();
+    }
+    if (renderMode == RENDER_TREE) {
+        renderTreeAlloc(&renderTree);
+        printf("Render: tree, far field of clusters under theta %g per %d x %d pixel tile\n",
+            renderTheta, RENDER_TILE, RENDER_TILE);
+    }
+    if (accuracyReport) {
+        integratorAccuracyReport();
+    }
+    if (nbodyBenchmark) {
+        nbodyThroughputBenchmark();
+    }
+}
+
+// Gravity of the black hole at (mx, my) on a satellite at (x, y)
+static inline void blackHoleAcceleration(double x, double y, double mx, double my,
+    double* ax, double* ay) {
+    double dx = x - mx;
+    double dy = y - my;
+    double d2 = dx * dx + dy * dy;
+    double invd = 1.0 / sqrt(d2);
+    double scale = GRAVITY * invd * invd * invd;
+    *ax = -dx * scale;
+    *ay = -dy * scale;
+}
+
+// One step of length h for one satellite with each integrator.
+// (ax, ay) holds the acceleration at the current position on entry and on
+// exit, so the leapfrog reuses the closing kick's force in the next step.
+static inline void eulerStep(double h, double mx, double my,
+    double* x, double* y, double* vx, double* vy, double* ax, double* ay) {
+    blackHoleAcceleration(*x, *y, mx, my, ax, ay);
+    *vx += *ax * h;
+    *vy += *ay * h;
+    *x += *vx * h;
+    *y += *vy * h;
+}
+
+static inline void leapfrogStep(double h, double mx, double my,
+    double* x, double* y, double* vx, double* vy, double* ax, double* ay) {
+    // Kick-drift-kick
+    *vx += *ax * (0.5 * h);
+    *vy += *ay * (0.5 * h);
+    *x += *vx * h;
+    *y += *vy * h;
+    blackHoleAcceleration(*x, *y, mx, my, ax, ay);
+    *vx += *ax * (0.5 * h);
+    *vy += *ay * (0.5 * h);
+}
+
+static inline void yoshida4Step(double h, double mx, double my,
+    double* x, double* y, double* vx, double* vy, double* ax, double* ay) {
+    // Yoshida's 4th order composition of leapfrog steps
+    const double cbrt2 = 1.2599210498948732;
+    const double w1 = 1.0 / (2.0 - cbrt2);
+    const double w0 = -cbrt2 / (2.0 - cbrt2);
+    const double c[4] = { w1 / 2.0, (w0 + w1) / 2.0, (w0 + w1) / 2.0, w1 / 2.0 };
+    const double d[3] = { w1, w0, w1 };
+
+    for (int stage = 0; stage < 3; ++stage) {
+        *x += *vx * (c[stage] * h);
+        *y += *vy * (c[stage] * h);
+        blackHoleAcceleration(*x, *y, mx, my, ax, ay);
+        *vx += *ax * (d[stage] * h);
+        *vy += *ay * (d[stage] * h);
+    }
+    *x += *vx * (c[3] * h);
+    *y += *vy * (c[3] * h);
+}
+
+static inline void rk4Step(double h, double mx, double my,
+    double* x, double* y, double* vx, double* vy, double* ax, double* ay) {
+    double k1x = *vx, k1y = *vy, l1x, l1y;
+    blackHoleAcceleration(*x, *y, mx, my, &l1x, &l1y);
+
+    double k2x = *vx + 0.5 * h * l1x, k2y = *vy + 0.5 * h * l1y, l2x, l2y;
+    blackHoleAcceleration(*x + 0.5 * h * k1x, *y + 0.5 * h * k1y, mx, my, &l2x, &l2y);
+
+    double k3x = *vx + 0.5 * h * l2x, k3y = *vy + 0.5 * h * l2y, l3x, l3y;
+    blackHoleAcceleration(*x + 0.5 * h * k2x, *y + 0.5 * h * k2y, mx, my, &l3x, &l3y);
+
+    double k4x = *vx + h * l3x, k4y = *vy + h * l3y, l4x, l4y;
+    blackHoleAcceleration(*x + h * k3x, *y + h * k3y, mx, my, &l4x, &l4y);
+
+    *x += h / 6.0 * (k1x + 2.0 * k2x + 2.0 * k3x + k4x);
+    *y += h / 6.0 * (k1y + 2.0 * k2y + 2.0 * k3y + k4y);
+    *vx += h / 6.0 * (l1x + 2.0 * l2x + 2.0 * l3x + l4x);
+    *vy += h / 6.0 * (l1y + 2.0 * l2y + 2.0 * l3y + l4y);
+    *ax = l1x;
+    *ay = l1y;
+}
+
+// Advances PHYSICS_LANES satellites by one frame (DELTATIME) with 'steps'
+// steps of the given integrator. The lanes loops vectorize across satellites.
+void integrateLanes(integratorkind kind, int steps, double mx, double my,
+    double* x, double* y, double* vx, double* vy) {
+
+    const double h = (double)DELTATIME / (double)steps;
+    double ax[PHYSICS_LANES], ay[PHYSICS_LANES];
+
+#pragma omp simd
+    for (int k = 0; k < PHYSICS_LANES; ++k) {
+        blackHoleAcceleration(x[k], y[k], mx, my, &ax[k], &ay[k]);
+    }
+
+    // One loop per integrator keeps the switch out of the vector loops
+    switch (kind) {
+    case INTEGRATOR_EULER:
+        for (int step = 0; step < steps; ++step) {
+#pragma omp simd
+            for (int k = 0; k < PHYSICS_LANES; ++k) {
+                eulerStep(h, mx, my, &x[k], &y[k], &vx[k], &vy[k], &ax[k], &ay[k]);
+            }
+        }
+        break;
+
+    case INTEGRATOR_LEAPFROG:
+        for (int step = 0; step < steps; ++step) {
+#pragma omp simd
+            for (int k = 0; k < PHYSICS_LANES; ++k) {
+                leapfrogStep(h, mx, my, &x[k], &y[k], &vx[k], &vy[k], &ax[k], &ay[k]);
+            }
+        }
+        break;
+
+    case INTEGRATOR_YOSHIDA4:
+        for (int step = 0; step < steps; ++step) {
+#pragma omp simd
+            for (int k = 0; k < PHYSICS_LANES; ++k) {
+                yoshida4Step(h, mx, my, &x[k], &y[k], &vx[k], &vy[k], &ax[k], &ay[k]);
+            }
+        }
+        break;
+
+    case INTEGRATOR_RK4:
+        for (int step = 0; step < steps; ++step) {
+#pragma omp simd
+            for (int k = 0; k < PHYSICS_LANES; ++k) {
+                rk4Step(h, mx, my, &x[k], &y[k], &vx[k], &vy[k], &ax[k], &ay[k]);
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Advances satellite i over one frame with adaptive steps
+// h = adaptiveEta * r^1.5 / sqrt(GRAVITY), i.e. a fixed fraction of the
+// local orbital time scale: satellites on close passes to the black hole
+// take many short steps, distant ones a few long ones. The last step is
+// shortened to end exactly on the frame boundary. Returns the step count.
+int advanceSatelliteAdaptive(int i, int tmpMousePosX, int tmpMousePosY) {
+
+    const double mx = tmpMousePosX;
+    const double my = tmpMousePosY;
+    const double minStep = (double)DELTATIME / ADAPTIVE_MAX_STEPS;
+
+    double x = satellites.x[i];
+    double y = satellites.y[i];
+    double vx = satellites.vx[i];
+    double vy = satellites.vy[i];
+    double ax, ay;
+    blackHoleAcceleration(x, y, mx, my, &ax, &ay);
+
+    double t = 0.0;
+    int steps = 0;
+    while (t < DELTATIME) {
+        double dx = x - mx;
+        double dy = y - my;
+        double r = sqrt(dx * dx + dy * dy);
+        double h = adaptiveEta * r * sqrt(r / GRAVITY);
+        if (h < minStep) h = minStep;
+        if (h > DELTATIME - t) h = DELTATIME - t;
+
+        switch (integrator) {
+        case INTEGRATOR_LEAPFROG: leapfrogStep(h, mx, my, &x, &y, &vx, &vy, &ax, &ay); break;
+        case INTEGRATOR_YOSHIDA4: yoshida4Step(h, mx, my, &x, &y, &vx, &vy, &ax, &ay); break;
+        case INTEGRATOR_RK4:      rk4Step(h, mx, my, &x, &y, &vx, &vy, &ax, &ay); break;
+        default:                  eulerStep(h, mx, my, &x, &y, &vx, &vy, &ax, &ay); break;
+        }
+        t += h;
+        ++steps;
+    }
+
+    satellites.x[i] = (float)x;
+    satellites.y[i] = (float)y;
+    satellites.vx[i] = (float)vx;
+    satellites.vy[i] = (float)vy;
+    return steps;
+}
+
+// Stumpff functions C(z) and S(z) of the universal variable formulation.
+// Near z = 0 the closed forms cancel badly, so their series is used instead.
+static inline void stumpff(double z, double* c, double* s) {
+    if (z > 1.0e-4) {
+        double sz = sqrt(z);
+        *c = (1.0 - cos(sz)) / z;
+        *s = (sz - sin(sz)) / (z * sz);
+    } else if (z < -1.0e-4) {
+        double sz = sqrt(-z);
+        *c = (cosh(sz) - 1.0) / -z;
+        *s = (sinh(sz) - sz) / (-z * sz);
+    } else {
+        *c = 1.0 / 2.0 - z / 24.0 + z * z / 720.0;
+        *s = 1.0 / 6.0 - z / 120.0 + z * z / 5040.0;
+    }
+}
+
+// Propagates one satellite analytically by dt around a black hole at
+// (mx, my). With the black hole fixed the motion is a two-body Kepler
+// orbit: the universal Kepler equation is solved for chi by Newton
+// iteration and the new state follows from the Lagrange f and g
+// coefficients, which covers elliptic and hyperbolic orbits alike.
+// Returns 0 and leaves the state untouched if the iteration does not
+// converge (e.g. a satellite sitting on the black hole).
+int keplerPropagate(double dt, double mx, double my,
+    double* x, double* y, double* vx, double* vy) {
+
+    const double mu = GRAVITY;
+    const double sqrtMu = sqrt(mu);
+
+    double rx = *x - mx;
+    double ry = *y - my;
+    double r0 = sqrt(rx * rx + ry * ry);
+    if (r0 <= 0.0) return 0;
+    double vr0 = (rx * *vx + ry * *vy) / r0;
+    double alpha = 2.0 / r0 - (*vx * *vx + *vy * *vy) / mu; // 1 / semi-major axis
+
+    double chi = sqrtMu * fabs(alpha) * dt;
+    if (chi == 0.0) chi = sqrtMu * dt / r0;
+    double c, s;
+    int converged = 0;
+    for (int iter = 0; iter < KEPLER_MAX_ITERATIONS; ++iter) {
+        double chi2 = chi * chi;
+        stumpff(alpha * chi2, &c, &s);
+        double f = r0 * vr0 / sqrtMu * chi2 * c + (1.0 - alpha * r0) * chi2 * chi * s
+            + r0 * chi - sqrtMu * dt;
+        double df = r0 * vr0 / sqrtMu * chi * (1.0 - alpha * chi2 * s)
+            + (1.0 - alpha * r0) * chi2 * c + r0;
+        double delta = f / df;
+        chi -= delta;
+        if (fabs(delta) <= KEPLER_TOLERANCE * fabs(chi)) {
+            converged = 1;
+            break;
+        }
+    }
+    if (!converged || !isfinite(chi)) return 0;
+
+    double chi2 = chi * chi;
+    stumpff(alpha * chi2, &c, &s);
+    double f = 1.0 - chi2 / r0 * c;
+    double g = dt - chi2 * chi / sqrtMu * s;
+    double nx = f * rx + g * *vx;
+    double ny = f * ry + g * *vy;
+    double r = sqrt(nx * nx + ny * ny);
+    double df = sqrtMu / (r * r0) * (alpha * chi2 * chi * s - chi);
+    double dg = 1.0 - chi2 / r * c;
+
+    double nvx = df * rx + dg * *vx;
+    double nvy = df * ry + dg * *vy;
+    *x = nx + mx;
+    *y = ny + my;
+    *vx = nvx;
+    *vy = nvy;
+    return 1;
+}
+
+// Advances satellite i over one frame with keplerPropagate, see --kepler
+int advanceSatelliteKepler(int i, int tmpMousePosX, int tmpMousePosY) {
+
+    double x = satellites.x[i];
+    double y = satellites.y[i];
+    double vx = satellites.vx[i];
+    double vy = satellites.vy[i];
+
+    if (!keplerPropagate(DELTATIME, tmpMousePosX, tmpMousePosY, &x, &y, &vx, &vy)) return 0;
+
+    satellites.x[i] = (float)x;
+    satellites.y[i] = (float)y;
+    satellites.vx[i] = (float)vx;
+    satellites.vy[i] = (float)vy;
+    return 1;
+}
+
+// Fallback for satellites the Kepler solver gives up on: the usual fixed
+// sub-step integration of that one satellite
+void advanceSatelliteNumerical(int i, int tmpMousePosX, int tmpMousePosY) {
+
+    const double mx = tmpMousePosX;
+    const double my = tmpMousePosY;
+    const double h = (double)DELTATIME / physicsSubsteps;
+
+    double x = satellites.x[i];
+    double y = satellites.y[i];
+    double vx = satellites.vx[i];
+    double vy = satellites.vy[i];
+    double ax, ay;
+    blackHoleAcceleration(x, y, mx, my, &ax, &ay);
+
+    for (int step = 0; step < physicsSubsteps; ++step) {
+        switch (integrator) {
+        case INTEGRATOR_LEAPFROG: leapfrogStep(h, mx, my, &x, &y, &vx, &vy, &ax, &ay); break;
+        case INTEGRATOR_YOSHIDA4: yoshida4Step(h, mx, my, &x, &y, &vx, &vy, &ax, &ay); break;
+        case INTEGRATOR_RK4:      rk4Step(h, mx, my, &x, &y, &vx, &vy, &ax, &ay); break;
+        default:                  eulerStep(h, mx, my, &x, &y, &vx, &vy, &ax, &ay); break;
+        }
+    }
+
+    satellites.x[i] = (float)x;
+    satellites.y[i] = (float)y;
+    satellites.vx[i] = (float)vx;
+    satellites.vy[i] = (float)vy;
+}
+
+// Mass of satellite i relative to the black hole, for the N-body mode:
+// nbodyMass on average, spread evenly over [0.5, 1.5) times that by a hash
+// of the index so every backend and run gets the same masses.
+double satelliteMass(int i) {
+    unsigned int h = (unsigned int)i * 2654435761u;
+    h ^= h >> 16;
+    h *= 2246822519u;
+    h ^= h >> 13;
+    return nbodyMass * (0.5 + (h & 0xffffff) / (double)0x1000000);
+}
+
+void nbodyStateAlloc(nbodystate* s, int count) {
+    s->count = count;
+    s->tiles = (count + NBODY_TILE - 1) / NBODY_TILE;
+    size_t bytes = sizeof(double) * s->tiles * NBODY_TILE;
+    s->x = (double*)alignedMalloc(bytes);
+    s->y = (double*)alignedMalloc(bytes);
+    s->vx = (double*)alignedMalloc(bytes);
+    s->vy = (double*)alignedMalloc(bytes);
+    s->ax = (double*)alignedMalloc(bytes);
+    s->ay = (double*)alignedMalloc(bytes);
+    s->mass = (double*)alignedMalloc(bytes);
+    for (int i = 0; i < s->tiles * NBODY_TILE; ++i) {
+        s->x[i] = s->y[i] = PADDING_POSITION;
+        s->vx[i] = s->vy[i] = 0.0;
+        s->mass[i] = i < count ? satelliteMass(i) : 0.0;
+    }
+
+    s->pm = NULL;
+    bhTreeAlloc(&s->tree, count);
+}
+
+void bhTreeAlloc(bhtree* tree, int count) {
+    // per-thread arrays cover every parallel region the program can start
+    int threads = omp_get_max_threads();
+    tree->code = (unsigned int*)alignedMalloc(sizeof(unsigned int) * count);
+    tree->codeTmp = (unsigned int*)alignedMalloc(sizeof(unsigned int) * count);
+    tree->order = (int*)alignedMalloc(sizeof(int) * count);
+    tree->orderTmp = (int*)alignedMalloc(sizeof(int) * count);
+    tree->x = (double*)alignedMalloc(sizeof(double) * count);
+    tree->y = (double*)alignedMalloc(sizeof(double) * count);
+    tree->mass = (double*)alignedMalloc(sizeof(double) * count);
+    tree->histogram = (int*)alignedMalloc(sizeof(int) * BH_RADIX * threads);
+    tree->bounds = (double*)alignedMalloc(sizeof(double) * 4 * threads);
+    // grown by bhTreeBuild when needed
+    tree->nodeCapacity = count / BH_LEAF_SIZE * 2 + 64;
+    tree->nodes = (bhnode*)malloc(sizeof(bhnode) * tree->nodeCapacity);
+}
+
+void nbodyStateFree(nbodystate* s) {
+    alignedFree(s->x);
+    alignedFree(s->y);
+    alignedFree(s->vx);
+    alignedFree(s->vy);
+    alignedFree(s->ax);
+    alignedFree(s->ay);
+    alignedFree(s->mass);
+    bhTreeFree(&s->tree);
+    if (s->pm) {
+        pmFree(s->pm);
+        free(s->pm);
+    }
+}
+
+void bhTreeFree(bhtree* tree) {
+    alignedFree(tree->code);
+    alignedFree(tree->codeTmp);
+    alignedFree(tree->order);
+    alignedFree(tree->orderTmp);
+    alignedFree(tree->x);
+    alignedFree(tree->y);
+    alignedFree(tree->mass);
+    alignedFree(tree->histogram);
+    alignedFree(tree->bounds);
+    free(tree->nodes);
+}
+
+// Mutual gravity within one tile. Each pair is evaluated once and applied
+// to both satellites (Newton's third law).
+static void nbodyTileSelf(nbodystate* s, int tile, double eps2) {
+    const int end = (tile + 1) * NBODY_TILE;
+    for (int i = tile * NBODY_TILE; i < end; ++i) {
+        double xi = s->x[i], yi = s->y[i], mi = s->mass[i];
+        double axi = 0.0, ayi = 0.0;
+#pragma omp simd reduction(+:axi,ayi)
+        for (int j = i + 1; j < end; ++j) {
+            double dx = s->x[j] - xi;
+            double dy = s->y[j] - yi;
+            double invd = 1.0 / sqrt(dx * dx + dy * dy + eps2);
+            double invd3 = invd * invd * invd;
+            axi += s->mass[j] * dx * invd3;
+            ayi += s->mass[j] * dy * invd3;
+            s->ax[j] -= mi * dx * invd3;
+            s->ay[j] -= mi * dy * invd3;
+        }
+        s->ax[i] += axi;
+        s->ay[i] += ayi;
+    }
+}
+
+// Mutual gravity between two different tiles, again once per pair. Both
+// tiles (2 * NBODY_TILE satellites) stay in L1 while their
+// NBODY_TILE^2 pairs are evaluated.
+static void nbodyTilePair(nbodystate* s, int a, int b, double eps2) {
+    const int j0 = b * NBODY_TILE;
+    const int j1 = j0 + NBODY_TILE;
+    for (int i = a * NBODY_TILE; i < (a + 1) * NBODY_TILE; ++i) {
+        double xi = s->x[i], yi = s->y[i], mi = s->mass[i];
+        double axi = 0.0, ayi = 0.0;
+#pragma omp simd reduction(+:axi,ayi)
+        for (int j = j0; j < j1; ++j) {
+            double dx = s->x[j] - xi;
+            double dy = s->y[j] - yi;
+            double invd = 1.0 / sqrt(dx * dx + dy * dy + eps2);
+            double invd3 = invd * invd * invd;
+            axi += s->mass[j] * dx * invd3;
+            ayi += s->mass[j] * dy * invd3;
+            s->ax[j] -= mi * dx * invd3;
+            s->ay[j] -= mi * dy * invd3;
+        }
+        s->ax[i] += axi;
+        s->ay[i] += ayi;
+    }
+}
+
+// Raw mutual gravity (without GRAVITY) of all satellites by direct summation.
+// Must be called by every thread of a parallel region.
+//
+// Because of the Newton's third law symmetry a tile pair writes to both of
+// its tiles, so two threads must never work on tile pairs sharing a tile.
+// The tile pairs are therefore scheduled as a round-robin tournament: in
+// each round every tile takes part in exactly one pair, the pairs of a
+// round run in parallel and rounds are separated by barriers. The sums are
+// accumulated in a fixed order, so the result is independent of the thread
+// count.
+void nbodyDirectGravity(nbodystate* s) {
+
+    const double eps2 = nbodySoftening * nbodySoftening;
+    const int padded = s->tiles * NBODY_TILE;
+    // An odd tile count gets a dummy tile; its pairs are skipped
+    const int players = s->tiles + (s->tiles & 1);
+    const int half = players / 2;
+    int i, t, k;
+
+#pragma omp for schedule(static)
+    for (i = 0; i < padded; ++i) {
+        s->ax[i] = 0.0;
+        s->ay[i] = 0.0;
+    }
+
+#pragma omp for schedule(static)
+    for (t = 0; t < s->tiles; ++t) {
+        nbodyTileSelf(s, t, eps2);
+    }
+
+    for (int round = 0; round < players - 1; ++round) {
+#pragma omp for schedule(dynamic)
+        for (k = 0; k < half; ++k) {
+            // Circle method: the last player stays put, the others rotate
+            int a = k == 0 ? players - 1 : (round + k) % (players - 1);
+            int b = (round - k + players - 1) % (players - 1);
+            if (a < s->tiles && b < s->tiles) {
+                nbodyTilePair(s, a, b, eps2);
+            }
+        }
+    }
+}
+
+// Spreads the low 16 bits of v to the even bit positions
+static inline unsigned int mortonSpread(unsigned int v) {
+    v &= 0xffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// First index in [begin, end) of the sorted codes whose quadrant digit at
+// 'shift' is at least 'digit'. The codes in the range share all higher bits.
+static int bhFindSplit(const unsigned int* code, int begin, int end, int shift, unsigned int digit) {
+    while (begin < end) {
+        int mid = begin + (end - begin) / 2;
+        if (((code[mid] >> shift) & 3u) < digit) begin = mid + 1;
+        else end = mid;
+    }
+    return begin;
+}
+
+// Builds the quadtree of points x, y (count of them) into 'tree'. Must be
+// called by every thread of a parallel region:
+//  1. points get 32 bit Morton codes in their common bounding square and
+//     are radix sorted by them (per-thread histograms, 4 x 8 bit passes)
+//  2. nodes are created one level at a time: a node is a range of the
+//     sorted points sharing a code prefix, and its children are found by
+//     binary search on the next 2 bits
+// Node masses and centers are left to the caller. Only plain OpenMP 2.0
+// worksharing is used, so MSVC can build it too.
+void bhTreeBuild(bhtree* tree, const double* x, const double* y, int count) {
+
+    const int thread = omp_get_thread_num();
+    const int threads = omp_get_num_threads();
+    const int lo = (int)((long long)count * thread / threads);
+    const int hi = (int)((long long)count * (thread + 1) / threads);
+    int i, n;
+
+    // 1. Bounding square, from per-thread partial bounds
+    double* bounds = &tree->bounds[4 * thread];
+    bounds[0] = bounds[1] = INFINITY;
+    bounds[2] = bounds[3] = -INFINITY;
+    for (i = lo; i < hi; ++i) {
+        if (x[i] < bounds[0]) bounds[0] = x[i];
+        if (y[i] < bounds[1]) bounds[1] = y[i];
+        if (x[i] > bounds[2]) bounds[2] = x[i];
+        if (y[i] > bounds[3]) bounds[3] = y[i];
+    }
+#pragma omp barrier
+#pragma omp single
+    {
+        double minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+        for (int t = 0; t < threads; ++t) {
+            if (tree->bounds[4 * t + 0] < minX) minX = tree->bounds[4 * t + 0];
+            if (tree->bounds[4 * t + 1] < minY) minY = tree->bounds[4 * t + 1];
+            if (tree->bounds[4 * t + 2] > maxX) maxX = tree->bounds[4 * t + 2];
+            if (tree->bounds[4 * t + 3] > maxY) maxY = tree->bounds[4 * t + 3];
+        }
+        double extent = maxX - minX > maxY - minY ? maxX - minX : maxY - minY;
+        tree->minX = minX;
+        tree->minY = minY;
+        // slightly larger, so the maximum coordinate still quantizes below 65536
+        tree->extent = extent > 0.0 ? extent * (1.0 + 1.0e-9) : 1.0;
+    }
+
+    const double scale = 65536.0 / tree->extent;
+#pragma omp for schedule(static)
+    for (i = 0; i < count; ++i) {
+        unsigned int qx = (unsigned int)((x[i] - tree->minX) * scale);
+        unsigned int qy = (unsigned int)((y[i] - tree->minY) * scale);
+        tree->code[i] = mortonSpread(qx) | (mortonSpread(qy) << 1);
+        tree->order[i] = i;
+    }
+
+    // Stable LSD radix sort. Each thread sorts its own static range of
+    // every pass into the positions given by the combined histograms.
+    // After the 4 passes the result is back in code and order.
+    int* histogram = &tree->histogram[BH_RADIX * thread];
+    for (int pass = 0; pass < 4; ++pass) {
+        const int shift = 8 * pass;
+        unsigned int* srcCode = pass & 1 ? tree->codeTmp : tree->code;
+        unsigned int* dstCode = pass & 1 ? tree->code : tree->codeTmp;
+        int* srcOrder = pass & 1 ? tree->orderTmp : tree->order;
+        int* dstOrder = pass & 1 ? tree->order : tree->orderTmp;
+
+        memset(histogram, 0, sizeof(int) * BH_RADIX);
+        for (i = lo; i < hi; ++i) {
+            ++histogram[(srcCode[i] >> shift) & (BH_RADIX - 1)];
+        }
+#pragma omp barrier
+#pragma omp single
+        {
+            int sum = 0;
+            for (int digit = 0; digit < BH_RADIX; ++digit) {
+                for (int t = 0; t < threads; ++t) {
+                    int c = tree->histogram[BH_RADIX * t + digit];
+                    tree->histogram[BH_RADIX * t + digit] = sum;
+                    sum += c;
+                }
+            }
+        }
+        for (i = lo; i < hi; ++i) {
+            int position = histogram[(srcCode[i] >> shift) & (BH_RADIX - 1)]++;
+            dstCode[position] = srcCode[i];
+            dstOrder[position] = srcOrder[i];
+        }
+#pragma omp barrier
+    }
+
+    // Sorted copies of the points, so tree walks read nearby memory
+#pragma omp for schedule(static)
+    for (i = 0; i < count; ++i) {
+        int j = tree->order[i];
+        tree->x[i] = x[j];
+        tree->y[i] = y[j];
+    }
+
+    // 2. Levels of nodes, breadth first
+#pragma omp single
+    {
+        bhnode root = { 0.0, 0.0, 0.0, tree->extent, 0, count, -1, 0 };
+        tree->nodes[0] = root;
+        tree->levelStart[0] = 0;
+        tree->levelStart[1] = 1;
+        tree->levels = 1;
+    }
+    for (int level = 0; level < BH_LEVELS; ++level) {
+        const int first = tree->levelStart[level];
+        const int last = tree->levelStart[level + 1];
+        const int shift = 2 * (BH_LEVELS - 1 - level);
+
+        // number of non-empty quadrants of every node to split
+#pragma omp for schedule(static)
+        for (n = first; n < last; ++n) {
+            bhnode* node = &tree->nodes[n];
+            node->children = 0;
+            if (node->end - node->begin <= BH_LEAF_SIZE) continue;
+            int previous = node->begin;
+            for (unsigned int digit = 1; digit <= 4; ++digit) {
+                int split = digit < 4 ? bhFindSplit(tree->code, previous, node->end, shift, digit) : node->end;
+                if (split > previous) ++node->children;
+                previous = split;
+            }
+        }
+#pragma omp single
+        {
+            int next = last;
+            for (int m = first; m < last; ++m) {
+                tree->nodes[m].child = tree->nodes[m].children ? next : -1;
+                next += tree->nodes[m].children;
+            }
+            if (next > tree->nodeCapacity) {
+                tree->nodeCapacity = next * 2;
+                tree->nodes = (bhnode*)realloc(tree->nodes, sizeof(bhnode) * tree->nodeCapacity);
+                if (!tree->nodes) {
+                    fprintf(stderr, "Failed to allocate %d tree nodes\n", tree->nodeCapacity);
+                    exit(1);
+                }
+            }
+            tree->levelStart[level + 2] = next;
+            if (next > last) tree->levels = level + 2;
+        }
+        if (tree->levelStart[level + 2] == last) break;
+
+#pragma omp for schedule(static)
+        for (n = first; n < last; ++n) {
+            bhnode node = tree->nodes[n];
+            if (node.child < 0) continue;
+            int previous = node.begin;
+            int slot = node.child;
+            for (unsigned int digit = 1; digit <= 4; ++digit) {
+                int split = digit < 4 ? bhFindSplit(tree->code, previous, node.end, shift, digit) : node.end;
+                if (split > previous) {
+                    bhnode child = { 0.0, 0.0, 0.0, node.size * 0.5, previous, split, -1, 0 };
+                    tree->nodes[slot++] = child;
+                }
+                previous = split;
+            }
+        }
+    }
+}
+
+// Raw mutual gravity (without GRAVITY) of all satellites from a Barnes-Hut
+// quadtree. Must be called by every thread of a parallel region. The tree
+// is rebuilt on every call (bhTreeBuild), then
+//  3. masses and centers of mass are summed from the deepest level up
+//  4. every satellite walks the tree, using a node's center of mass when the
+//     node appears smaller than nbodyTheta radians, and direct sums in leaves
+void nbodyTreeGravity(nbodystate* s) {
+
+    bhtree* tree = &s->tree;
+    const int count = s->count;
+    const double eps2 = nbodySoftening * nbodySoftening;
+    const double theta2 = nbodyTheta * nbodyTheta;
+    int i, n;
+
+    bhTreeBuild(tree, s->x, s->y, count);
+#pragma omp for schedule(static)
+    for (i = 0; i < count; ++i) {
+        tree->mass[i] = s->mass[tree->order[i]];
+    }
+
+    // 3. Masses and centers of mass, deepest level first
+    for (int level = tree->levels - 1; level >= 0; --level) {
+#pragma omp for schedule(static)
+        for (n = tree->levelStart[level]; n < tree->levelStart[level + 1]; ++n) {
+            bhnode* node = &tree->nodes[n];
+            double m = 0.0, mx = 0.0, my = 0.0;
+            if (node->child < 0) {
+                for (int j = node->begin; j < node->end; ++j) {
+                    m += tree->mass[j];
+                    mx += tree->mass[j] * tree->x[j];
+                    my += tree->mass[j] * tree->y[j];
+                }
+            } else {
+                for (int c = node->child; c < node->child + node->children; ++c) {
+                    m += tree->nodes[c].mass;
+                    mx += tree->nodes[c].mass * tree->nodes[c].cx;
+                    my += tree->nodes[c].mass * tree->nodes[c].cy;
+                }
+            }
+            node->mass = m;
+            // massless nodes pull nothing, any point inside will do
+            node->cx = m > 0.0 ? mx / m : tree->x[node->begin];
+            node->cy = m > 0.0 ? my / m : tree->y[node->begin];
+        }
+    }
+
+    // 4. Tree walks in sorted order, so neighbouring iterations share nodes
+#pragma omp for schedule(dynamic, BH_WALK_CHUNK)
+    for (i = 0; i < count; ++i) {
+        const double xi = tree->x[i], yi = tree->y[i];
+        double axi = 0.0, ayi = 0.0;
+        int stack[3 * BH_LEVELS + 4];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const bhnode* node = &tree->nodes[stack[--top]];
+            double dx = node->cx - xi;
+            double dy = node->cy - yi;
+            double d2 = dx * dx + dy * dy;
+            // a node holding satellite i is never a monopole, else i would
+            // pull on itself for theta above 1/sqrt(2)
+            const int holdsSelf = node->begin <= i && i < node->end;
+            if (!holdsSelf && node->size * node->size < theta2 * d2) {
+                double invd = 1.0 / sqrt(d2 + eps2);
+                double s3 = node->mass * invd * invd * invd;
+                axi += dx * s3;
+                ayi += dy * s3;
+            } else if (node->child < 0) {
+                for (int j = node->begin; j < node->end; ++j) {
+                    if (j == i) continue;
+                    double ex = tree->x[j] - xi;
+                    double ey = tree->y[j] - yi;
+                    double invd = 1.0 / sqrt(ex * ex + ey * ey + eps2);
+                    double s3 = tree->mass[j] * invd * invd * invd;
+                    axi += ex * s3;
+                    ayi += ey * s3;
+                }
+            } else {
+                for (int c = node->child; c < node->child + node->children; ++c) {
+                    stack[top++] = c;
+                }
+            }
+        }
+        s->ax[tree->order[i]] = axi;
+        s->ay[tree->order[i]] = ayi;
+    }
+}
+
+// In-place radix-2 complex FFT of one row of pm->padded values with the
+// twiddle and bit reversal tables of the grid. Unnormalized in both
+// directions.
+static void pmFFT(double* re, double* im, const pmgrid* pm, int inverse) {
+    const int n = pm->padded;
+    for (int i = 0; i < n; ++i) {
+        int j = pm->bitrev[i];
+        if (j > i) {
+            double t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        const int half = len / 2;
+        const int step = n / len;
+        for (int k = 0; k < half; ++k) {
+            const double wr = pm->cosTable[k * step];
+            const double wi = inverse ? pm->sinTable[k * step] : -pm->sinTable[k * step];
+            for (int i = 0; i < n; i += len) {
+                int a = i + k, b = a + half;
+                double tr = re[b] * wr - im[b] * wi;
+                double ti = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+// FFTs of rows [0, rows) of a padded x padded array, in parallel over rows.
+// Must be called by every thread of a parallel region.
+static void pmRowFFTs(pmgrid* pm, double* re, double* im, int rows, int inverse) {
+    int row;
+#pragma omp for schedule(static)
+    for (row = 0; row < rows; ++row) {
+        pmFFT(&re[(size_t)row * pm->padded], &im[(size_t)row * pm->padded], pm, inverse);
+    }
+}
+
+// Blocked transpose of a padded x padded array. Must be called by every
+// thread of a parallel region.
+static void pmTranspose(pmgrid* pm, const double* srcRe, const double* srcIm, double* dstRe, double* dstIm) {
+    const int n = pm->padded;
+    int block;
+#pragma omp for schedule(static)
+    for (block = 0; block < n; block += PM_TRANSPOSE_BLOCK) {
+        for (int col = 0; col < n; col += PM_TRANSPOSE_BLOCK) {
+            for (int r = block; r < block + PM_TRANSPOSE_BLOCK; ++r) {
+                for (int c = col; c < col + PM_TRANSPOSE_BLOCK; ++c) {
+                    dstRe[(size_t)c * n + r] = srcRe[(size_t)r * n + c];
+                    dstIm[(size_t)c * n + r] = srcIm[(size_t)r * n + c];
+                }
+            }
+        }
+    }
+}
+
+// Forward 2D FFT of the real grid in 'a' (only the first 'rows' rows are
+// non-zero) into 'b' in transposed layout. Must be called by every thread
+// of a parallel region.
+static void pmForward2D(pmgrid* pm, int rows) {
+    pmRowFFTs(pm, pm->aRe, pm->aIm, rows, 0);
+    pmTranspose(pm, pm->aRe, pm->aIm, pm->bRe, pm->bIm);
+    pmRowFFTs(pm, pm->bRe, pm->bIm, pm->padded, 0);
+}
+
+// Allocates a particle-mesh solver with gridSize x gridSize cells over the
+// square PM_DOMAIN pixels wide around the window center, for up to 'count'
+// satellites, and transforms its Green's function.
+void pmAlloc(pmgrid* pm, int gridSize, int count) {
+    const int threads = omp_get_max_threads();
+    const size_t paddedCells = (size_t)4 * gridSize * gridSize;
+
+    pm->size = gridSize;
+    pm->padded = 2 * gridSize;
+    pm->cell = PM_DOMAIN / gridSize;
+    pm->x0 = WINDOW_WIDTH / 2 - PM_DOMAIN / 2;
+    pm->y0 = WINDOW_HEIGHT / 2 - PM_DOMAIN / 2;
+    pm->strips = gridSize / PM_STRIP_ROWS;
+    pm->aRe = (double*)alignedMalloc(sizeof(double) * paddedCells);
+    pm->aIm = (double*)alignedMalloc(sizeof(double) * paddedCells);
+    pm->bRe = (double*)alignedMalloc(sizeof(double) * paddedCells);
+    pm->bIm = (double*)alignedMalloc(sizeof(double) * paddedCells);
+    pm->greenRe = (double*)alignedMalloc(sizeof(double) * paddedCells);
+    pm->greenIm = (double*)alignedMalloc(sizeof(double) * paddedCells);
+    pm->fx = (double*)alignedMalloc(sizeof(double) * gridSize * gridSize);
+    pm->fy = (double*)alignedMalloc(sizeof(double) * gridSize * gridSize);
+    pm->cosTable = (double*)alignedMalloc(sizeof(double) * pm->padded / 2);
+    pm->sinTable = (double*)alignedMalloc(sizeof(double) * pm->padded / 2);
+    pm->bitrev = (int*)alignedMalloc(sizeof(int) * pm->padded);
+    pm->sorted = (int*)alignedMalloc(sizeof(int) * (count > 0 ? count : 1));
+    pm->stripStart = (int*)alignedMalloc(sizeof(int) * (pm->strips + 1));
+    pm->stripHistogram = (int*)alignedMalloc(sizeof(int) * pm->strips * threads);
+
+    const double pi = 3.14159265358979323846;
+    for (int k = 0; k < pm->padded / 2; ++k) {
+        pm->cosTable[k] = cos(2.0 * pi * k / pm->padded);
+        pm->sinTable[k] = sin(2.0 * pi * k / pm->padded);
+    }
+    int bits = 0;
+    while ((1 << bits) < pm->padded) ++bits;
+    for (int i = 0; i < pm->padded; ++i) {
+        int r = 0;
+        for (int b = 0; b < bits; ++b) r |= ((i >> b) & 1) << (bits - 1 - b);
+        pm->bitrev[i] = r;
+    }
+
+    // Softened Newtonian potential of a unit mass, laid out with wrap-around
+    // so that the cyclic convolution of the zero padded grid is the
+    // isolated one. The grid does not resolve anything below a cell, and
+    // half a cell keeps the self term finite.
+    const double eps = nbodySoftening > 0.5 * pm->cell ? nbodySoftening : 0.5 * pm->cell;
+    const int n = pm->padded;
+    for (int r = 0; r < n; ++r) {
+        double dy = (r < gridSize ? r : r - n) * pm->cell;
+        for (int c = 0; c < n; ++c) {
+            double dx = (c < gridSize ? c : c - n) * pm->cell;
+            pm->aRe[(size_t)r * n + c] = -1.0 / sqrt(dx * dx + dy * dy + eps * eps);
+            pm->aIm[(size_t)r * n + c] = 0.0;
+        }
+    }
+#pragma omp parallel
+    pmForward2D(pm, n);
+    memcpy(pm->greenRe, pm->bRe, sizeof(double) * paddedCells);
+    memcpy(pm->greenIm, pm->bIm, sizeof(double) * paddedCells);
+}
+
+void pmFree(pmgrid* pm) {
+    alignedFree(pm->aRe);
+    alignedFree(pm->aIm);
+    alignedFree(pm->bRe);
+    alignedFree(pm->bIm);
+    alignedFree(pm->greenRe);
+    alignedFree(pm->greenIm);
+    alignedFree(pm->fx);
+    alignedFree(pm->fy);
+    alignedFree(pm->cosTable);
+    alignedFree(pm->sinTable);
+    alignedFree(pm->bitrev);
+    alignedFree(pm->sorted);
+    alignedFree(pm->stripStart);
+    alignedFree(pm->stripHistogram);
+}
+
+// Cloud-in-cell footprint of a satellite: the lower left of its 2 x 2
+// cells and the weight of the upper right ones. Returns 0 outside the grid.
+static inline int pmFootprint(const pmgrid* pm, double x, double y, int* col, int* row, double* wx, double* wy) {
+    double u = (x - pm->x0) / pm->cell - 0.5;
+    double v = (y - pm->y0) / pm->cell - 0.5;
+    if (!(u >= 0.0 && v >= 0.0 && u < pm->size - 1 && v < pm->size - 1)) return 0;
+    *col = (int)u;
+    *row = (int)v;
+    *wx = u - *col;
+    *wy = v - *row;
+    return 1;
+}
+
+// Raw mutual gravity (without GRAVITY) of all satellites with the
+// particle-mesh method. Must be called by every thread of a parallel region.
+//  1. masses are deposited on the grid with cloud-in-cell weights; the
+//     satellites are bucketed by strips of PM_STRIP_ROWS rows, and even and
+//     odd strips are deposited in two parallel passes, so no two threads
+//     write the same cell
+//  2. the potential is the convolution of the mass grid with the Green's
+//     function, done with zero padded 2D FFTs (rows in parallel, a
+//     transpose, rows again), so there are no periodic images
+//  3. grid accelerations are central differences of the potential and are
+//     interpolated back to the satellites with the same weights
+// Satellites outside the PM_DOMAIN square feel no mutual gravity (only the
+// black hole) and do not contribute any.
+void nbodyPMGravity(nbodystate* s, pmgrid* pm) {
+
+    const int count = s->count;
+    const int size = pm->size;
+    const int n = pm->padded;
+    const int thread = omp_get_thread_num();
+    const int threads = omp_get_num_threads();
+    const int lo = (int)((long long)count * thread / threads);
+    const int hi = (int)((long long)count * (thread + 1) / threads);
+    int i, r;
+
+    // 1. Bucket the satellites by strip, keeping their order within a strip
+    int* histogram = &pm->stripHistogram[pm->strips * thread];
+    memset(histogram, 0, sizeof(int) * pm->strips);
+    for (i = lo; i < hi; ++i) {
+        int col, row;
+        double wx, wy;
+        if (pmFootprint(pm, s->x[i], s->y[i], &col, &row, &wx, &wy)) {
+            ++histogram[row / PM_STRIP_ROWS];
+        }
+    }
+#pragma omp barrier
+#pragma omp single
+    {
+        int sum = 0;
+        for (int strip = 0; strip < pm->strips; ++strip) {
+            pm->stripStart[strip] = sum;
+            for (int t = 0; t < threads; ++t) {
+                int c = pm->stripHistogram[pm->strips * t + strip];
+                pm->stripHistogram[pm->strips * t + strip] = sum;
+                sum += c;
+            }
+        }
+        pm->stripStart[pm->strips] = sum;
+    }
+    for (i = lo; i < hi; ++i) {
+        int col, row;
+        double wx, wy;
+        if (pmFootprint(pm, s->x[i], s->y[i], &col, &row, &wx, &wy)) {
+            pm->sorted[histogram[row / PM_STRIP_ROWS]++] = i;
+        }
+    }
+
+#pragma omp for schedule(static)
+    for (r = 0; r < n; ++r) {
+        memset(&pm->aRe[(size_t)r * n], 0, sizeof(double) * n);
+        memset(&pm->aIm[(size_t)r * n], 0, sizeof(double) * n);
+    }
+
+    // A footprint covers its own row and the next, which is at most in the
+    // following strip, so strips two apart never touch the same cells
+    for (int parity = 0; parity < 2; ++parity) {
+        int strip;
+#pragma omp for schedule(dynamic)
+        for (strip = parity; strip < pm->strips; strip += 2) {
+            for (int k = pm->stripStart[strip]; k < pm->stripStart[strip + 1]; ++k) {
+                int j = pm->sorted[k];
+                int col, row;
+                double wx, wy;
+                if (!pmFootprint(pm, s->x[j], s->y[j], &col, &row, &wx, &wy)) continue;
+                double* cell = &pm->aRe[(size_t)row * n + col];
+                double m = s->mass[j];
+                cell[0] += m * (1.0 - wx) * (1.0 - wy);
+                cell[1] += m * wx * (1.0 - wy);
+                cell[n] += m * (1.0 - wx) * wy;
+                cell[n + 1] += m * wx * wy;
+            }
+        }
+    }
+
+    // 2. Potential by FFT convolution. The product stays in transposed
+    // layout and the inverse transform transposes it back.
+    pmForward2D(pm, size);
+#pragma omp for schedule(static)
+    for (r = 0; r < n; ++r) {
+        for (size_t c = (size_t)r * n; c < (size_t)(r + 1) * n; ++c) {
+            double re = pm->bRe[c] * pm->greenRe[c] - pm->bIm[c] * pm->greenIm[c];
+            double im = pm->bRe[c] * pm->greenIm[c] + pm->bIm[c] * pm->greenRe[c];
+            pm->bRe[c] = re;
+            pm->bIm[c] = im;
+        }
+    }
+    pmRowFFTs(pm, pm->bRe, pm->bIm, n, 1);
+    pmTranspose(pm, pm->bRe, pm->bIm, pm->aRe, pm->aIm);
+    pmRowFFTs(pm, pm->aRe, pm->aIm, size, 1);
+
+    // 3. Accelerations on the grid, -grad(potential), one-sided at the edges
+    const double scale = 1.0 / ((double)n * n * pm->cell);
+#pragma omp for schedule(static)
+    for (r = 0; r < size; ++r) {
+        const double* phi = &pm->aRe[(size_t)r * n];
+        const double* below = &pm->aRe[(size_t)(r > 0 ? r - 1 : r) * n];
+        const double* above = &pm->aRe[(size_t)(r < size - 1 ? r + 1 : r) * n];
+        const double dyScale = r > 0 && r < size - 1 ? 0.5 * scale : scale;
+        for (int col = 0; col < size; ++col) {
+            int left = col > 0 ? col - 1 : col;
+            int right = col < size - 1 ? col + 1 : col;
+            double dxScale = col > 0 && col < size - 1 ? 0.5 * scale : scale;
+            pm->fx[(size_t)r * size + col] = -(phi[right] - phi[left]) * dxScale;
+            pm->fy[(size_t)r * size + col] = -(above[col] - below[col]) * dyScale;
+        }
+    }
+
+#pragma omp for schedule(static)
+    for (i = 0; i < count; ++i) {
+        int col, row;
+        double wx, wy;
+        if (!pmFootprint(pm, s->x[i], s->y[i], &col, &row, &wx, &wy)) {
+            s->ax[i] = 0.0;
+            s->ay[i] = 0.0;
+            continue;
+        }
+        size_t cell = (size_t)row * size + col;
+        s->ax[i] = pm->fx[cell] * (1.0 - wx) * (1.0 - wy) + pm->fx[cell + 1] * wx * (1.0 - wy)
+            + pm->fx[cell + size] * (1.0 - wx) * wy + pm->fx[cell + size + 1] * wx * wy;
+        s->ay[i] = pm->fy[cell] * (1.0 - wx) * (1.0 - wy) + pm->fy[cell + 1] * wx * (1.0 - wy)
+            + pm->fy[cell + size] * (1.0 - wx) * wy + pm->fy[cell + size + 1] * wx * wy;
+    }
+}
+
+// Accelerations of all satellites: softened mutual gravity from the
+// selected solver plus the black hole at (mx, my). Must be called by every
+// thread of a parallel region.
+void nbodyAccelerations(nbodystate* s, double mx, double my) {
+    int i;
+
+    if (nbodySolver == NBODY_BARNESHUT) {
+        nbodyTreeGravity(s);
+    } else if (nbodySolver == NBODY_PM) {
+        nbodyPMGravity(s, s->pm);
+    } else {
+        nbodyDirectGravity(s);
+    }
+
+#pragma omp for schedule(static)
+    for (i = 0; i < s->count; ++i) {
+        double bx, by;
+        blackHoleAcceleration(s->x[i], s->y[i], mx, my, &bx, &by);
+        s->ax[i] = GRAVITY * s->ax[i] + bx;
+        s->ay[i] = GRAVITY * s->ay[i] + by;
+    }
+}
+
+// Advances all satellites by one frame with physicsSubsteps kick-drift-kick
+// leapfrog steps under the black hole and the satellites' mutual gravity.
+// Returns the number of interactions, N * (N - 1) per force evaluation: what
+// a direct sum computes, of which the symmetric kernel evaluates half.
+double nbodyAdvance(int tmpMousePosX, int tmpMousePosY) {
+
+    nbodystate* s = &nbody;
+    const double h = (double)DELTATIME / physicsSubsteps;
+    const double mx = tmpMousePosX;
+    const double my = tmpMousePosY;
+    int i;
+
+    for (i = 0; i < s->count; ++i) {
+        s->x[i] = satellites.x[i];
+        s->y[i] = satellites.y[i];
+        s->vx[i] = satellites.vx[i];
+        s->vy[i] = satellites.vy[i];
+    }
+
+#pragma omp parallel
+    {
+        nbodyAccelerations(s, mx, my);
+        for (int step = 0; step < physicsSubsteps; ++step) {
+#pragma omp for schedule(static)
+            for (i = 0; i < s->count; ++i) {
+                s->vx[i] += s->ax[i] * (0.5 * h);
+                s->vy[i] += s->ay[i] * (0.5 * h);
+                s->x[i] += s->vx[i] * h;
+                s->y[i] += s->vy[i] * h;
+            }
+            nbodyAccelerations(s, mx, my);
+#pragma omp for schedule(static)
+            for (i = 0; i < s->count; ++i) {
+                s->vx[i] += s->ax[i] * (0.5 * h);
+                s->vy[i] += s->ay[i] * (0.5 * h);
+            }
+        }
+    }
+
+    for (i = 0; i < s->count; ++i) {
+        satellites.x[i] = (float)s->x[i];
+        satellites.y[i] = (float)s->y[i];
+        satellites.vx[i] = (float)s->vx[i];
+        satellites.vy[i] = (float)s->vy[i];
+    }
+
+    return s->count * (s->count - 1.0) * (physicsSubsteps + 1);
+}
+
+// Times a force evaluation of the given solver, repeated until the timing
+// is long enough to be meaningful. Returns seconds per evaluation.
+double nbodyTimeSolver(nbodystate* s, nbodysolver solver) {
+    int evaluations = 0;
+    double start = omp_get_wtime(), seconds;
+    do {
+#pragma omp parallel
+        {
+            if (solver == NBODY_BARNESHUT) nbodyTreeGravity(s);
+            else if (solver == NBODY_PM) nbodyPMGravity(s, s->pm);
+            else nbodyDirectGravity(s);
+        }
+        ++evaluations;
+        seconds = omp_get_wtime() - start;
+    } while (seconds < 0.5);
+    return seconds / evaluations;
+}
+
+// Relative error of the last computed forces against direct sums at
+// NBODY_BENCHMARK_SAMPLES evenly spread satellites
+void nbodySampleError(const nbodystate* s, double* rmsError, double* maxError) {
+    const double eps2 = nbodySoftening * nbodySoftening;
+    int samples = s->count < NBODY_BENCHMARK_SAMPLES ? s->count : NBODY_BENCHMARK_SAMPLES;
+    double sumSquares = 0.0;
+    *maxError = 0.0;
+    for (int k = 0; k < samples; ++k) {
+        int i = (int)((long long)s->count * k / samples);
+        double ax = 0.0, ay = 0.0;
+        for (int j = 0; j < s->count; ++j) {
+            if (j == i) continue;
+            double dx = s->x[j] - s->x[i];
+            double dy = s->y[j] - s->y[i];
+            double invd = 1.0 / sqrt(dx * dx + dy * dy + eps2);
+            ax += s->mass[j] * dx * invd * invd * invd;
+            ay += s->mass[j] * dy * invd * invd * invd;
+        }
+        double ex = s->ax[i] - ax, ey = s->ay[i] - ay;
+        double error = sqrt((ex * ex + ey * ey) / (ax * ax + ay * ay));
+        sumSquares += error * error;
+        if (!(error <= *maxError)) *maxError = error;
+    }
+    *rmsError = sqrt(sumSquares / samples);
+}
+
+// Satellites at random positions in the window, from an own generator so
+// the benchmark leaves rand() and the seed alone
+void nbodyRandomState(nbodystate* s, int count) {
+    nbodyStateAlloc(s, count);
+    unsigned int lcg = 12345u;
+    for (int i = 0; i < s->count; ++i) {
+        lcg = lcg * 1664525u + 1013904223u;
+        s->x[i] = (lcg >> 8) / 16777216.0 * WINDOW_WIDTH;
+        lcg = lcg * 1664525u + 1013904223u;
+        s->y[i] = (lcg >> 8) / 16777216.0 * WINDOW_HEIGHT;
+    }
+}
+
+// Compares the solvers for a range of satellite counts with random
+// positions, see --nbody-benchmark. Throughput counts N * (N - 1)
+// interactions per evaluation as in nbodyAdvance. The direct sum is timed
+// up to NBODY_BENCHMARK_DIRECT_MAX satellites, and the errors of the
+// approximate solvers are measured with nbodySampleError. The particle-mesh
+// solver is listed per grid size, as its cost depends on both.
+void nbodyThroughputBenchmark(void) {
+
+    const int counts[] = { 1024, 4096, 16384, 65536, 262144, 1048576 };
+    const int numCounts = (int)(sizeof(counts) / sizeof(counts[0]));
+    const int grids[] = { 128, 256, 512, 1024 };
+    const int numGrids = (int)(sizeof(grids) / sizeof(grids[0]));
+    double rmsError, maxError;
+
+    printf("N-body solvers, %d threads, softening %g, theta %g\n",
+        omp_get_max_threads(), nbodySoftening, nbodyTheta);
+    printf("  satellites   direct ms  interactions/s | barneshut ms  interactions/s  rms error  max error\n");
+
+    for (int c = 0; c < numCounts; ++c) {
+        nbodystate s;
+        nbodyRandomState(&s, counts[c]);
+        const double interactions = s.count * (s.count - 1.0);
+
+        printf("  %10d", s.count);
+        if (s.count <= NBODY_BENCHMARK_DIRECT_MAX) {
+            double seconds = nbodyTimeSolver(&s, NBODY_DIRECT);
+            printf("  %10.2f  %14.3e |", seconds * 1000.0, interactions / seconds);
+        } else {
+            printf("  %10s  %14s |", "-", "-");
+        }
+
+        double seconds = nbodyTimeSolver(&s, NBODY_BARNESHUT);
+        nbodySampleError(&s, &rmsError, &maxError);
+        printf("  %11.2f  %14.3e  %9.2e  %9.2e\n", seconds * 1000.0, interactions / seconds,
+            rmsError, maxError);
+        nbodyStateFree(&s);
+    }
+
+    printf("  satellites        grid      pm ms  interactions/s  rms error  max error\n");
+    for (int c = 0; c < numCounts; c += 2) {
+        nbodystate s;
+        nbodyRandomState(&s, counts[c]);
+        const double interactions = s.count * (s.count - 1.0);
+        s.pm = (pmgrid*)malloc(sizeof(pmgrid));
+        for (int g = 0; g < numGrids; ++g) {
+            pmAlloc(s.pm, grids[g], s.count);
+            double seconds = nbodyTimeSolver(&s, NBODY_PM);
+            nbodySampleError(&s, &rmsError, &maxError);
+            printf("  %10d  %4d x %-4d  %9.2f  %14.3e  %9.2e  %9.2e\n", s.count, grids[g], grids[g],
+                seconds * 1000.0, interactions / seconds, rmsError, maxError);
+            pmFree(s.pm);
+        }
+        free(s.pm);
+        s.pm = NULL;
+        nbodyStateFree(&s);
+    }
+}
+
+// Physics for one block of PHYSICS_LANES satellites with the integrator
+// selected by --integrator (other than Euler, which has its own kernels)
+void advanceBlockIntegrator(int block, int tmpMousePosX, int tmpMousePosY) {
+
+    double x[PHYSICS_LANES], y[PHYSICS_LANES];
+    double vx[PHYSICS_LANES], vy[PHYSICS_LANES];
+
+    for (int k = 0; k < PHYSICS_LANES; ++k) {
+        x[k] = satellites.x[block + k];
+        y[k] = satellites.y[block + k];
+        vx[k] = satellites.vx[block + k];
+        vy[k] = satellites.vy[block + k];
+    }
+
+    integrateLanes(integrator, physicsSubsteps, tmpMousePosX, tmpMousePosY, x, y, vx, vy);
+
+    for (int k = 0; k < PHYSICS_LANES; ++k) {
+        satellites.x[block + k] = (float)x[k];
+        satellites.y[block + k] = (float)y[k];
+        satellites.vx[block + k] = (float)vx[k];
+        satellites.vy[block + k] = (float)vy[k];
+    }
+}
+
+// Integrates the first satellites for ACCURACY_REPORT_FRAMES frames around a
+// fixed black hole with every integrator at the selected sub-step count, and
+// prints the position error against an RK4 reference with
+// ACCURACY_REFERENCE_SUBSTEPS steps per frame. The analytic Kepler
+// propagation is listed last.
+void integratorAccuracyReport(void) {
+
+    int count = satellites.count < ACCURACY_REPORT_SATELLITES ? satellites.count : ACCURACY_REPORT_SATELLITES;
+    int padded = (count + PHYSICS_LANES - 1) / PHYSICS_LANES * PHYSICS_LANES;
+    const double mx = WINDOW_WIDTH / 2;
+    const double my = WINDOW_HEIGHT / 2;
+
+    // [0] is the reference, [1 + kind] the integrators under test, the last one Kepler
+    double* state[2 + INTEGRATOR_COUNT][4];
+    for (int run = 0; run < 2 + INTEGRATOR_COUNT; ++run) {
+        for (int component = 0; component < 4; ++component) {
+            state[run][component] = (double*)alignedMalloc(sizeof(double) * padded);
+        }
+        for (int i = 0; i < padded; ++i) {
+            state[run][0][i] = satellites.x[i];
+            state[run][1][i] = satellites.y[i];
+            state[run][2][i] = satellites.vx[i];
+            state[run][3][i] = satellites.vy[i];
+        }
+    }
+
+    printf("Integrator accuracy over %d frames, %d satellites, reference rk4 with %d steps per frame\n",
+        ACCURACY_REPORT_FRAMES, count, ACCURACY_REFERENCE_SUBSTEPS);
+
+    for (int run = 0; run < 2 + INTEGRATOR_COUNT; ++run) {
+        int kepler = run == 1 + INTEGRATOR_COUNT;
+        integratorkind kind = run == 0 ? INTEGRATOR_RK4 : (integratorkind)(run - 1);
+        int steps = run == 0 ? ACCURACY_REFERENCE_SUBSTEPS : physicsSubsteps;
+        double start = omp_get_wtime();
+
+        int block;
+#pragma omp parallel for schedule(dynamic)
+        for (block = 0; block < padded; block += PHYSICS_LANES) {
+            for (int frame = 0; frame < ACCURACY_REPORT_FRAMES; ++frame) {
+                if (kepler) {
+                    for (int i = block; i < block + PHYSICS_LANES; ++i) {
+                        keplerPropagate(DELTATIME, mx, my, &state[run][0][i], &state[run][1][i],
+                            &state[run][2][i], &state[run][3][i]);
+                    }
+                } else {
+                    integrateLanes(kind, steps, mx, my, &state[run][0][block], &state[run][1][block],
+                        &state[run][2][block], &state[run][3][block]);
+                }
+            }
+        }
+        double seconds = omp_get_wtime() - start;
+        if (run == 0) continue;
+
+        double maxError = 0.0, sumSquares = 0.0;
+        for (int i = 0; i < count; ++i) {
+            double ex = state[run][0][i] - state[0][0][i];
+            double ey = state[run][1][i] - state[0][1][i];
+            double error = sqrt(ex * ex + ey * ey);
+            if (!(error <= maxError)) maxError = error; // also catches NaN
+            sumSquares += error * error;
+        }
+        if (kepler) {
+            printf("  %-9s analytic, one solve per frame:          max error %.3e px, rms %.3e px, %.1f ms\n",
+                "kepler", maxError, sqrt(sumSquares / count), seconds * 1000.0);
+        } else {
+            printf("  %-9s %7d steps, %8d force evaluations/frame: max error %.3e px, rms %.3e px, %.1f ms\n",
+                integratorNames[kind], steps, steps * integratorForceEvaluations[kind],
+                maxError, sqrt(sumSquares / count), seconds * 1000.0);
+        }
+    }
+
+    for (int run = 0; run < 2 + INTEGRATOR_COUNT; ++run) {
+        for (int component = 0; component < 4; ++component) {
+            alignedFree(state[run][component]);
+        }
+    }
+}
+
+// Physics for one block of PHYSICS_LANES satellites, portable version.
+// The inner loop runs across the satellites of the block, so the compiler
+// can vectorize it.
+void advanceBlockScalar(int block, int tmpMousePosX, int tmpMousePosY) {
+
+    const double dt = (double)DELTATIME / (double)physicsSubsteps;
+
+    // double precision required for accumulation inside this routine,
+    // but float storage is ok outside these loops.
+    // Work in registers to avoid false sharing
+    double x[PHYSICS_LANES], y[PHYSICS_LANES];
+    double vx[PHYSICS_LANES], vy[PHYSICS_LANES];
+
+    for (int k = 0; k < PHYSICS_LANES; ++k) {
+        x[k] = satellites.x[block + k];
+        y[k] = satellites.y[block + k];
+        vx[k] = satellites.vx[block + k];
+        vy[k] = satellites.vy[block + k];
+    }
+
+    int physicsUpdateIndex;
+    if (physicsExact) {
+        for (physicsUpdateIndex = 0;
+            physicsUpdateIndex < physicsSubsteps;
+            ++physicsUpdateIndex)
+        {
+            // Same expressions as sequentialPhysicsEngine
+#pragma omp simd
+            for (int k = 0; k < PHYSICS_LANES; ++k) {
+                double dx = x[k] - tmpMousePosX;
+                double dy = y[k] - tmpMousePosY;
+                double d2 = dx * dx + dy * dy;
+                double dist = sqrt(d2);
+
+                double accumulation = GRAVITY / d2;
+                vx[k] -= accumulation * (dx / dist) * DELTATIME / physicsSubsteps;
+                vy[k] -= accumulation * (dy / dist) * DELTATIME / physicsSubsteps;
+
+                x[k] += vx[k] * DELTATIME / physicsSubsteps;
+                y[k] += vy[k] * DELTATIME / physicsSubsteps;
+            }
+        }
+    } else {
+        for (physicsUpdateIndex = 0;
+            physicsUpdateIndex < physicsSubsteps;
+            ++physicsUpdateIndex)
+        {
+#pragma omp simd
+            for (int k = 0; k < PHYSICS_LANES; ++k) {
+                double dx = x[k] - tmpMousePosX;
+                double dy = y[k] - tmpMousePosY;
+                double d2 = dx * dx + dy * dy;
+
+                double invd = 1.0 / sqrt(d2);
+                double invd2 = invd * invd;
+
+                double ax = (GRAVITY * dx) * (invd * invd2);
+                double ay = (GRAVITY * dy) * (invd * invd2);
+
+                vx[k] -= ax * dt;
+                vy[k] -= ay * dt;
+
+                x[k] += vx[k] * dt;
+                y[k] += vy[k] * dt;
+            }
+        }
+    }
+
+    // Single write-back per satellite
+    for (int k = 0; k < PHYSICS_LANES; ++k) {
+        satellites.x[block + k] = (float)x[k];
+        satellites.y[block + k] = (float)y[k];
+        satellites.vx[block + k] = (float)vx[k];
+        satellites.vy[block + k] = (float)vy[k];
+    }
+}
+
+#ifdef SIMD_X86
+// AVX2 physics: the block is two vectors of 4 doubles, which stay in
+// registers for all physicsSubsteps steps. Two independent vectors
+// hide part of the sqrt and divide latency.
+SIMD_TARGET_AVX2
+void advanceBlockAVX2(int block, int tmpMousePosX, int tmpMousePosY) {
+
+    const __m256d mouseX = _mm256_set1_pd(tmpMousePosX);
+    const __m256d mouseY = _mm256_set1_pd(tmpMousePosY);
+    const __m256d gravity = _mm256_set1_pd(GRAVITY);
+    const __m256d deltaTime = _mm256_set1_pd(DELTATIME);
+    const __m256d updates = _mm256_set1_pd(physicsSubsteps);
+    const __m256d dt = _mm256_set1_pd((double)DELTATIME / (double)physicsSubsteps);
+    const __m256d one = _mm256_set1_pd(1.0);
+
+    __m256d x[2], y[2], vx[2], vy[2];
+    for (int v = 0; v < 2; ++v) {
+        int i = block + 4 * v;
+        x[v] = _mm256_cvtps_pd(_mm_load_ps(&satellites.x[i]));
+        y[v] = _mm256_cvtps_pd(_mm_load_ps(&satellites.y[i]));
+        vx[v] = _mm256_cvtps_pd(_mm_load_ps(&satellites.vx[i]));
+        vy[v] = _mm256_cvtps_pd(_mm_load_ps(&satellites.vy[i]));
+    }
+
+    int physicsUpdateIndex;
+    if (physicsExact) {
+        for (physicsUpdateIndex = 0;
+            physicsUpdateIndex < physicsSubsteps;
+            ++physicsUpdateIndex)
+        {
+            // Same operations in the same order as sequentialPhysicsEngine
+            for (int v = 0; v < 2; ++v) {
+                __m256d dx = _mm256_sub_pd(x[v], mouseX);
+                __m256d dy = _mm256_sub_pd(y[v], mouseY);
+                __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+                __m256d dist = _mm256_sqrt_pd(d2);
+                __m256d accumulation = _mm256_div_pd(gravity, d2);
+
+                __m256d ax = _mm256_mul_pd(accumulation, _mm256_div_pd(dx, dist));
+                __m256d ay = _mm256_mul_pd(accumulation, _mm256_div_pd(dy, dist));
+                vx[v] = _mm256_sub_pd(vx[v], _mm256_div_pd(_mm256_mul_pd(ax, deltaTime), updates));
+                vy[v] = _mm256_sub_pd(vy[v], _mm256_div_pd(_mm256_mul_pd(ay, deltaTime), updates));
+
+                x[v] = _mm256_add_pd(x[v], _mm256_div_pd(_mm256_mul_pd(vx[v], deltaTime), updates));
+                y[v] = _mm256_add_pd(y[v], _mm256_div_pd(_mm256_mul_pd(vy[v], deltaTime), updates));
+            }
+        }
+    } else {
+        for (physicsUpdateIndex = 0;
+            physicsUpdateIndex < physicsSubsteps;
+            ++physicsUpdateIndex)
+        {
+            for (int v = 0; v < 2; ++v) {
+                __m256d dx = _mm256_sub_pd(x[v], mouseX);
+                __m256d dy = _mm256_sub_pd(y[v], mouseY);
+                __m256d d2 = _mm256_fmadd_pd(dx, dx, _mm256_mul_pd(dy, dy));
+
+                __m256d invd = _mm256_div_pd(one, _mm256_sqrt_pd(d2));
+                __m256d invd3 = _mm256_mul_pd(gravity, _mm256_mul_pd(invd, _mm256_mul_pd(invd, invd)));
+
+                vx[v] = _mm256_fnmadd_pd(_mm256_mul_pd(dx, invd3), dt, vx[v]);
+                vy[v] = _mm256_fnmadd_pd(_mm256_mul_pd(dy, invd3), dt, vy[v]);
+
+                x[v] = _mm256_fmadd_pd(vx[v], dt, x[v]);
+                y[v] = _mm256_fmadd_pd(vy[v], dt, y[v]);
+            }
+        }
+    }
+
+    for (int v = 0; v < 2; ++v) {
+        int i = block + 4 * v;
+        _mm_store_ps(&satellites.x[i], _mm256_cvtpd_ps(x[v]));
+        _mm_store_ps(&satellites.y[i], _mm256_cvtpd_ps(y[v]));
+        _mm_store_ps(&satellites.vx[i], _mm256_cvtpd_ps(vx[v]));
+        _mm_store_ps(&satellites.vy[i], _mm256_cvtpd_ps(vy[v]));
+    }
+}
+
+// AVX-512 physics: the block is one vector of 8 doubles
+SIMD_TARGET_AVX512
+void advanceBlockAVX512(int block, int tmpMousePosX, int tmpMousePosY) {
+
+    const __m512d mouseX = _mm512_set1_pd(tmpMousePosX);
+    const __m512d mouseY = _mm512_set1_pd(tmpMousePosY);
+    const __m512d gravity = _mm512_set1_pd(GRAVITY);
+    const __m512d deltaTime = _mm512_set1_pd(DELTATIME);
+    const __m512d updates = _mm512_set1_pd(physicsSubsteps);
+    const __m512d dt = _mm512_set1_pd((double)DELTATIME / (double)physicsSubsteps);
+    const __m512d one = _mm512_set1_pd(1.0);
+
+    __m512d x = _mm512_cvtps_pd(_mm256_load_ps(&satellites.x[block]));
+    __m512d y = _mm512_cvtps_pd(_mm256_load_ps(&satellites.y[block]));
+    __m512d vx = _mm512_cvtps_pd(_mm256_load_ps(&satellites.vx[block]));
+    __m512d vy = _mm512_cvtps_pd(_mm256_load_ps(&satellites.vy[block]));
+
+    int physicsUpdateIndex;
+    if (physicsExact) {
+        for (physicsUpdateIndex = 0;
+            physicsUpdateIndex < physicsSubsteps;
+            ++physicsUpdateIndex)
+        {
+            // Same operations in the same order as sequentialPhysicsEngine
+            __m512d dx = _mm512_sub_pd(x, mouseX);
+            __m512d dy = _mm512_sub_pd(y, mouseY);
+            __m512d d2 = _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+            __m512d dist = _mm512_sqrt_pd(d2);
+            __m512d accumulation = _mm512_div_pd(gravity, d2);
+
+            __m512d ax = _mm512_mul_pd(accumulation, _mm512_div_pd(dx, dist));
+            __m512d ay = _mm512_mul_pd(accumulation, _mm512_div_pd(dy, dist));
+            vx = _mm512_sub_pd(vx, _mm512_div_pd(_mm512_mul_pd(ax, deltaTime), updates));
+            vy = _mm512_sub_pd(vy, _mm512_div_pd(_mm512_mul_pd(ay, deltaTime), updates));
+
+            x = _mm512_add_pd(x, _mm512_div_pd(_mm512_mul_pd(vx, deltaTime), updates));
+            y = _mm512_add_pd(y, _mm512_div_pd(_mm512_mul_pd(vy, deltaTime), updates));
+        }
+    } else {
+        for (physicsUpdateIndex = 0;
+            physicsUpdateIndex < physicsSubsteps;
+            ++physicsUpdateIndex)
+        {
+            __m512d dx = _mm512_sub_pd(x, mouseX);
+            __m512d dy = _mm512_sub_pd(y, mouseY);
+            __m512d d2 = _mm512_fmadd_pd(dx, dx, _mm512_mul_pd(dy, dy));
+
+            __m512d invd = _mm512_div_pd(one, _mm512_sqrt_pd(d2));
+            __m512d invd3 = _mm512_mul_pd(gravity, _mm512_mul_pd(invd, _mm512_mul_pd(invd, invd)));
+
+            vx = _mm512_fnmadd_pd(_mm512_mul_pd(dx, invd3), dt, vx);
+            vy = _mm512_fnmadd_pd(_mm512_mul_pd(dy, invd3), dt, vy);
+
+            x = _mm512_fmadd_pd(vx, dt, x);
+            y = _mm512_fmadd_pd(vy, dt, y);
+        }
+    }
+
+    _mm256_store_ps(&satellites.x[block], _mm512_cvtpd_ps(x));
+    _mm256_store_ps(&satellites.y[block], _mm512_cvtpd_ps(y));
+    _mm256_store_ps(&satellites.vx[block], _mm512_cvtpd_ps(vx));
+    _mm256_store_ps(&satellites.vy[block], _mm512_cvtpd_ps(vy));
+}
+#endif
+
+// ## You are asked to make this code parallel ##
+// Physics engine loop. (This is called once a frame before graphics engine)
+// Moves the satellites based on gravity
+// This is done multiple times in a frame because the Euler integration
+// is not accurate enough to be done only once
+// Each thread advances whole blocks of PHYSICS_LANES satellites with the
+// block function matching simdLevel.
+void pipelinePhysics(void);
+
+// One frame of the physics engine with the black hole at the given position
+void physicsFrame(int tmpMousePosX, int tmpMousePosY) {
+
+    simdlevel level = simdLevel;
+
+    if (nbodyMode) {
+        double start = omp_get_wtime();
+        double pairs = nbodyAdvance(tmpMousePosX, tmpMousePosY);
+        double seconds = omp_get_wtime() - start;
+        printf("N-body: %.3e pair interactions/s\n", pairs / seconds);
+        return;
+    }
+
+    if (keplerPropagation) {
+        // The mouse position is sampled once per frame, so the black hole is
+        // stationary within every frame and each satellite's orbit is
+        // re-derived from its state relative to this frame's position.
+        // Frames where the black hole jumped need no special treatment.
+        int fallbacks = 0;
+        int i;
+#pragma omp parallel for schedule(static) reduction(+:fallbacks)
+        for (i = 0; i < satellites.count; ++i) {
+            if (!advanceSatelliteKepler(i, tmpMousePosX, tmpMousePosY)) {
+                advanceSatelliteNumerical(i, tmpMousePosX, tmpMousePosY);
+                ++fallbacks;
+            }
+        }
+        if (fallbacks > 0) {
+            printf("Kepler solver fell back to integration for %d satellites\n", fallbacks);
+        }
+        return;
+    }
+
+    if (adaptiveEta > 0.0) {
+        // Per-satellite cost is uneven, so satellites are handed out in
+        // small chunks to whichever thread is free. Each thread keeps its
+        // own maximum and merges it once; reduction(max:) needs OpenMP 3.1
+        long long totalSteps = 0;
+        int maxSteps = 0;
+        int i;
+#pragma omp parallel
+        {
+            int localMax = 0;
+#pragma omp for schedule(dynamic, ADAPTIVE_CHUNK) reduction(+:totalSteps)
+            for (i = 0; i < satellites.count; ++i) {
+                int steps = advanceSatelliteAdaptive(i, tmpMousePosX, tmpMousePosY);
+                totalSteps += steps;
+                if (steps > localMax) localMax = steps;
+            }
+#pragma omp critical
+            if (localMax > maxSteps) maxSteps = localMax;
+        }
+        printf("Adaptive steps: %lld in total, %.1f per satellite, at most %d\n",
+            totalSteps, (double)totalSteps / satellites.count, maxSteps);
+        return;
+    }
+
+    if (integrator != INTEGRATOR_EULER) {
+        int block;
+#pragma omp parallel for schedule(static)
+        for (block = 0; block < satellites.capacity; block += PHYSICS_LANES) {
+            advanceBlockIntegrator(block, tmpMousePosX, tmpMousePosY);
+        }
+        return;
+    }
+
+    int block;
+#pragma omp parallel for schedule(static)
+    for (block = 0; block < satellites.capacity; block += PHYSICS_LANES) {
+#ifdef SIMD_X86
+        if (level == SIMD_AVX512) {
+            advanceBlockAVX512(block, tmpMousePosX, tmpMousePosY);
+            continue;
+        }
+        if (level == SIMD_AVX2) {
+            advanceBlockAVX2(block, tmpMousePosX, tmpMousePosY);
+            continue;
+        }
+#endif
+        advanceBlockScalar(block, tmpMousePosX, tmpMousePosY);
+    }
+}
+
+void parallelPhysicsEngine(void) {
+    if (pipelineMode && pipelineFrame >= PIPELINE_FIRST_FRAME) {
+        pipelinePhysics();
+        return;
+    }
+    physicsFrame(mousePosX, mousePosY);
+}
+
+
+// ## You are asked to make this code parallel ##
+// Rendering loop (This is called once a frame after physics engine)
+// Decides the color for each pixel.
+// Rows are shaded by one of the row shaders below, chosen by simdLevel.
+// A row shader visits the satellites of 'sats', which is either the whole
+// satellite store or the candidates of a screen tile. 'far', if not NULL,
+// holds the weight and color sums of the satellites a tile left out, and
+// starts the pixels' sums.
+
+// Far field sums of channel q at pixel (px, py)
+static inline float farFieldAt(const farfield* far, int q, float px, float py) {
+    const float* c = far->c[q];
+    float u = px - far->x;
+    float v = py - far->y;
+    return c[0] + v * (c[2] + v * c[5]) + u * (c[1] + v * c[4] + u * c[3]);
+}
+
+// Scalar shader for pixels x0 ... x1-1 of row y
+void shadeRowScalar(const satellitestore* sats, int y, int x0, int x1, int tmpMousePosX, int tmpMousePosY,
+    const farfield* far) {
+
+    const float BH_R2 = BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS;
+    const float SAT_R2 = SATELLITE_RADIUS * SATELLITE_RADIUS;
+
+    // The satellite loop streams only the position arrays;
+    // colors are read when a satellite contributes
+    const float* satX = sats->x;
+    const float* satY = sats->y;
+    const float* satR = sats->red;
+    const float* satG = sats->green;
+    const float* satB = sats->blue;
+    const int satCount = sats->count;
+
+    int idx = y * WINDOW_WIDTH + x0;
+    float py = (float)y;
+
+    int x;
+    for (x = x0; x < x1; ++x, ++idx) {
+
+        float px = (float)x;
+
+        // Black hole test (no sqrt)
+        float dxBH = px - tmpMousePosX;
+        float dyBH = py - tmpMousePosY;
+        float d2BH = dxBH * dxBH + dyBH * dyBH;
+        if (d2BH < BH_R2) {
+            shadePixels[idx].red = 0;
+            shadePixels[idx].green = 0;
+            shadePixels[idx].blue = 0;
+            continue;
+        }
+
+        // Single-pass satellite loop
+        float sumR = 0.f, sumG = 0.f, sumB = 0.f;
+        float weights = 0.f;
+        if (far) {
+            weights = farFieldAt(far, 0, px, py);
+            sumR = farFieldAt(far, 1, px, py);
+            sumG = farFieldAt(far, 2, px, py);
+            sumB = farFieldAt(far, 3, px, py);
+        }
+
+        float shortestD2 = INFINITY;
+        int nearest = 0;
+        int hitsSatellite = 0;
+
+        int j;
+        for (j = 0; j < satCount; ++j) {
+
+            float dx = px - satX[j];
+            float dy = py - satY[j];
+            float d2 = dx * dx + dy * dy;
+
+            if (d2 < SAT_R2) {
+                shadePixels[idx].red = 255;
+                shadePixels[idx].green = 255;
+                shadePixels[idx].blue = 255;
+                hitsSatellite = 1;
+                break;
+            }
+
+            float w = 1.0f / (d2 * d2);
+            weights += w;
+
+            sumR += satR[j] * w;
+            sumG += satG[j] * w;
+            sumB += satB[j] * w;
+
+            if (d2 < shortestD2) {
+                shortestD2 = d2;
+                nearest = j;
+            }
+        }
+
+        if (!hitsSatellite) {
+            float invW = 1.0f / weights;
+            float r = satR[nearest] + 3.0f * (sumR * invW);
+            float g = satG[nearest] + 3.0f * (sumG * invW);
+            float b = satB[nearest] + 3.0f * (sumB * invW);
+
+            shadePixels[idx].red = (uint8_t)(r * 255.0f);
+            shadePixels[idx].green = (uint8_t)(g * 255.0f);
+            shadePixels[idx].blue = (uint8_t)(b * 255.0f);
+        }
+    }
+}
+
+#ifdef SIMD_X86
+// farFieldAt for 8 pixels u = px - far->x of a row with v = py - far->y
+SIMD_TARGET_AVX2
+static inline __m256 farFieldAVX2(const float* c, __m256 u, float v) {
+    __m256 ux = _mm256_fmadd_ps(u, _mm256_set1_ps(c[3]), _mm256_set1_ps(c[1] + v * c[4]));
+    return _mm256_fmadd_ps(u, ux, _mm256_set1_ps(c[0] + v * (c[2] + v * c[5])));
+}
+
+// AVX2 shader: 8 pixels of a row per iteration. Lanes that hit a satellite
+// keep accumulating but are masked to white at the end, the nearest
+// satellite color is selected with blends, and the loop over satellites
+// only exits early once all 8 lanes have hit.
+SIMD_TARGET_AVX2
+void shadeRowAVX2(const satellitestore* sats, int y, int x0, int x1, int tmpMousePosX, int tmpMousePosY,
+    const farfield* far) {
+
+    const float* satX = sats->x;
+    const float* satY = sats->y;
+    const float* satR = sats->red;
+    const float* satG = sats->green;
+    const float* satB = sats->blue;
+    const int satCount = sats->count;
+
+    const __m256 bhR2 = _mm256_set1_ps(BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS);
+    const __m256 satR2 = _mm256_set1_ps(SATELLITE_RADIUS * SATELLITE_RADIUS);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 three = _mm256_set1_ps(3.0f);
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    const __m256 laneOffset = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+    const __m256i white = _mm256_set1_epi32(0x00FFFFFF);
+
+    const float py = (float)y;
+    const float dyBH = py - tmpMousePosY;
+    const __m256 d2BHy = _mm256_set1_ps(dyBH * dyBH);
+    const __m256 mouseX = _mm256_set1_ps((float)tmpMousePosX);
+
+    const int vectorEnd = x1 - (x1 - x0) % 8;
+    int x;
+    for (x = x0; x < vectorEnd; x += 8) {
+
+        __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), laneOffset);
+
+        // Black hole test (no sqrt)
+        __m256 dxBH = _mm256_sub_ps(px, mouseX);
+        __m256 blackHole = _mm256_cmp_ps(_mm256_fmadd_ps(dxBH, dxBH, d2BHy), bhR2, _CMP_LT_OQ);
+        __m256i* out = (__m256i*)&shadePixels[y * WINDOW_WIDTH + x];
+        if (_mm256_movemask_ps(blackHole) == 0xFF) {
+            _mm256_storeu_si256(out, _mm256_setzero_si256());
+            continue;
+        }
+
+        __m256 sumR = _mm256_setzero_ps(), sumG = _mm256_setzero_ps(), sumB = _mm256_setzero_ps();
+        __m256 weights = _mm256_setzero_ps();
+        if (far) {
+            __m256 u = _mm256_sub_ps(px, _mm256_set1_ps(far->x));
+            float v = py - far->y;
+            weights = farFieldAVX2(far->c[0], u, v);
+            sumR = farFieldAVX2(far->c[1], u, v);
+            sumG = farFieldAVX2(far->c[2], u, v);
+            sumB = farFieldAVX2(far->c[3], u, v);
+        }
+        __m256 shortestD2 = _mm256_set1_ps(INFINITY);
+        __m256 nearR = _mm256_setzero_ps(), nearG = _mm256_setzero_ps(), nearB = _mm256_setzero_ps();
+        __m256 hits = _mm256_setzero_ps();
+
+        for (int j = 0; j < satCount; ++j) {
+            __m256 dx = _mm256_sub_ps(px, _mm256_set1_ps(satX[j]));
+            float dy = py - satY[j];
+            __m256 d2 = _mm256_fmadd_ps(dx, dx, _mm256_set1_ps(dy * dy));
+
+            hits = _mm256_or_ps(hits, _mm256_cmp_ps(d2, satR2, _CMP_LT_OQ));
+            if (_mm256_movemask_ps(hits) == 0xFF) break;
+
+            __m256 w = _mm256_div_ps(one, _mm256_mul_ps(d2, d2));
+            weights = _mm256_add_ps(weights, w);
+
+            __m256 r = _mm256_set1_ps(satR[j]);
+            __m256 g = _mm256_set1_ps(satG[j]);
+            __m256 b = _mm256_set1_ps(satB[j]);
+            sumR = _mm256_fmadd_ps(r, w, sumR);
+            sumG = _mm256_fmadd_ps(g, w, sumG);
+            sumB = _mm256_fmadd_ps(b, w, sumB);
+
+            __m256 closer = _mm256_cmp_ps(d2, shortestD2, _CMP_LT_OQ);
+            shortestD2 = _mm256_blendv_ps(shortestD2, d2, closer);
+            nearR = _mm256_blendv_ps(nearR, r, closer);
+            nearG = _mm256_blendv_ps(nearG, g, closer);
+            nearB = _mm256_blendv_ps(nearB, b, closer);
+        }
+
+        __m256 invW = _mm256_div_ps(one, weights);
+        __m256 r = _mm256_fmadd_ps(three, _mm256_mul_ps(sumR, invW), nearR);
+        __m256 g = _mm256_fmadd_ps(three, _mm256_mul_ps(sumG, invW), nearG);
+        __m256 b = _mm256_fmadd_ps(three, _mm256_mul_ps(sumB, invW), nearB);
+
+        // Pack to BGRA bytes, then apply the satellite and black hole masks
+        __m256i ri = _mm256_cvttps_epi32(_mm256_mul_ps(r, scale));
+        __m256i gi = _mm256_cvttps_epi32(_mm256_mul_ps(g, scale));
+        __m256i bi = _mm256_cvttps_epi32(_mm256_mul_ps(b, scale));
+        __m256i color = _mm256_or_si256(bi, _mm256_or_si256(
+            _mm256_slli_epi32(gi, 8), _mm256_slli_epi32(ri, 16)));
+        color = _mm256_blendv_epi8(color, white, _mm256_castps_si256(hits));
+        color = _mm256_andnot_si256(_mm256_castps_si256(blackHole), color);
+        _mm256_storeu_si256(out, color);
+    }
+
+    shadeRowScalar(sats, y, vectorEnd, x1, tmpMousePosX, tmpMousePosY, far);
+}
+
+// farFieldAt for 16 pixels
+SIMD_TARGET_AVX512
+static inline __m512 farFieldAVX512(const float* c, __m512 u, float v) {
+    __m512 ux = _mm512_fmadd_ps(u, _mm512_set1_ps(c[3]), _mm512_set1_ps(c[1] + v * c[4]));
+    return _mm512_fmadd_ps(u, ux, _mm512_set1_ps(c[0] + v * (c[2] + v * c[5])));
+}
+
+// AVX-512 shader: same as shadeRowAVX2 with 16 pixels and mask registers
+SIMD_TARGET_AVX512
+void shadeRowAVX512(const satellitestore* sats, int y, int x0, int x1, int tmpMousePosX, int tmpMousePosY,
+    const farfield* far) {
+
+    const float* satX = sats->x;
+    const float* satY = sats->y;
+    const float* satR = sats->red;
+    const float* satG = sats->green;
+    const float* satB = sats->blue;
+    const int satCount = sats->count;
+
+    const __m512 bhR2 = _mm512_set1_ps(BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS);
+    const __m512 satR2 = _mm512_set1_ps(SATELLITE_RADIUS * SATELLITE_RADIUS);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 three = _mm512_set1_ps(3.0f);
+    const __m512 scale = _mm512_set1_ps(255.0f);
+    const __m512 laneOffset = _mm512_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f,
+        8.f, 9.f, 10.f, 11.f, 12.f, 13.f, 14.f, 15.f);
+    const __m512i white = _mm512_set1_epi32(0x00FFFFFF);
+
+    const float py = (float)y;
+    const float dyBH = py - tmpMousePosY;
+    const __m512 d2BHy = _mm512_set1_ps(dyBH * dyBH);
+    const __m512 mouseX = _mm512_set1_ps((float)tmpMousePosX);
+
+    const int vectorEnd = x1 - (x1 - x0) % 16;
+    int x;
+    for (x = x0; x < vectorEnd; x += 16) {
+
+        __m512 px = _mm512_add_ps(_mm512_set1_ps((float)x), laneOffset);
+
+        // Black hole test (no sqrt)
+        __m512 dxBH = _mm512_sub_ps(px, mouseX);
+        __mmask16 blackHole = _mm512_cmp_ps_mask(_mm512_fmadd_ps(dxBH, dxBH, d2BHy), bhR2, _CMP_LT_OQ);
+        void* out = &shadePixels[y * WINDOW_WIDTH + x];
+        if (blackHole == 0xFFFF) {
+            _mm512_storeu_si512(out, _mm512_setzero_si512());
+            continue;
+        }
+
+        __m512 sumR = _mm512_setzero_ps(), sumG = _mm512_setzero_ps(), sumB = _mm512_setzero_ps();
+        __m512 weights = _mm512_setzero_ps();
+        if (far) {
+            __m512 u = _mm512_sub_ps(px, _mm512_set1_ps(far->x));
+            float v = py - far->y;
+            weights = farFieldAVX512(far->c[0], u, v);
+            sumR = farFieldAVX512(far->c[1], u, v);
+            sumG = farFieldAVX512(far->c[2], u, v);
+            sumB = farFieldAVX512(far->c[3], u, v);
+        }
+        __m512 shortestD2 = _mm512_set1_ps(INFINITY);
+        __m512 nearR = _mm512_setzero_ps(), nearG = _mm512_setzero_ps(), nearB = _mm512_setzero_ps();
+        __mmask16 hits = 0;
+
+        for (int j = 0; j < satCount; ++j) {
+            __m512 dx = _mm512_sub_ps(px, _mm512_set1_ps(satX[j]));
+            float dy = py - satY[j];
+            __m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_set1_ps(dy * dy));
+
+            hits |= _mm512_cmp_ps_mask(d2, satR2, _CMP_LT_OQ);
+            if (hits == 0xFFFF) break;
+
+            __m512 w = _mm512_div_ps(one, _mm512_mul_ps(d2, d2));
+            weights = _mm512_add_ps(weights, w);
+
+            __m512 r = _mm512_set1_ps(satR[j]);
+            __m512 g = _mm512_set1_ps(satG[j]);
+            __m512 b = _mm512_set1_ps(satB[j]);
+            sumR = _mm512_fmadd_ps(r, w, sumR);
+            sumG = _mm512_fmadd_ps(g, w, sumG);
+            sumB = _mm512_fmadd_ps(b, w, sumB);
+
+            __mmask16 closer = _mm512_cmp_ps_mask(d2, shortestD2, _CMP_LT_OQ);
+            shortestD2 = _mm512_mask_blend_ps(closer, shortestD2, d2);
+            nearR = _mm512_mask_blend_ps(closer, nearR, r);
+            nearG = _mm512_mask_blend_ps(closer, nearG, g);
+            nearB = _mm512_mask_blend_ps(closer, nearB, b);
+        }
+
+        __m512 invW = _mm512_div_ps(one, weights);
+        __m512 r = _mm512_fmadd_ps(three, _mm512_mul_ps(sumR, invW), nearR);
+        __m512 g = _mm512_fmadd_ps(three, _mm512_mul_ps(sumG, invW), nearG);
+        __m512 b = _mm512_fmadd_ps(three, _mm512_mul_ps(sumB, invW), nearB);
+
+        // Pack to BGRA bytes, then apply the satellite and black hole masks
+        __m512i ri = _mm512_cvttps_epi32(_mm512_mul_ps(r, scale));
+        __m512i gi = _mm512_cvttps_epi32(_mm512_mul_ps(g, scale));
+        __m512i bi = _mm512_cvttps_epi32(_mm512_mul_ps(b, scale));
+        __m512i color = _mm512_or_si512(bi, _mm512_or_si512(
+            _mm512_slli_epi32(gi, 8), _mm512_slli_epi32(ri, 16)));
+        color = _mm512_mask_blend_epi32(hits, color, white);
+        color = _mm512_mask_blend_epi32(blackHole, color, _mm512_setzero_si512());
+        _mm512_storeu_si512(out, color);
+    }
+
+    shadeRowScalar(sats, y, vectorEnd, x1, tmpMousePosX, tmpMousePosY, far);
+}
+#endif
+
+// Shades pixels x0 ... x1-1 of row y with the row shader of simdLevel
+void shadeRow(const satellitestore* sats, int y, int x0, int x1, int tmpMousePosX, int tmpMousePosY,
+    const farfield* far) {
+#ifdef SIMD_X86
+    if (simdLevel == SIMD_AVX512) {
+        shadeRowAVX512(sats, y, x0, x1, tmpMousePosX, tmpMousePosY, far);
+        return;
+    }
+    if (simdLevel == SIMD_AVX2) {
+        shadeRowAVX2(sats, y, x0, x1, tmpMousePosX, tmpMousePosY, far);
+        return;
+    }
+#endif
+    shadeRowScalar(sats, y, x0, x1, tmpMousePosX, tmpMousePosY, far);
+}
+
+// Makes room for 'count' candidates. Grows geometrically, the contents
+// are not kept.
+void renderCandidatesReserve(rendercandidates* c, int count) {
+    satellitestore* s = &c->sats;
+    if (count <= s->capacity) return;
+    int capacity = s->capacity * 2 > count ? s->capacity * 2 : count;
+    capacity = (capacity + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    alignedFree(s->x);
+    alignedFree(s->y);
+    alignedFree(s->red);
+    alignedFree(s->green);
+    alignedFree(s->blue);
+    size_t bytes = sizeof(float) * capacity;
+    s->x = (float*)alignedMalloc(bytes);
+    s->y = (float*)alignedMalloc(bytes);
+    s->red = (float*)alignedMalloc(bytes);
+    s->green = (float*)alignedMalloc(bytes);
+    s->blue = (float*)alignedMalloc(bytes);
+    s->vx = s->vy = NULL;
+    s->capacity = capacity;
+}
+
+void renderCandidatesFree(rendercandidates* c) {
+    alignedFree(c->sats.x);
+    alignedFree(c->sats.y);
+    alignedFree(c->sats.red);
+    alignedFree(c->sats.green);
+    alignedFree(c->sats.blue);
+    free(c->marked);
+}
+
+// Bins are a whole number of tiles wide, so every tile lies in one bin.
+// The size aims at RENDER_BIN_OCCUPANCY satellites per bin of the window.
+void renderBinsAlloc(renderbins* rb) {
+    int count = shadeSatellites->count;
+    double size = sqrt((double)WINDOW_WIDTH * WINDOW_HEIGHT * RENDER_BIN_OCCUPANCY / count);
+    int tiles = (int)(size / RENDER_TILE + 0.5);
+    if (tiles < 1) tiles = 1;
+    if (tiles * RENDER_TILE > WINDOW_WIDTH) tiles = WINDOW_WIDTH / RENDER_TILE;
+    rb->binSize = tiles * RENDER_TILE;
+    rb->binsX = (WINDOW_WIDTH + rb->binSize - 1) / rb->binSize;
+    rb->binsY = (WINDOW_HEIGHT + rb->binSize - 1) / rb->binSize;
+    int bins = rb->binsX * rb->binsY;
+
+    int threads = omp_get_max_threads();
+    rb->sorted = (int*)malloc(sizeof(int) * count);
+    rb->candidates = (rendercandidates*)calloc(threads, sizeof(rendercandidates));
+    for (int t = 0; t < threads; ++t) {
+        rb->candidates[t].marked = (uint64_t*)calloc((count + 63) / 64, sizeof(uint64_t));
+    }
+    rb->binOf = (int*)malloc(sizeof(int) * count);
+    rb->binStart = (int*)malloc(sizeof(int) * (bins + 1));
+    rb->binFill = (int*)malloc(sizeof(int) * bins);
+    rb->binTable = (int*)malloc(sizeof(int) * (rb->binsX + 1) * (rb->binsY + 1));
+
+    // Colors never change, so the error bound's color factor is fixed
+    const float* channels[3] = { shadeSatellites->red, shadeSatellites->green, shadeSatellites->blue };
+    rb->colorRange = 0.f;
+    for (int c = 0; c < 3; ++c) {
+        float lo = channels[c][0], hi = channels[c][0];
+        for (int i = 1; i < count; ++i) {
+            lo = fminf(lo, channels[c][i]);
+            hi = fmaxf(hi, channels[c][i]);
+        }
+        if (hi - lo > rb->colorRange) rb->colorRange = hi - lo;
+    }
+}
+
+void renderBinsFree(renderbins* rb) {
+    free(rb->sorted);
+    int threads = omp_get_max_threads();
+    for (int t = 0; t < threads; ++t) {
+        renderCandidatesFree(&rb->candidates[t]);
+    }
+    free(rb->candidates);
+    free(rb->binOf);
+    free(rb->binStart);
+    free(rb->binFill);
+    free(rb->binTable);
+}
+
+// Bin column or row of a coordinate. Satellites outside the window go to
+// the border bins, which is safe for the distance bounds: they are only
+// farther from every pixel than the border bin is.
+static inline int renderBinCoordinate(float v, int binSize, int bins) {
+    if (!(v >= 0.f)) return 0; // also NaN
+    if (v >= (float)bins * binSize) return bins - 1;
+    return (int)(v / binSize);
+}
+
+// Satellites in bins bx0 ... bx1, by0 ... by1, clamped to the grid
+static inline int renderBinRectCount(const renderbins* rb, int bx0, int by0, int bx1, int by1) {
+    if (bx0 < 0) bx0 = 0;
+    if (by0 < 0) by0 = 0;
+    if (bx1 > rb->binsX - 1) bx1 = rb->binsX - 1;
+    if (by1 > rb->binsY - 1) by1 = rb->binsY - 1;
+    const int stride = rb->binsX + 1;
+    const int* t = rb->binTable;
+    return t[(by1 + 1) * stride + bx1 + 1] - t[by0 * stride + bx1 + 1]
+        - t[(by1 + 1) * stride + bx0] + t[by0 * stride + bx0];
+}
+
+// Appends the satellites of bin (bx, by) to the tile candidates and updates
+// the lower bound of the weight sum and the nearest farthest-corner distance.
+static inline void renderGatherBin(const renderbins* rb, int bx, int by,
+    float tx0, float ty0, float tx1, float ty1, rendercandidates* cand,
+    double* weightLower, double* nearestFar2) {
+    int bin = by * rb->binsX + bx;
+    int first = rb->binStart[bin];
+    int n = rb->binStart[bin + 1] - first;
+    if (n == 0) return;
+    cand->sats.count += n;
+    double w = 0.0;
+    double best = *nearestFar2;
+    for (int j = first; j < first + n; ++j) {
+        int i = rb->sorted[j];
+        cand->marked[i >> 6] |= (uint64_t)1 << (i & 63);
+        // Farthest tile corner, an upper bound of the distance to any pixel
+        float sx = shadeSatellites->x[i];
+        float sy = shadeSatellites->y[i];
+        double fx = fmax(fabs(sx - tx0), fabs(sx - tx1));
+        double fy = fmax(fabs(sy - ty0), fabs(sy - ty1));
+        double far2 = fx * fx + fy * fy;
+        w += 1.0 / (far2 * far2);
+        if (far2 < best) best = far2;
+    }
+    *weightLower += w;
+    *nearestFar2 = best;
+}
+
+// Index of the lowest set bit of a nonzero word
+static inline int lowestBit(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(word);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long bit;
+    _BitScanForward64(&bit, word);
+    return (int)bit;
+#else
+    int bit = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+// Copies the marked satellites to the candidates in ascending index order
+// and clears the bitmap. The candidates must have room for them.
+static void renderCandidatesCollect(rendercandidates* cand) {
+    const int words = (shadeSatellites->count + 63) / 64;
+    int j = 0;
+    for (int k = 0; k < words; ++k) {
+        uint64_t word = cand->marked[k];
+        cand->marked[k] = 0;
+        while (word) {
+            int i = k * 64 + lowestBit(word);
+            word &= word - 1;
+            cand->sats.x[j] = shadeSatellites->x[i];
+            cand->sats.y[j] = shadeSatellites->y[i];
+            cand->sats.red[j] = shadeSatellites->red[i];
+            cand->sats.green[j] = shadeSatellites->green[i];
+            cand->sats.blue[j] = shadeSatellites->blue[i];
+            ++j;
+        }
+    }
+    cand->sats.count = j;
+}
+
+// Collects the satellites the tile with pixels tx0 ... tx1, ty0 ... ty1
+// (inclusive) has to visit. Rings of bins are added around the tile's bin
+// until, with 'gap' the distance from the tile to the first bin left out:
+//   - the nearest satellite of every pixel is a candidate (some candidate's
+//     farthest tile corner is closer than gap), which also keeps every
+//     satellite hit, and
+//   - the left out weight cannot move a color channel by more than the
+//     budget: the weighted mean moves by at most Wout / (Win + Wout) times
+//     the channel's spread, so with Win >= sum of 1/far^4 over the
+//     candidates and Wout <= sum of 1/gap_j^4 over the later rings,
+//     |error| <= 3 * 255 * colorRange * Wout / (Win + Wout).
+static void renderGatherTile(const renderbins* rb, int tx0, int ty0, int tx1, int ty1,
+    rendercandidates* cand) {
+    const int B = rb->binSize;
+    const int cx = tx0 / B;
+    const int cy = ty0 / B;
+    int rings = cx;
+    if (rb->binsX - 1 - cx > rings) rings = rb->binsX - 1 - cx;
+    if (cy > rings) rings = cy;
+    if (rb->binsY - 1 - cy > rings) rings = rb->binsY - 1 - cy;
+
+    // Satellites within ring k, gap to the bins outside it, and the bound
+    // of the weight outside it
+    int inside[RENDER_MAX_RINGS];
+    double gap[RENDER_MAX_RINGS];
+    double outside[RENDER_MAX_RINGS];
+    for (int k = 0; k <= rings; ++k) {
+        inside[k] = renderBinRectCount(rb, cx - k, cy - k, cx + k, cy + k);
+        double g = INFINITY;
+        if (cx - k > 0) g = fmin(g, tx0 - (double)(cx - k) * B);
+        if (cx + k < rb->binsX - 1) g = fmin(g, (double)(cx + k + 1) * B - tx1);
+        if (cy - k > 0) g = fmin(g, ty0 - (double)(cy - k) * B);
+        if (cy + k < rb->binsY - 1) g = fmin(g, (double)(cy + k + 1) * B - ty1);
+        gap[k] = g;
+    }
+    outside[rings] = 0.0;
+    for (int k = rings - 1; k >= 0; --k) {
+        int n = inside[k + 1] - inside[k];
+        double g2 = gap[k] * gap[k];
+        outside[k] = outside[k + 1] + (n > 0 ? n / (g2 * g2) : 0.0);
+    }
+
+    const double scale = 3.0 * 255.0 * rb->colorRange / renderErrorBudget;
+    double weightLower = 0.0;
+    double nearestFar2 = INFINITY;
+    cand->sats.count = 0;
+    for (int k = 0; k <= rings; ++k) {
+        renderCandidatesReserve(cand, inside[k]);
+        for (int by = cy - k; by <= cy + k; ++by) {
+            if (by < 0 || by >= rb->binsY) continue;
+            int step = (by == cy - k || by == cy + k) ? 1 : 2 * k;
+            for (int bx = cx - k; bx <= cx + k; bx += step) {
+                if (bx < 0 || bx >= rb->binsX) continue;
+                renderGatherBin(rb, bx, by, (float)tx0, (float)ty0, (float)tx1, (float)ty1,
+                    cand, &weightLower, &nearestFar2);
+            }
+        }
+        if (nearestFar2 < gap[k] * gap[k] && scale * outside[k] <= weightLower + outside[k]) break;
+    }
+    renderCandidatesCollect(cand);
+}
+
+// Sorts the satellites into bins and builds the summed-area table.
+// Called by all threads of a parallel region.
+static void renderBinSatellites(renderbins* rb) {
+    const int count = shadeSatellites->count;
+    const int B = rb->binSize;
+    int i;
+#pragma omp for schedule(static)
+    for (i = 0; i < count; ++i) {
+        rb->binOf[i] = renderBinCoordinate(shadeSatellites->y[i], B, rb->binsY) * rb->binsX
+            + renderBinCoordinate(shadeSatellites->x[i], B, rb->binsX);
+    }
+#pragma omp single
+    {
+        const int bins = rb->binsX * rb->binsY;
+        memset(rb->binStart, 0, sizeof(int) * (bins + 1));
+        for (int j = 0; j < count; ++j) rb->binStart[rb->binOf[j] + 1]++;
+        for (int b = 0; b < bins; ++b) rb->binStart[b + 1] += rb->binStart[b];
+        memcpy(rb->binFill, rb->binStart, sizeof(int) * bins);
+        for (int j = 0; j < count; ++j) {
+            rb->sorted[rb->binFill[rb->binOf[j]]++] = j;
+        }
+        const int stride = rb->binsX + 1;
+        memset(rb->binTable, 0, sizeof(int) * stride);
+        for (int by = 0; by < rb->binsY; ++by) {
+            int row = 0;
+            rb->binTable[(by + 1) * stride] = 0;
+            for (int bx = 0; bx < rb->binsX; ++bx) {
+                int b = by * rb->binsX + bx;
+                row += rb->binStart[b + 1] - rb->binStart[b];
+                rb->binTable[(by + 1) * stride + bx + 1] = rb->binTable[by * stride + bx + 1] + row;
+            }
+        }
+    } // implicit barrier
+}
+
+// Binned rendering: tiles are shaded against their candidate satellites
+void parallelGraphicsEngineBinned(int tmpMousePosX, int tmpMousePosY) {
+    const int tilesX = WINDOW_WIDTH / RENDER_TILE;
+    const int tiles = tilesX * (WINDOW_HEIGHT / RENDER_TILE);
+#pragma omp parallel
+    {
+        renderBinSatellites(&renderBins);
+        rendercandidates* cand = &renderBins.candidates[omp_get_thread_num()];
+        int tile;
+#pragma omp for schedule(dynamic, 4)
+        for (tile = 0; tile < tiles; ++tile) {
+            int x0 = tile % tilesX * RENDER_TILE;
+            int y0 = tile / tilesX * RENDER_TILE;
+            renderGatherTile(&renderBins, x0, y0, x0 + RENDER_TILE - 1, y0 + RENDER_TILE - 1, cand);
+            for (int y = y0; y < y0 + RENDER_TILE; ++y) {
+                shadeRow(&cand->sats, y, x0, x0 + RENDER_TILE, tmpMousePosX, tmpMousePosY, NULL);
+            }
+        }
+    }
+}
+
+void boundsCandidatesAlloc(void) {
+    int threads = omp_get_max_threads();
+    boundsCandidates = (tilecandidates*)calloc(threads, sizeof(tilecandidates));
+    for (int t = 0; t < threads; ++t) {
+        boundsCandidates[t].hit = (int*)malloc(sizeof(int) * shadeSatellites->count);
+        boundsCandidates[t].nearest = (int*)malloc(sizeof(int) * shadeSatellites->count);
+    }
+}
+
+void boundsCandidatesFree(void) {
+    int threads = omp_get_max_threads();
+    for (int t = 0; t < threads; ++t) {
+        free(boundsCandidates[t].hit);
+        free(boundsCandidates[t].nearest);
+    }
+    free(boundsCandidates);
+}
+
+// Builds the hit and nearest candidate lists of the tile with pixels
+// tx0 ... tx1, ty0 ... ty1 (inclusive) from the distance interval
+// [near, far] of every satellite to the tile's pixel rectangle
+void boundsGatherTile(int tx0, int ty0, int tx1, int ty1, tilecandidates* cand) {
+    const float* satX = shadeSatellites->x;
+    const float* satY = shadeSatellites->y;
+    const int satCount = shadeSatellites->count;
+    const float x0 = (float)tx0, y0 = (float)ty0, x1 = (float)tx1, y1 = (float)ty1;
+
+    // Every pixel has a satellite within the smallest farthest-corner distance
+    float nearestFar2 = INFINITY;
+    for (int j = 0; j < satCount; ++j) {
+        float fx = fmaxf(fabsf(satX[j] - x0), fabsf(satX[j] - x1));
+        float fy = fmaxf(fabsf(satY[j] - y0), fabsf(satY[j] - y1));
+        nearestFar2 = fminf(nearestFar2, fx * fx + fy * fy);
+    }
+
+    const float hitLimit = SATELLITE_RADIUS * SATELLITE_RADIUS * RENDER_BOUNDS_SLACK;
+    const float nearestLimit = nearestFar2 * RENDER_BOUNDS_SLACK;
+    int hits = 0, nearest = 0;
+    for (int j = 0; j < satCount; ++j) {
+        float nx = fmaxf(fmaxf(x0 - satX[j], satX[j] - x1), 0.f);
+        float ny = fmaxf(fmaxf(y0 - satY[j], satY[j] - y1), 0.f);
+        float near2 = nx * nx + ny * ny;
+        if (near2 < hitLimit) cand->hit[hits++] = j;
+        if (near2 <= nearestLimit) cand->nearest[nearest++] = j;
+    }
+    cand->hitCount = hits;
+    cand->nearestCount = nearest;
+}
+
+// Bounds variant of shadeRowScalar, same arithmetic in the same order
+void shadeRowBoundsScalar(const tilecandidates* cand, int y, int x0, int x1, int tmpMousePosX, int tmpMousePosY) {
+
+    const float BH_R2 = BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS;
+    const float SAT_R2 = SATELLITE_RADIUS * SATELLITE_RADIUS;
+
+    const float* satX = shadeSatellites->x;
+    const float* satY = shadeSatellites->y;
+    const float* satR = shadeSatellites->red;
+    const float* satG = shadeSatellites->green;
+    const float* satB = shadeSatellites->blue;
+    const int satCount = shadeSatellites->count;
+
+    int idx = y * WINDOW_WIDTH + x0;
+    float py = (float)y;
+
+    int x;
+    for (x = x0; x < x1; ++x, ++idx) {
+
+        float px = (float)x;
+
+        float dxBH = px - tmpMousePosX;
+        float dyBH = py - tmpMousePosY;
+        float d2BH = dxBH * dxBH + dyBH * dyBH;
+        if (d2BH < BH_R2) {
+            shadePixels[idx].red = 0;
+            shadePixels[idx].green = 0;
+            shadePixels[idx].blue = 0;
+            continue;
+        }
+
+        int hitsSatellite = 0;
+        for (int c = 0; c < cand->hitCount; ++c) {
+            int j = cand->hit[c];
+            float dx = px - satX[j];
+            float dy = py - satY[j];
+            if (dx * dx + dy * dy < SAT_R2) {
+                hitsSatellite = 1;
+                break;
+            }
+        }
+        if (hitsSatellite) {
+            shadePixels[idx].red = 255;
+            shadePixels[idx].green = 255;
+            shadePixels[idx].blue = 255;
+            continue;
+        }
+
+        float sumR = 0.f, sumG = 0.f, sumB = 0.f;
+        float weights = 0.f;
+        int j;
+        for (j = 0; j < satCount; ++j) {
+            float dx = px - satX[j];
+            float dy = py - satY[j];
+            float d2 = dx * dx + dy * dy;
+
+            float w = 1.0f / (d2 * d2);
+            weights += w;
+
+            sumR += satR[j] * w;
+            sumG += satG[j] * w;
+            sumB += satB[j] * w;
+        }
+
+        float shortestD2 = INFINITY;
+        int nearest = 0;
+        for (int c = 0; c < cand->nearestCount; ++c) {
+            j = cand->nearest[c];
+            float dx = px - satX[j];
+            float dy = py - satY[j];
+            float d2 = dx * dx + dy * dy;
+            if (d2 < shortestD2) {
+                shortestD2 = d2;
+                nearest = j;
+            }
+        }
+
+        float invW = 1.0f / weights;
+        float r = satR[nearest] + 3.0f * (sumR * invW);
+        float g = satG[nearest] + 3.0f * (sumG * invW);
+        float b = satB[nearest] + 3.0f * (sumB * invW);
+
+        shadePixels[idx].red = (uint8_t)(r * 255.0f);
+        shadePixels[idx].green = (uint8_t)(g * 255.0f);
+        shadePixels[idx].blue = (uint8_t)(b * 255.0f);
+    }
+}
+
+#ifdef SIMD_X86
+// Bounds variant of shadeRowAVX2
+SIMD_TARGET_AVX2
+void shadeRowBoundsAVX2(const tilecandidates* cand, int y, int x0, int x1, int tmpMousePosX, int tmpMousePosY) {
+
+    const float* satX = shadeSatellites->x;
+    const float* satY = shadeSatellites->y;
+    const float* satR = shadeSatellites->red;
+    const float* satG = shadeSatellites->green;
+    const float* satB = shadeSatellites->blue;
+    const int satCount = shadeSatellites->count;
+
+    const __m256 bhR2 = _mm256_set1_ps(BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS);
+    const __m256 satR2 = _mm256_set1_ps(SATELLITE_RADIUS * SATELLITE_RADIUS);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 three = _mm256_set1_ps(3.0f);
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    const __m256 laneOffset = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+    const __m256i white = _mm256_set1_epi32(0x00FFFFFF);
+
+    const float py = (float)y;
+    const float dyBH = py - tmpMousePosY;
+    const __m256 d2BHy = _mm256_set1_ps(dyBH * dyBH);
+    const __m256 mouseX = _mm256_set1_ps((float)tmpMousePosX);
+
+    const int vectorEnd = x1 - (x1 - x0) % 8;
+    int x;
+    for (x = x0; x < vectorEnd; x += 8) {
+
+        __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), laneOffset);
+
+        __m256 dxBH = _mm256_sub_ps(px, mouseX);
+        __m256 blackHole = _mm256_cmp_ps(_mm256_fmadd_ps(dxBH, dxBH, d2BHy), bhR2, _CMP_LT_OQ);
+        __m256i* out = (__m256i*)&shadePixels[y * WINDOW_WIDTH + x];
+        if (_mm256_movemask_ps(blackHole) == 0xFF) {
+            _mm256_storeu_si256(out, _mm256_setzero_si256());
+            continue;
+        }
+
+        __m256 hits = _mm256_setzero_ps();
+        for (int c = 0; c < cand->hitCount; ++c) {
+            int j = cand->hit[c];
+            __m256 dx = _mm256_sub_ps(px, _mm256_set1_ps(satX[j]));
+            float dy = py - satY[j];
+            __m256 d2 = _mm256_fmadd_ps(dx, dx, _mm256_set1_ps(dy * dy));
+            hits = _mm256_or_ps(hits, _mm256_cmp_ps(d2, satR2, _CMP_LT_OQ));
+        }
+        if (_mm256_movemask_ps(hits) == 0xFF) {
+            _mm256_storeu_si256(out, _mm256_andnot_si256(_mm256_castps_si256(blackHole), white));
+            continue;
+        }
+
+        __m256 sumR = _mm256_setzero_ps(), sumG = _mm256_setzero_ps(), sumB = _mm256_setzero_ps();
+        __m256 weights = _mm256_setzero_ps();
+        for (int j = 0; j < satCount; ++j) {
+            __m256 dx = _mm256_sub_ps(px, _mm256_set1_ps(satX[j]));
+            float dy = py - satY[j];
+            __m256 d2 = _mm256_fmadd_ps(dx, dx, _mm256_set1_ps(dy * dy));
+
+            __m256 w = _mm256_div_ps(one, _mm256_mul_ps(d2, d2));
+            weights = _mm256_add_ps(weights, w);
+            sumR = _mm256_fmadd_ps(_mm256_set1_ps(satR[j]), w, sumR);
+            sumG = _mm256_fmadd_ps(_mm256_set1_ps(satG[j]), w, sumG);
+            sumB = _mm256_fmadd_ps(_mm256_set1_ps(satB[j]), w, sumB);
+        }
+
+        __m256 shortestD2 = _mm256_set1_ps(INFINITY);
+        __m256 nearR = _mm256_setzero_ps(), nearG = _mm256_setzero_ps(), nearB = _mm256_setzero_ps();
+        for (int c = 0; c < cand->nearestCount; ++c) {
+            int j = cand->nearest[c];
+            __m256 dx = _mm256_sub_ps(px, _mm256_set1_ps(satX[j]));
+            float dy = py - satY[j];
+            __m256 d2 = _mm256_fmadd_ps(dx, dx, _mm256_set1_ps(dy * dy));
+
+            __m256 closer = _mm256_cmp_ps(d2, shortestD2, _CMP_LT_OQ);
+            shortestD2 = _mm256_blendv_ps(shortestD2, d2, closer);
+            nearR = _mm256_blendv_ps(nearR, _mm256_set1_ps(satR[j]), closer);
+            nearG = _mm256_blendv_ps(nearG, _mm256_set1_ps(satG[j]), closer);
+            nearB = _mm256_blendv_ps(nearB, _mm256_set1_ps(satB[j]), closer);
+        }
+
+        __m256 invW = _mm256_div_ps(one, weights);
+        __m256 r = _mm256_fmadd_ps(three, _mm256_mul_ps(sumR, invW), nearR);
+        __m256 g = _mm256_fmadd_ps(three, _mm256_mul_ps(sumG, invW), nearG);
+        __m256 b = _mm256_fmadd_ps(three, _mm256_mul_ps(sumB, invW), nearB);
+
+        __m256i ri = _mm256_cvttps_epi32(_mm256_mul_ps(r, scale));
+        __m256i gi = _mm256_cvttps_epi32(_mm256_mul_ps(g, scale));
+        __m256i bi = _mm256_cvttps_epi32(_mm256_mul_ps(b, scale));
+        __m256i color = _mm256_or_si256(bi, _mm256_or_si256(
+            _mm256_slli_epi32(gi, 8), _mm256_slli_epi32(ri, 16)));
+        color = _mm256_blendv_epi8(color, white, _mm256_castps_si256(hits));
+        color = _mm256_andnot_si256(_mm256_castps_si256(blackHole), color);
+        _mm256_storeu_si256(out, color);
+    }
+
+    shadeRowBoundsScalar(cand, y, vectorEnd, x1, tmpMousePosX, tmpMousePosY);
+}
+
+// Bounds variant of shadeRowAVX512
+SIMD_TARGET_AVX512
+void shadeRowBoundsAVX512(const tilecandidates* cand, int y, int x0, int x1, int tmpMousePosX, int tmpMousePosY) {
+
+    const float* satX = shadeSatellites->x;
+    const float* satY = shadeSatellites->y;
+    const float* satR = shadeSatellites->red;
+    const float* satG = shadeSatellites->green;
+    const float* satB = shadeSatellites->blue;
+    const int satCount = shadeSatellites->count;
+
+    const __m512 bhR2 = _mm512_set1_ps(BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS);
+    const __m512 satR2 = _mm512_set1_ps(SATELLITE_RADIUS * SATELLITE_RADIUS);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 three = _mm512_set1_ps(3.0f);
+    const __m512 scale = _mm512_set1_ps(255.0f);
+    const __m512 laneOffset = _mm512_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f,
+        8.f, 9.f, 10.f, 11.f, 12.f, 13.f, 14.f, 15.f);
+    const __m512i white = _mm512_set1_epi32(0x00FFFFFF);
+
+    const float py = (float)y;
+    const float dyBH = py - tmpMousePosY;
+    const __m512 d2BHy = _mm512_set1_ps(dyBH * dyBH);
+    const __m512 mouseX = _mm512_set1_ps((float)tmpMousePosX);
+
+    const int vectorEnd = x1 - (x1 - x0) % 16;
+    int x;
+    for (x = x0; x < vectorEnd; x += 16) {
+
+        __m512 px = _mm512_add_ps(_mm512_set1_ps((float)x), laneOffset);
+
+        __m512 dxBH = _mm512_sub_ps(px, mouseX);
+        __mmask16 blackHole = _mm512_cmp_ps_mask(_mm512_fmadd_ps(dxBH, dxBH, d2BHy), bhR2, _CMP_LT_OQ);
+        void* out = &shadePixels[y * WINDOW_WIDTH + x];
+        if (blackHole == 0xFFFF) {
+            _mm512_storeu_si512(out, _mm512_setzero_si512());
+            continue;
+        }
+
+        __mmask16 hits = 0;
+        for (int c = 0; c < cand->hitCount; ++c) {
+            int j = cand->hit[c];
+            __m512 dx = _mm512_sub_ps(px, _mm512_set1_ps(satX[j]));
+            float dy = py - satY[j];
+            __m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_set1_ps(dy * dy));
+            hits |= _mm512_cmp_ps_mask(d2, satR2, _CMP_LT_OQ);
+        }
+        if (hits == 0xFFFF) {
+            _mm512_storeu_si512(out, _mm512_mask_blend_epi32(blackHole, white, _mm512_setzero_si512()));
+            continue;
+        }
+
+        __m512 sumR = _mm512_setzero_ps(), sumG = _mm512_setzero_ps(), sumB = _mm512_setzero_ps();
+        __m512 weights = _mm512_setzero_ps();
+        for (int j = 0; j < satCount; ++j) {
+            __m512 dx = _mm512_sub_ps(px, _mm512_set1_ps(satX[j]));
+            float dy = py - satY[j];
+            __m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_set1_ps(dy * dy));
+
+            __m512 w = _mm512_div_ps(one, _mm512_mul_ps(d2, d2));
+            weights = _mm512_add_ps(weights, w);
+            sumR = _mm512_fmadd_ps(_mm512_set1_ps(satR[j]), w, sumR);
+            sumG = _mm512_fmadd_ps(_mm512_set1_ps(satG[j]), w, sumG);
+            sumB = _mm512_fmadd_ps(_mm512_set1_ps(satB[j]), w, sumB);
+        }
+
+        __m512 shortestD2 = _mm512_set1_ps(INFINITY);
+        __m512 nearR = _mm512_setzero_ps(), nearG = _mm512_setzero_ps(), nearB = _mm512_setzero_ps();
+        for (int c = 0; c < cand->nearestCount; ++c) {
+            int j = cand->nearest[c];
+            __m512 dx = _mm512_sub_ps(px, _mm512_set1_ps(satX[j]));
+            float dy = py - satY[j];
+            __m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_set1_ps(dy * dy));
+
+            __mmask16 closer = _mm512_cmp_ps_mask(d2, shortestD2, _CMP_LT_OQ);
+            shortestD2 = _mm512_mask_blend_ps(closer, shortestD2, d2);
+            nearR = _mm512_mask_blend_ps(closer, nearR, _mm512_set1_ps(satR[j]));
+            nearG = _mm512_mask_blend_ps(closer, nearG, _mm512_set1_ps(satG[j]));
+            nearB = _mm512_mask_blend_ps(closer, nearB, _mm512_set1_ps(satB[j]));
+        }
+
+        __m512 invW = _mm512_div_ps(one, weights);
+        __m512 r = _mm512_fmadd_ps(three, _mm512_mul_ps(sumR, invW), nearR);
+        __m512 g = _mm512_fmadd_ps(three, _mm512_mul_ps(sumG, invW), nearG);
+        __m512 b = _mm512_fmadd_ps(three, _mm512_mul_ps(sumB, invW), nearB);
+
+        __m512i ri = _mm512_cvttps_epi32(_mm512_mul_ps(r, scale));
+        __m512i gi = _mm512_cvttps_epi32(_mm512_mul_ps(g, scale));
+        __m512i bi = _mm512_cvttps_epi32(_mm512_mul_ps(b, scale));
+        __m512i color = _mm512_or_si512(bi, _mm512_or_si512(
+            _mm512_slli_epi32(gi, 8), _mm512_slli_epi32(ri, 16)));
+        color = _mm512_mask_blend_epi32(hits, color, white);
+        color = _mm512_mask_blend_epi32(blackHole, color, _mm512_setzero_si512());
+        _mm512_storeu_si512(out, color);
+    }
+
+    shadeRowBoundsScalar(cand, y, vectorEnd, x1, tmpMousePosX, tmpMousePosY);
+}
+#endif
+
+// Bounds rendering: per tile candidate lists, then the bounds row shaders
+void parallelGraphicsEngineBounds(int tmpMousePosX, int tmpMousePosY) {
+    const int tilesX = WINDOW_WIDTH / RENDER_TILE;
+    const int tiles = tilesX * (WINDOW_HEIGHT / RENDER_TILE);
+    const simdlevel level = simdLevel;
+#pragma omp parallel
+    {
+        tilecandidates* cand = &boundsCandidates[omp_get_thread_num()];
+        int tile;
+#pragma omp for schedule(dynamic, 4)
+        for (tile = 0; tile < tiles; ++tile) {
+            int x0 = tile % tilesX * RENDER_TILE;
+            int y0 = tile / tilesX * RENDER_TILE;
+            boundsGatherTile(x0, y0, x0 + RENDER_TILE - 1, y0 + RENDER_TILE - 1, cand);
+            for (int y = y0; y < y0 + RENDER_TILE; ++y) {
+#ifdef SIMD_X86
+                if (level == SIMD_AVX512) {
+                    shadeRowBoundsAVX512(cand, y, x0, x0 + RENDER_TILE, tmpMousePosX, tmpMousePosY);
+                    continue;
+                }
+                if (level == SIMD_AVX2) {
+                    shadeRowBoundsAVX2(cand, y, x0, x0 + RENDER_TILE, tmpMousePosX, tmpMousePosY);
+                    continue;
+                }
+#endif
+                shadeRowBoundsScalar(cand, y, x0, x0 + RENDER_TILE, tmpMousePosX, tmpMousePosY);
+            }
+        }
+    }
+}
+
+// Pixel coordinate of a satellite coordinate, clamped to [0, size)
+static inline int jfaPixel(float v, int size) {
+    if (v < 0.5f) return 0;
+    if (v >= size - 0.5f) return size - 1;
+    return (int)(v + 0.5f);
+}
+
+// Sets every pixel to -1 (no seed), then seeds the satellites' pixels.
+// Called by all threads of a parallel region.
+void jfaSeed(int* map) {
+    int i;
+#pragma omp for schedule(static)
+    for (i = 0; i < SIZE; ++i) {
+        map[i] = -1;
+    }
+#pragma omp single
+    for (int j = shadeSatellites->count - 1; j >= 0; --j) {
+        float x = shadeSatellites->x[j];
+        float y = shadeSatellites->y[j];
+        jfaNext[j] = -1;
+        if (x != x || y != y) continue; // NaN, never the nearest
+        int p = jfaPixel(y, WINDOW_HEIGHT) * WINDOW_WIDTH + jfaPixel(x, WINDOW_WIDTH);
+        jfaNext[j] = map[p];
+        map[p] = j;
+    }
+}
+
+// Nearest member of seed group 'head' to (px, py), its squared distance
+// computed like in the row shaders; ties go to the lower index
+static inline int jfaGroupNearest(int head, float px, float py, float* d2Out) {
+    int best = head;
+    float bestD2 = INFINITY;
+    for (int j = head; j >= 0; j = jfaNext[j]) {
+        float dx = px - shadeSatellites->x[j];
+        float dy = py - shadeSatellites->y[j];
+        float d2 = dx * dx + dy * dy;
+        if (d2 < bestD2) {
+            bestD2 = d2;
+            best = j;
+        }
+    }
+    *d2Out = bestD2;
+    return best;
+}
+
+// One jump-flooding pass, ties between groups go to the lower satellite
+// index as in the brute force search.
+// Called by all threads of a parallel region.
+void jfaPass(const int* in, int* out, int step) {
+    int y;
+#pragma omp for schedule(static)
+    for (y = 0; y < WINDOW_HEIGHT; ++y) {
+        const float py = (float)y;
+        for (int x = 0; x < WINDOW_WIDTH; ++x) {
+            const float px = (float)x;
+            int bestHead = in[y * WINDOW_WIDTH + x];
+            int best = -1;
+            float bestD2 = INFINITY;
+            if (bestHead >= 0) {
+                best = jfaGroupNearest(bestHead, px, py, &bestD2);
+            }
+            for (int oy = -step; oy <= step; oy += step) {
+                int ny = y + oy;
+                if (ny < 0 || ny >= WINDOW_HEIGHT) continue;
+                for (int ox = -step; ox <= step; ox += step) {
+                    int nx = x + ox;
+                    if (nx < 0 || nx >= WINDOW_WIDTH || (ox == 0 && oy == 0)) continue;
+                    int head = in[ny * WINDOW_WIDTH + nx];
+                    if (head < 0 || head == bestHead) continue;
+                    float d2;
+                    int s = jfaGroupNearest(head, px, py, &d2);
+                    if (d2 < bestD2 || (d2 == bestD2 && s < best)) {
+                        bestHead = head;
+                        best = s;
+                        bestD2 = d2;
+                    }
+                }
+            }
+            out[y * WINDOW_WIDTH + x] = bestHead;
+        }
+    }
+}
+
+// Runs the seed and all passes, returns the map holding the result.
+// Called by all threads of a parallel region.
+int* jfaNearestMap(void) {
+    int current = 0;
+    jfaSeed(jfaMap[current]);
+    jfaPass(jfaMap[current], jfaMap[1 - current], 1);
+    current = 1 - current;
+    for (int step = JFA_FIRST_STEP; step >= 1; step /= 2) {
+        jfaPass(jfaMap[current], jfaMap[1 - current], step);
+        current = 1 - current;
+    }
+    for (int step = 2; step >= 1; step /= 2) {
+        jfaPass(jfaMap[current], jfaMap[1 - current], step);
+        current = 1 - current;
+    }
+    return jfaMap[current];
+}
+
+// Colors pixel idx from the accumulated weights and the nearest satellite of
+// its seed group, white if that satellite covers the pixel
+static inline void jfaShadePixel(int idx, float px, float py, int head,
+    float weights, float sumR, float sumG, float sumB) {
+    float d2 = INFINITY;
+    int nearest = head >= 0 ? jfaGroupNearest(head, px, py, &d2) : 0;
+    if (d2 < SATELLITE_RADIUS * SATELLITE_RADIUS) {
+        shadePixels[idx].red = 255;
+        shadePixels[idx].green = 255;
+        shadePixels[idx].blue = 255;
+        return;
+    }
+    float invW = 1.0f / weights;
+    float r = shadeSatellites->red[nearest] + 3.0f * (sumR * invW);
+    float g = shadeSatellites->green[nearest] + 3.0f * (sumG * invW);
+    float b = shadeSatellites->blue[nearest] + 3.0f * (sumB * invW);
+    shadePixels[idx].red = (uint8_t)(r * 255.0f);
+    shadePixels[idx].green = (uint8_t)(g * 255.0f);
+    shadePixels[idx].blue = (uint8_t)(b * 255.0f);
+}
+
+// Row shader with a nearest satellite map: the satellite loop only sums weights
+void shadeRowJfaScalar(const int* nearestMap, int y, int x0, int x1, int tmpMousePosX, int tmpMousePosY) {
+
+    const float BH_R2 = BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS;
+    const float* satX = shadeSatellites->x;
+    const float* satY = shadeSatellites->y;
+    const float* satR = shadeSatellites->red;
+    const float* satG = shadeSatellites->green;
+    const float* satB = shadeSatellites->blue;
+    const int satCount = shadeSatellites->count;
 
+    const float py = (float)y;
+    int x;
+    for (x = x0; x < x1; ++x) {
+        const int idx = y * WINDOW_WIDTH + x;
+        const float px = (float)x;
 
+        float dxBH = px - tmpMousePosX;
+        float dyBH = py - tmpMousePosY;
+        if (dxBH * dxBH + dyBH * dyBH < BH_R2) {
+            shadePixels[idx].red = 0;
+            shadePixels[idx].green = 0;
+            shadePixels[idx].blue = 0;
+            continue;
+        }
 
-// Stores 2D data like the coordinates
-typedef struct{
-   float x;
-   float y;
-} floatvector;
+        float sumR = 0.f, sumG = 0.f, sumB = 0.f;
+        float weights = 0.f;
+        for (int j = 0; j < satCount; ++j) {
+            float dx = px - satX[j];
+            float dy = py - satY[j];
+            float d2 = dx * dx + dy * dy;
+            float w = 1.0f / (d2 * d2);
+            weights += w;
+            sumR += satR[j] * w;
+            sumG += satG[j] * w;
+            sumB += satB[j] * w;
+        }
+        jfaShadePixel(idx, px, py, nearestMap[idx], weights, sumR, sumG, sumB);
+    }
+}
 
-// Stores 2D data like the coordinates
-typedef struct{
-   double x;
-   double y;
-} doublevector;
+#ifdef SIMD_X86
+// AVX2 variant of shadeRowJfaScalar: weights of 8 pixels per iteration,
+// the pixels are then finished one by one
+SIMD_TARGET_AVX2
+void shadeRowJfaAVX2(const int* nearestMap, int y, int tmpMousePosX, int tmpMousePosY) {
 
-// Each float may vary from 0.0f ... 1.0f
-typedef struct{
-   float blue;
-   float green;
-   float red;
-} color_f32;
+    const float* satX = shadeSatellites->x;
+    const float* satY = shadeSatellites->y;
+    const float* satR = shadeSatellites->red;
+    const float* satG = shadeSatellites->green;
+    const float* satB = shadeSatellites->blue;
+    const int satCount = shadeSatellites->count;
 
-// Stores rendered colors. Each value may vary from 0 ... 255
-typedef struct{
-   uint8_t blue;
-   uint8_t green;
-   uint8_t red;
-   uint8_t reserved;
-} color_u8;
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 laneOffset = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+    const float py = (float)y;
+    const float bhDy = py - tmpMousePosY;
+    float lanes[4][8];
 
-// Stores the satellite data, which fly around black hole in the space
-typedef struct{
-   color_f32 identifier;
-   floatvector position;
-   floatvector velocity;
-} satellite;
+    const int vectorEnd = WINDOW_WIDTH - WINDOW_WIDTH % 8;
+    int x;
+    for (x = 0; x < vectorEnd; x += 8) {
+        // all 8 pixels in the black hole only if both ends are
+        float dxa = (float)x - tmpMousePosX, dxb = (float)(x + 7) - tmpMousePosX;
+        if (dxa * dxa + bhDy * bhDy < BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS &&
+            dxb * dxb + bhDy * bhDy < BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS) {
+            shadeRowJfaScalar(nearestMap, y, x, x + 8, tmpMousePosX, tmpMousePosY);
+            continue;
+        }
 
-// Pixel buffer which is rendered to the screen
-color_u8* pixels;
+        __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), laneOffset);
+        __m256 sumR = _mm256_setzero_ps(), sumG = _mm256_setzero_ps(), sumB = _mm256_setzero_ps();
+        __m256 weights = _mm256_setzero_ps();
+        for (int j = 0; j < satCount; ++j) {
+            __m256 dx = _mm256_sub_ps(px, _mm256_set1_ps(satX[j]));
+            float dy = py - satY[j];
+            __m256 d2 = _mm256_fmadd_ps(dx, dx, _mm256_set1_ps(dy * dy));
+            __m256 w = _mm256_div_ps(one, _mm256_mul_ps(d2, d2));
+            weights = _mm256_add_ps(weights, w);
+            sumR = _mm256_fmadd_ps(_mm256_set1_ps(satR[j]), w, sumR);
+            sumG = _mm256_fmadd_ps(_mm256_set1_ps(satG[j]), w, sumG);
+            sumB = _mm256_fmadd_ps(_mm256_set1_ps(satB[j]), w, sumB);
+        }
+        _mm256_storeu_ps(lanes[0], weights);
+        _mm256_storeu_ps(lanes[1], sumR);
+        _mm256_storeu_ps(lanes[2], sumG);
+        _mm256_storeu_ps(lanes[3], sumB);
 
-// Pixel buffer which is used for error checking
-color_u8* correctPixels;
+        for (int l = 0; l < 8; ++l) {
+            const int idx = y * WINDOW_WIDTH + x + l;
+            const float pxl = (float)(x + l);
+            const float dxBH = pxl - tmpMousePosX;
+            if (dxBH * dxBH + bhDy * bhDy < BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS) {
+                shadePixels[idx].red = 0;
+                shadePixels[idx].green = 0;
+                shadePixels[idx].blue = 0;
+                continue;
+            }
+            jfaShadePixel(idx, pxl, py, nearestMap[idx], lanes[0][l], lanes[1][l], lanes[2][l], lanes[3][l]);
+        }
+    }
+    shadeRowJfaScalar(nearestMap, y, vectorEnd, WINDOW_WIDTH, tmpMousePosX, tmpMousePosY);
+}
 
-// Buffer for all satellites in the space
-satellite* satellites;
-satellite* backupSatelites;
+// AVX-512 variant of shadeRowJfaScalar, 16 pixels per iteration
+SIMD_TARGET_AVX512
+void shadeRowJfaAVX512(const int* nearestMap, int y, int tmpMousePosX, int tmpMousePosY) {
 
+    const float* satX = shadeSatellites->x;
+    const float* satY = shadeSatellites->y;
+    const float* satR = shadeSatellites->red;
+    const float* satG = shadeSatellites->green;
+    const float* satB = shadeSatellites->blue;
+    const int satCount = shadeSatellites->count;
 
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 laneOffset = _mm512_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f,
+        8.f, 9.f, 10.f, 11.f, 12.f, 13.f, 14.f, 15.f);
+    const float py = (float)y;
+    const float bhDy = py - tmpMousePosY;
+    float lanes[4][16];
 
-void init(){
+    const int vectorEnd = WINDOW_WIDTH - WINDOW_WIDTH % 16;
+    int x;
+    for (x = 0; x < vectorEnd; x += 16) {
+        float dxa = (float)x - tmpMousePosX, dxb = (float)(x + 15) - tmpMousePosX;
+        if (dxa * dxa + bhDy * bhDy < BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS &&
+            dxb * dxb + bhDy * bhDy < BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS) {
+            shadeRowJfaScalar(nearestMap, y, x, x + 16, tmpMousePosX, tmpMousePosY);
+            continue;
+        }
 
+        __m512 px = _mm512_add_ps(_mm512_set1_ps((float)x), laneOffset);
+        __m512 sumR = _mm512_setzero_ps(), sumG = _mm512_setzero_ps(), sumB = _mm512_setzero_ps();
+        __m512 weights = _mm512_setzero_ps();
+        for (int j = 0; j < satCount; ++j) {
+            __m512 dx = _mm512_sub_ps(px, _mm512_set1_ps(satX[j]));
+            float dy = py - satY[j];
+            __m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_set1_ps(dy * dy));
+            __m512 w = _mm512_div_ps(one, _mm512_mul_ps(d2, d2));
+            weights = _mm512_add_ps(weights, w);
+            sumR = _mm512_fmadd_ps(_mm512_set1_ps(satR[j]), w, sumR);
+            sumG = _mm512_fmadd_ps(_mm512_set1_ps(satG[j]), w, sumG);
+            sumB = _mm512_fmadd_ps(_mm512_set1_ps(satB[j]), w, sumB);
+        }
+        _mm512_storeu_ps(lanes[0], weights);
+        _mm512_storeu_ps(lanes[1], sumR);
+        _mm512_storeu_ps(lanes[2], sumG);
+        _mm512_storeu_ps(lanes[3], sumB);
 
+        for (int l = 0; l < 16; ++l) {
+            const int idx = y * WINDOW_WIDTH + x + l;
+            const float pxl = (float)(x + l);
+            const float dxBH = pxl - tmpMousePosX;
+            if (dxBH * dxBH + bhDy * bhDy < BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS) {
+                shadePixels[idx].red = 0;
+                shadePixels[idx].green = 0;
+                shadePixels[idx].blue = 0;
+                continue;
+            }
+            jfaShadePixel(idx, pxl, py, nearestMap[idx], lanes[0][l], lanes[1][l], lanes[2][l], lanes[3][l]);
+        }
+    }
+    shadeRowJfaScalar(nearestMap, y, vectorEnd, WINDOW_WIDTH, tmpMousePosX, tmpMousePosY);
 }
+#endif
 
-// ## You are asked to make this code parallel ##
-// Physics engine loop. (This is called once a frame before graphics engine)
-// Moves the satellites based on gravity
-// This is done multiple times in a frame because the Euler integration
-// is not accurate enough to be done only once
-void parallelPhysicsEngine(void) {
-
-    int tmpMousePosX = mousePosX;
-    int tmpMousePosY = mousePosY;
+// Jump-flooding rendering: nearest satellite map, then the weight-only shaders
+void parallelGraphicsEngineJfa(int tmpMousePosX, int tmpMousePosY) {
+    const simdlevel level = simdLevel;
+#pragma omp parallel
+    {
+        const int* nearestMap = jfaNearestMap();
+        int y;
+#pragma omp for schedule(static)
+        for (y = 0; y < WINDOW_HEIGHT; ++y) {
+#ifdef SIMD_X86
+            if (level == SIMD_AVX512) {
+                shadeRowJfaAVX512(nearestMap, y, tmpMousePosX, tmpMousePosY);
+                continue;
+            }
+            if (level == SIMD_AVX2) {
+                shadeRowJfaAVX2(nearestMap, y, tmpMousePosX, tmpMousePosY);
+                continue;
+            }
+#endif
+            shadeRowJfaScalar(nearestMap, y, 0, WINDOW_WIDTH, tmpMousePosX, tmpMousePosY);
+        }
+    }
+}
 
-    // double precision required for accumulation inside this routine,
-    // but float storage is ok outside these loops.
-    doublevector tmpPosition[SATELLITE_COUNT];
-    doublevector tmpVelocity[SATELLITE_COUNT];
+void renderTreeAlloc(rendertree* rt) {
+    int count = shadeSatellites->count;
+    int threads = omp_get_max_threads();
+    bhTreeAlloc(&rt->tree, count);
+    rt->x = (double*)alignedMalloc(sizeof(double) * count);
+    rt->y = (double*)alignedMalloc(sizeof(double) * count);
+    rt->momentCapacity = rt->tree.nodeCapacity;
+    rt->moments = (rendermoments*)malloc(sizeof(rendermoments) * rt->momentCapacity);
+    rt->candidates = (rendercandidates*)calloc(threads, sizeof(rendercandidates));
+    for (int t = 0; t < threads; ++t) {
+        rt->candidates[t].marked = (uint64_t*)calloc((count + 63) / 64, sizeof(uint64_t));
+    }
+}
 
-    // Copy in (float -> double) once
-    for (int idx = 0; idx < SATELLITE_COUNT; ++idx) {
-        tmpPosition[idx].x = satellites[idx].position.x;
-        tmpPosition[idx].y = satellites[idx].position.y;
-        tmpVelocity[idx].x = satellites[idx].velocity.x;
-        tmpVelocity[idx].y = satellites[idx].velocity.y;
+void renderTreeFree(rendertree* rt) {
+    bhTreeFree(&rt->tree);
+    alignedFree(rt->x);
+    alignedFree(rt->y);
+    free(rt->moments);
+    int threads = omp_get_max_threads();
+    for (int t = 0; t < threads; ++t) {
+        renderCandidatesFree(&rt->candidates[t]);
     }
+    free(rt->candidates);
+}
 
-    const double dt = (double)DELTATIME / (double)PHYSICSUPDATESPERFRAME;
+// Builds the quadtree and the node moments. The tree is built from
+// positions clamped to a band around the window, so satellites far outside
+// do not stretch it; the moments use the real positions.
+// Called by all threads of a parallel region.
+static void renderTreeBuild(rendertree* rt) {
+    bhtree* tree = &rt->tree;
+    const int count = shadeSatellites->count;
+    int i, n;
+#pragma omp for schedule(static)
+    for (i = 0; i < count; ++i) {
+        rt->x[i] = fmin(fmax(shadeSatellites->x[i], -(double)WINDOW_WIDTH), 2.0 * WINDOW_WIDTH);
+        rt->y[i] = fmin(fmax(shadeSatellites->y[i], -(double)WINDOW_WIDTH), 2.0 * WINDOW_WIDTH);
+    }
+    bhTreeBuild(tree, rt->x, rt->y, count);
+#pragma omp single
+    {
+        const int nodes = tree->levelStart[tree->levels];
+        if (nodes > rt->momentCapacity) {
+            rt->momentCapacity = tree->nodeCapacity;
+            free(rt->moments);
+            rt->moments = (rendermoments*)malloc(sizeof(rendermoments) * rt->momentCapacity);
+            if (!rt->moments) {
+                fprintf(stderr, "Failed to allocate %d tree node moments\n", rt->momentCapacity);
+                exit(1);
+            }
+        }
+    }
 
-    int i;
-#pragma omp parallel for schedule(static) // or: schedule(static, 8)
-    for (i = 0; i < SATELLITE_COUNT; ++i) {
+    // Deepest level first, like the N-body masses
+    for (int level = tree->levels - 1; level >= 0; --level) {
+#pragma omp for schedule(static)
+        for (n = tree->levelStart[level]; n < tree->levelStart[level + 1]; ++n) {
+            const bhnode* node = &tree->nodes[n];
+            rendermoments* m = &rt->moments[n];
+            double mass[4] = { 0.0, 0.0, 0.0, 0.0 };
+            double mx[4] = { 0.0, 0.0, 0.0, 0.0 };
+            double my[4] = { 0.0, 0.0, 0.0, 0.0 };
+            m->minX = m->minY = INFINITY;
+            m->maxX = m->maxY = -INFINITY;
+            if (node->child < 0) {
+                for (int j = node->begin; j < node->end; ++j) {
+                    int k = tree->order[j];
+                    float x = shadeSatellites->x[k];
+                    float y = shadeSatellites->y[k];
+                    double c[4] = { 1.0, shadeSatellites->red[k], shadeSatellites->green[k], shadeSatellites->blue[k] };
+                    for (int q = 0; q < 4; ++q) {
+                        mass[q] += c[q];
+                        mx[q] += c[q] * x;
+                        my[q] += c[q] * y;
+                    }
+                    m->minX = fminf(m->minX, x);
+                    m->minY = fminf(m->minY, y);
+                    m->maxX = fmaxf(m->maxX, x);
+                    m->maxY = fmaxf(m->maxY, y);
+                }
+            } else {
+                for (int c = node->child; c < node->child + node->children; ++c) {
+                    const rendermoments* cm = &rt->moments[c];
+                    for (int q = 0; q < 4; ++q) {
+                        mass[q] += cm->m[q];
+                        mx[q] += (double)cm->m[q] * cm->cx[q];
+                        my[q] += (double)cm->m[q] * cm->cy[q];
+                    }
+                    m->minX = fminf(m->minX, cm->minX);
+                    m->minY = fminf(m->minY, cm->minY);
+                    m->maxX = fmaxf(m->maxX, cm->maxX);
+                    m->maxY = fmaxf(m->maxY, cm->maxY);
+                }
+            }
+            for (int q = 0; q < 4; ++q) {
+                m->m[q] = (float)mass[q];
+                // a channel that is zero everywhere contributes nothing, any center will do
+                m->cx[q] = (float)(mass[q] > 0.0 ? mx[q] / mass[q] : mx[0] / mass[0]);
+                m->cy[q] = (float)(mass[q] > 0.0 ? my[q] / mass[q] : my[0] / mass[0]);
+            }
+            double fx = fmax(m->cx[0] - m->minX, m->maxX - m->cx[0]);
+            double fy = fmax(m->cy[0] - m->minY, m->maxY - m->cy[0]);
+            m->radius = (float)sqrt(fx * fx + fy * fy);
+        }
+    }
+}
 
-        // Work in registers to avoid false sharing
-        double x = tmpPosition[i].x;
-        double y = tmpPosition[i].y;
-        double vx = tmpVelocity[i].x;
-        double vy = tmpVelocity[i].y;
+// Squared distance from a node's bounding box to the pixel rectangle
+static inline double renderBoxDistance2(const rendermoments* m, double tx0, double ty0, double tx1, double ty1) {
+    double dx = fmax(0.0, fmax(m->minX - tx1, tx0 - m->maxX));
+    double dy = fmax(0.0, fmax(m->minY - ty1, ty0 - m->maxY));
+    return dx * dx + dy * dy;
+}
 
-        int physicsUpdateIndex;
-        for (physicsUpdateIndex = 0;
-            physicsUpdateIndex < PHYSICSUPDATESPERFRAME;
-            ++physicsUpdateIndex)
-        {
-            double dx = x - tmpMousePosX;
-            double dy = y - tmpMousePosY;
-            double d2 = dx * dx + dy * dy;
+// Adds the second order Taylor expansion of the node's sums about (x0, y0)
+// to acc. With (a, b) from a moment's center to (x0, y0) and r2 = a^2 + b^2,
+// w = r2^-2 has the derivatives
+//   w_a = -4 a r2^-3, w_aa = (24 a^2 / r2 - 4) r2^-3, w_ab = 24 a b r2^-4.
+static inline void renderFarFieldAdd(double acc[4][6], const rendermoments* m, double x0, double y0) {
+    for (int q = 0; q < 4; ++q) {
+        double mass = m->m[q];
+        if (mass == 0.0) continue;
+        double a = x0 - m->cx[q];
+        double b = y0 - m->cy[q];
+        double inv = 1.0 / (a * a + b * b);
+        double inv3 = inv * inv * inv;
+        acc[q][0] += mass * inv * inv;
+        acc[q][1] += mass * -4.0 * a * inv3;
+        acc[q][2] += mass * -4.0 * b * inv3;
+        acc[q][3] += mass * 0.5 * (24.0 * a * a * inv - 4.0) * inv3;
+        acc[q][4] += mass * 24.0 * a * b * inv * inv3;
+        acc[q][5] += mass * 0.5 * (24.0 * b * b * inv - 4.0) * inv3;
+    }
+}
 
-            double invd = 1.0 / sqrt(d2);
-            double invd2 = invd * invd;
+// Splits the satellites for the tile with pixels tx0 ... tx1, ty0 ... ty1
+// (inclusive) into exact candidates and the far field. Returns 0 if no
+// cluster went to the far field.
+//  1. A nearest neighbour walk finds the smallest farthest-corner distance
+//     of any satellite, an upper bound of every pixel's nearest distance.
+//  2. A second walk sends a node to the far field if it passes the opening
+//     test and its box is beyond that bound, and marks the satellites of
+//     the leaves it reaches.
+static int renderTreeGatherTile(const rendertree* rt, int tx0, int ty0, int tx1, int ty1,
+    rendercandidates* cand, farfield* far) {
+    const bhtree* tree = &rt->tree;
+    const rendermoments* moments = rt->moments;
+    int stack[3 * BH_LEVELS + 4];
+    int top = 0;
 
-            double ax = (GRAVITY * dx) * (invd * invd2);
-            double ay = (GRAVITY * dy) * (invd * invd2);
+    double nearestFar2 = INFINITY;
+    stack[top++] = 0;
+    while (top > 0) {
+        const int n = stack[--top];
+        const bhnode* node = &tree->nodes[n];
+        if (renderBoxDistance2(&moments[n], tx0, ty0, tx1, ty1) >= nearestFar2) continue;
+        if (node->child < 0) {
+            for (int j = node->begin; j < node->end; ++j) {
+                int k = tree->order[j];
+                double sx = shadeSatellites->x[k];
+                double sy = shadeSatellites->y[k];
+                double fx = fmax(fabs(sx - tx0), fabs(sx - tx1));
+                double fy = fmax(fabs(sy - ty0), fabs(sy - ty1));
+                if (fx * fx + fy * fy < nearestFar2) nearestFar2 = fx * fx + fy * fy;
+            }
+            continue;
+        }
+        // nearest child last, so it is visited first
+        int children[4];
+        double distance[4];
+        int count = 0;
+        for (int c = node->child; c < node->child + node->children; ++c) {
+            double d = renderBoxDistance2(&moments[c], tx0, ty0, tx1, ty1);
+            int k = count++;
+            while (k > 0 && distance[k - 1] < d) {
+                children[k] = children[k - 1];
+                distance[k] = distance[k - 1];
+                --k;
+            }
+            children[k] = c;
+            distance[k] = d;
+        }
+        for (int k = 0; k < count; ++k) stack[top++] = children[k];
+    }
 
-            vx -= ax * dt;
-            vy -= ay * dt;
+    const double x0 = 0.5 * (tx0 + tx1);
+    const double y0 = 0.5 * (ty0 + ty1);
+    const double halfDiagonal = 0.5 * sqrt((double)(tx1 - tx0) * (tx1 - tx0) + (double)(ty1 - ty0) * (ty1 - ty0));
+    const double theta2 = renderTheta * renderTheta;
+    const double nearestLimit = nearestFar2 * RENDER_BOUNDS_SLACK;
+    double acc[4][6] = { { 0.0 } };
+    int farNodes = 0;
+    int marked = 0;
+    top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const int n = stack[--top];
+        const bhnode* node = &tree->nodes[n];
+        const rendermoments* m = &moments[n];
+        double dx = m->cx[0] - x0;
+        double dy = m->cy[0] - y0;
+        double open = m->radius + halfDiagonal;
+        if (open * open < theta2 * (dx * dx + dy * dy) &&
+            renderBoxDistance2(m, tx0, ty0, tx1, ty1) > nearestLimit) {
+            renderFarFieldAdd(acc, m, x0, y0);
+            ++farNodes;
+        } else if (node->child < 0) {
+            for (int j = node->begin; j < node->end; ++j) {
+                int k = tree->order[j];
+                cand->marked[k >> 6] |= (uint64_t)1 << (k & 63);
+            }
+            marked += node->end - node->begin;
+        } else {
+            for (int c = node->child; c < node->child + node->children; ++c) {
+                stack[top++] = c;
+            }
+        }
+    }
 
-            x += vx * dt;
-            y += vy * dt;
+    renderCandidatesReserve(cand, marked);
+    renderCandidatesCollect(cand);
+    far->x = (float)x0;
+    far->y = (float)y0;
+    for (int q = 0; q < 4; ++q) {
+        for (int k = 0; k < 6; ++k) {
+            far->c[q][k] = (float)acc[q][k];
         }
+    }
+    return farNodes > 0;
+}
 
-        // Single write-back per satellite
-        tmpPosition[i].x = x;
-        tmpPosition[i].y = y;
-        tmpVelocity[i].x = vx;
-        tmpVelocity[i].y = vy;
+// Tree rendering: tiles are shaded against their near satellites, starting
+// from the far field of the rest
+void parallelGraphicsEngineTree(int tmpMousePosX, int tmpMousePosY) {
+    const int tilesX = WINDOW_WIDTH / RENDER_TILE;
+    const int tiles = tilesX * (WINDOW_HEIGHT / RENDER_TILE);
+#pragma omp parallel
+    {
+        renderTreeBuild(&renderTree);
+        rendercandidates* cand = &renderTree.candidates[omp_get_thread_num()];
+        farfield far;
+        int tile;
+#pragma omp for schedule(dynamic, 4)
+        for (tile = 0; tile < tiles; ++tile) {
+            int x0 = tile % tilesX * RENDER_TILE;
+            int y0 = tile / tilesX * RENDER_TILE;
+            int hasFar = renderTreeGatherTile(&renderTree, x0, y0, x0 + RENDER_TILE - 1, y0 + RENDER_TILE - 1, cand, &far);
+            for (int y = y0; y < y0 + RENDER_TILE; ++y) {
+                shadeRow(&cand->sats, y, x0, x0 + RENDER_TILE, tmpMousePosX, tmpMousePosY, hasFar ? &far : NULL);
+            }
+        }
     }
+}
 
-    // Copy back into float storage once
-    for (int idx2 = 0; idx2 < SATELLITE_COUNT; ++idx2) {
-        satellites[idx2].position.x = (float)tmpPosition[idx2].x;
-        satellites[idx2].position.y = (float)tmpPosition[idx2].y;
-        satellites[idx2].velocity.x = (float)tmpVelocity[idx2].x;
-        satellites[idx2].velocity.y = (float)tmpVelocity[idx2].y;
+void tileSchedulerAlloc(void) {
+    int threads = omp_get_max_threads();
+    tileDeques = (tiledeque*)alignedMalloc(sizeof(tiledeque) * threads);
+    tileAccumulators = (tileaccumulator*)alignedMalloc(sizeof(tileaccumulator) * threads);
+    for (int t = 0; t < threads; ++t) {
+        omp_init_lock(&tileDeques[t].lock);
+        tileDeques[t].next = tileDeques[t].end = 0;
+        tileDeques[t].busy = 0.0;
     }
 }
 
+void tileSchedulerFree(void) {
+    int threads = omp_get_max_threads();
+    for (int t = 0; t < threads; ++t) {
+        omp_destroy_lock(&tileDeques[t].lock);
+    }
+    alignedFree(tileDeques);
+    alignedFree(tileAccumulators);
+}
 
-// ## You are asked to make this code parallel ##
-// Rendering loop (This is called once a frame after physics engine)
-// Decides the color for each pixel.
-void parallelGraphicsEngine(void) {
+// Next tile for 'thread': the front of its own deque, else the back of
+// another one. -1 once all are empty; tiles are never added during a frame.
+static int takeTile(int thread, int threads) {
+    for (int k = 0; k < threads; ++k) {
+        tiledeque* d = &tileDeques[(thread + k) % threads];
+        int tile = -1;
+        omp_set_lock(&d->lock);
+        if (d->next < d->end) {
+            tile = k == 0 ? d->next++ : --d->end;
+        }
+        omp_unset_lock(&d->lock);
+        if (tile >= 0) return tile;
+    }
+    return -1;
+}
 
-    int tmpMousePosX = mousePosX;
-    int tmpMousePosY = mousePosY;
+// One satellite block [j0, j1) over the tile with corner (x0, y0), with the
+// arithmetic of shadeRowScalar. 'first' starts the sums, 'last' writes the
+// pixels.
+static void shadeTileBlockScalar(tileaccumulator* acc, int j0, int j1, int x0, int y0,
+    int first, int last, int tmpMousePosX, int tmpMousePosY) {
 
     const float BH_R2 = BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS;
     const float SAT_R2 = SATELLITE_RADIUS * SATELLITE_RADIUS;
+    const float* satX = shadeSatellites->x;
+    const float* satY = shadeSatellites->y;
+    const float* satR = shadeSatellites->red;
+    const float* satG = shadeSatellites->green;
+    const float* satB = shadeSatellites->blue;
 
-    int y;
-#pragma omp parallel for schedule(static) // or: schedule(static, 2)
-    for (y = 0; y < WINDOW_HEIGHT; ++y) {
-
-        int idx = y * WINDOW_WIDTH;
-        float py = (float)y;
+    for (int ty = 0; ty < SCHED_TILE_HEIGHT; ++ty) {
+        const float py = (float)(y0 + ty);
+        for (int tx = 0; tx < SCHED_TILE_WIDTH; ++tx) {
+            const int p = ty * SCHED_TILE_WIDTH + tx;
+            const int idx = (y0 + ty) * WINDOW_WIDTH + x0 + tx;
+            const float px = (float)(x0 + tx);
 
-        int x;
-        for (x = 0; x < WINDOW_WIDTH; ++x, ++idx) {
-
-            float px = (float)x;
-
-            // Black hole test (no sqrt)
             float dxBH = px - tmpMousePosX;
             float dyBH = py - tmpMousePosY;
-            float d2BH = dxBH * dxBH + dyBH * dyBH;
-            if (d2BH < BH_R2) {
-                pixels[idx].red = 0;
-                pixels[idx].green = 0;
-                pixels[idx].blue = 0;
+            if (dxBH * dxBH + dyBH * dyBH < BH_R2) {
+                if (last) {
+                    shadePixels[idx].red = 0;
+                    shadePixels[idx].green = 0;
+                    shadePixels[idx].blue = 0;
+                }
                 continue;
             }
 
-            // Single-pass satellite loop
-            float sumR = 0.f, sumG = 0.f, sumB = 0.f;
-            float weights = 0.f;
-
-            float shortestD2 = INFINITY;
-            color_f32 nearestID = (color_f32){ 0.f, 0.f, 0.f };
-            int hitsSatellite = 0;
-
-            int j;
-            for (j = 0; j < SATELLITE_COUNT; ++j) {
+            if (first) {
+                acc->sumR[p] = acc->sumG[p] = acc->sumB[p] = 0.f;
+                acc->weights[p] = 0.f;
+                acc->shortestD2[p] = INFINITY;
+                acc->nearest[p] = 0;
+                acc->hits[p] = 0.f;
+            }
+            float sumR = acc->sumR[p], sumG = acc->sumG[p], sumB = acc->sumB[p];
+            float weights = acc->weights[p];
+            float shortestD2 = acc->shortestD2[p];
+            int nearest = acc->nearest[p];
+            int hitsSatellite = acc->hits[p] != 0.f;
 
-                float dx = px - satellites[j].position.x;
-                float dy = py - satellites[j].position.y;
+            for (int j = hitsSatellite ? j1 : j0; j < j1; ++j) {
+                float dx = px - satX[j];
+                float dy = py - satY[j];
                 float d2 = dx * dx + dy * dy;
-
                 if (d2 < SAT_R2) {
-                    pixels[idx].red = 255;
-                    pixels[idx].green = 255;
-                    pixels[idx].blue = 255;
                     hitsSatellite = 1;
                     break;
                 }
-
                 float w = 1.0f / (d2 * d2);
                 weights += w;
-
-                sumR += satellites[j].identifier.red * w;
-                sumG += satellites[j].identifier.green * w;
-                sumB += satellites[j].identifier.blue * w;
-
+                sumR += satR[j] * w;
+                sumG += satG[j] * w;
+                sumB += satB[j] * w;
                 if (d2 < shortestD2) {
                     shortestD2 = d2;
-                    nearestID = satellites[j].identifier;
+                    nearest = j;
                 }
             }
 
-            if (!hitsSatellite) {
+            if (!last) {
+                acc->sumR[p] = sumR;
+                acc->sumG[p] = sumG;
+                acc->sumB[p] = sumB;
+                acc->weights[p] = weights;
+                acc->shortestD2[p] = shortestD2;
+                acc->nearest[p] = nearest;
+                acc->hits[p] = (float)hitsSatellite;
+            } else if (hitsSatellite) {
+                shadePixels[idx].red = 255;
+                shadePixels[idx].green = 255;
+                shadePixels[idx].blue = 255;
+            } else {
                 float invW = 1.0f / weights;
-                float r = nearestID.red + 3.0f * (sumR * invW);
-                float g = nearestID.green + 3.0f * (sumG * invW);
-                float b = nearestID.blue + 3.0f * (sumB * invW);
+                float r = satR[nearest] + 3.0f * (sumR * invW);
+                float g = satG[nearest] + 3.0f * (sumG * invW);
+                float b = satB[nearest] + 3.0f * (sumB * invW);
+                shadePixels[idx].red = (uint8_t)(r * 255.0f);
+                shadePixels[idx].green = (uint8_t)(g * 255.0f);
+                shadePixels[idx].blue = (uint8_t)(b * 255.0f);
+            }
+        }
+    }
+}
+
+#ifdef SIMD_X86
+// shadeTileBlockScalar with the arithmetic of shadeRowAVX2
+SIMD_TARGET_AVX2
+static void shadeTileBlockAVX2(tileaccumulator* acc, int j0, int j1, int x0, int y0,
+    int first, int last, int tmpMousePosX, int tmpMousePosY) {
+
+    const float* satX = shadeSatellites->x;
+    const float* satY = shadeSatellites->y;
+    const float* satR = shadeSatellites->red;
+    const float* satG = shadeSatellites->green;
+    const float* satB = shadeSatellites->blue;
+
+    const __m256 bhR2 = _mm256_set1_ps(BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS);
+    const __m256 satR2 = _mm256_set1_ps(SATELLITE_RADIUS * SATELLITE_RADIUS);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 three = _mm256_set1_ps(3.0f);
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    const __m256 laneOffset = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+    const __m256i white = _mm256_set1_epi32(0x00FFFFFF);
+    const __m256 mouseX = _mm256_set1_ps((float)tmpMousePosX);
+
+    for (int ty = 0; ty < SCHED_TILE_HEIGHT; ++ty) {
+        const int y = y0 + ty;
+        const float py = (float)y;
+        const float dyBH = py - tmpMousePosY;
+        const __m256 d2BHy = _mm256_set1_ps(dyBH * dyBH);
+        for (int tx = 0; tx < SCHED_TILE_WIDTH; tx += 8) {
+            const int p = ty * SCHED_TILE_WIDTH + tx;
+            __m256 px = _mm256_add_ps(_mm256_set1_ps((float)(x0 + tx)), laneOffset);
+
+            __m256 dxBH = _mm256_sub_ps(px, mouseX);
+            __m256 blackHole = _mm256_cmp_ps(_mm256_fmadd_ps(dxBH, dxBH, d2BHy), bhR2, _CMP_LT_OQ);
+            __m256i* out = (__m256i*)&shadePixels[y * WINDOW_WIDTH + x0 + tx];
+            if (_mm256_movemask_ps(blackHole) == 0xFF) {
+                if (last) _mm256_storeu_si256(out, _mm256_setzero_si256());
+                continue;
+            }
+
+            __m256 sumR, sumG, sumB, weights, shortestD2, nearR, nearG, nearB, hits;
+            if (first) {
+                sumR = sumG = sumB = weights = _mm256_setzero_ps();
+                shortestD2 = _mm256_set1_ps(INFINITY);
+                nearR = nearG = nearB = hits = _mm256_setzero_ps();
+            } else {
+                sumR = _mm256_load_ps(&acc->sumR[p]);
+                sumG = _mm256_load_ps(&acc->sumG[p]);
+                sumB = _mm256_load_ps(&acc->sumB[p]);
+                weights = _mm256_load_ps(&acc->weights[p]);
+                shortestD2 = _mm256_load_ps(&acc->shortestD2[p]);
+                nearR = _mm256_load_ps(&acc->nearR[p]);
+                nearG = _mm256_load_ps(&acc->nearG[p]);
+                nearB = _mm256_load_ps(&acc->nearB[p]);
+                hits = _mm256_load_ps(&acc->hits[p]);
+            }
+
+            if (_mm256_movemask_ps(hits) != 0xFF) {
+                for (int j = j0; j < j1; ++j) {
+                    __m256 dx = _mm256_sub_ps(px, _mm256_set1_ps(satX[j]));
+                    float dy = py - satY[j];
+                    __m256 d2 = _mm256_fmadd_ps(dx, dx, _mm256_set1_ps(dy * dy));
 
-                pixels[idx].red = (uint8_t)(r * 255.0f);
-                pixels[idx].green = (uint8_t)(g * 255.0f);
-                pixels[idx].blue = (uint8_t)(b * 255.0f);
+                    hits = _mm256_or_ps(hits, _mm256_cmp_ps(d2, satR2, _CMP_LT_OQ));
+                    if (_mm256_movemask_ps(hits) == 0xFF) break;
+
+                    __m256 w = _mm256_div_ps(one, _mm256_mul_ps(d2, d2));
+                    weights = _mm256_add_ps(weights, w);
+
+                    __m256 r = _mm256_set1_ps(satR[j]);
+                    __m256 g = _mm256_set1_ps(satG[j]);
+                    __m256 b = _mm256_set1_ps(satB[j]);
+                    sumR = _mm256_fmadd_ps(r, w, sumR);
+                    sumG = _mm256_fmadd_ps(g, w, sumG);
+                    sumB = _mm256_fmadd_ps(b, w, sumB);
+
+                    __m256 closer = _mm256_cmp_ps(d2, shortestD2, _CMP_LT_OQ);
+                    shortestD2 = _mm256_blendv_ps(shortestD2, d2, closer);
+                    nearR = _mm256_blendv_ps(nearR, r, closer);
+                    nearG = _mm256_blendv_ps(nearG, g, closer);
+                    nearB = _mm256_blendv_ps(nearB, b, closer);
+                }
             }
+
+            if (!last) {
+                _mm256_store_ps(&acc->sumR[p], sumR);
+                _mm256_store_ps(&acc->sumG[p], sumG);
+                _mm256_store_ps(&acc->sumB[p], sumB);
+                _mm256_store_ps(&acc->weights[p], weights);
+                _mm256_store_ps(&acc->shortestD2[p], shortestD2);
+                _mm256_store_ps(&acc->nearR[p], nearR);
+                _mm256_store_ps(&acc->nearG[p], nearG);
+                _mm256_store_ps(&acc->nearB[p], nearB);
+                _mm256_store_ps(&acc->hits[p], hits);
+                continue;
+            }
+
+            __m256 invW = _mm256_div_ps(one, weights);
+            __m256 r = _mm256_fmadd_ps(three, _mm256_mul_ps(sumR, invW), nearR);
+            __m256 g = _mm256_fmadd_ps(three, _mm256_mul_ps(sumG, invW), nearG);
+            __m256 b = _mm256_fmadd_ps(three, _mm256_mul_ps(sumB, invW), nearB);
+            __m256i ri = _mm256_cvttps_epi32(_mm256_mul_ps(r, scale));
+            __m256i gi = _mm256_cvttps_epi32(_mm256_mul_ps(g, scale));
+            __m256i bi = _mm256_cvttps_epi32(_mm256_mul_ps(b, scale));
+            __m256i color = _mm256_or_si256(bi, _mm256_or_si256(
+                _mm256_slli_epi32(gi, 8), _mm256_slli_epi32(ri, 16)));
+            color = _mm256_blendv_epi8(color, white, _mm256_castps_si256(hits));
+            color = _mm256_andnot_si256(_mm256_castps_si256(blackHole), color);
+            _mm256_storeu_si256(out, color);
         }
     }
 }
 
+// shadeTileBlockScalar with the arithmetic of shadeRowAVX512
+SIMD_TARGET_AVX512
+static void shadeTileBlockAVX512(tileaccumulator* acc, int j0, int j1, int x0, int y0,
+    int first, int last, int tmpMousePosX, int tmpMousePosY) {
 
-void destroy(){
+    const float* satX = shadeSatellites->x;
+    const float* satY = shadeSatellites->y;
+    const float* satR = shadeSatellites->red;
+    const float* satG = shadeSatellites->green;
+    const float* satB = shadeSatellites->blue;
+
+    const __m512 bhR2 = _mm512_set1_ps(BLACK_HOLE_RADIUS * BLACK_HOLE_RADIUS);
+    const __m512 satR2 = _mm512_set1_ps(SATELLITE_RADIUS * SATELLITE_RADIUS);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 three = _mm512_set1_ps(3.0f);
+    const __m512 scale = _mm512_set1_ps(255.0f);
+    const __m512 laneOffset = _mm512_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f,
+        8.f, 9.f, 10.f, 11.f, 12.f, 13.f, 14.f, 15.f);
+    const __m512i white = _mm512_set1_epi32(0x00FFFFFF);
+    const __m512 mouseX = _mm512_set1_ps((float)tmpMousePosX);
+
+    for (int ty = 0; ty < SCHED_TILE_HEIGHT; ++ty) {
+        const int y = y0 + ty;
+        const float py = (float)y;
+        const float dyBH = py - tmpMousePosY;
+        const __m512 d2BHy = _mm512_set1_ps(dyBH * dyBH);
+        for (int tx = 0; tx < SCHED_TILE_WIDTH; tx += 16) {
+            const int p = ty * SCHED_TILE_WIDTH + tx;
+            __m512 px = _mm512_add_ps(_mm512_set1_ps((float)(x0 + tx)), laneOffset);
+
+            __m512 dxBH = _mm512_sub_ps(px, mouseX);
+            __mmask16 blackHole = _mm512_cmp_ps_mask(_mm512_fmadd_ps(dxBH, dxBH, d2BHy), bhR2, _CMP_LT_OQ);
+            void* out = &shadePixels[y * WINDOW_WIDTH + x0 + tx];
+            if (blackHole == 0xFFFF) {
+                if (last) _mm512_storeu_si512(out, _mm512_setzero_si512());
+                continue;
+            }
+
+            __m512 sumR, sumG, sumB, weights, shortestD2, nearR, nearG, nearB;
+            __mmask16 hits;
+            if (first) {
+                sumR = sumG = sumB = weights = _mm512_setzero_ps();
+                shortestD2 = _mm512_set1_ps(INFINITY);
+                nearR = nearG = nearB = _mm512_setzero_ps();
+                hits = 0;
+            } else {
+                sumR = _mm512_load_ps(&acc->sumR[p]);
+                sumG = _mm512_load_ps(&acc->sumG[p]);
+                sumB = _mm512_load_ps(&acc->sumB[p]);
+                weights = _mm512_load_ps(&acc->weights[p]);
+                shortestD2 = _mm512_load_ps(&acc->shortestD2[p]);
+                nearR = _mm512_load_ps(&acc->nearR[p]);
+                nearG = _mm512_load_ps(&acc->nearG[p]);
+                nearB = _mm512_load_ps(&acc->nearB[p]);
+                hits = acc->hitMasks[p / 16];
+            }
+
+            if (hits != 0xFFFF) {
+                for (int j = j0; j < j1; ++j) {
+                    __m512 dx = _mm512_sub_ps(px, _mm512_set1_ps(satX[j]));
+                    float dy = py - satY[j];
+                    __m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_set1_ps(dy * dy));
+
+                    hits |= _mm512_cmp_ps_mask(d2, satR2, _CMP_LT_OQ);
+                    if (hits == 0xFFFF) break;
+
+                    __m512 w = _mm512_div_ps(one, _mm512_mul_ps(d2, d2));
+                    weights = _mm512_add_ps(weights, w);
+
+                    __m512 r = _mm512_set1_ps(satR[j]);
+                    __m512 g = _mm512_set1_ps(satG[j]);
+                    __m512 b = _mm512_set1_ps(satB[j]);
+                    sumR = _mm512_fmadd_ps(r, w, sumR);
+                    sumG = _mm512_fmadd_ps(g, w, sumG);
+                    sumB = _mm512_fmadd_ps(b, w, sumB);
+
+                    __mmask16 closer = _mm512_cmp_ps_mask(d2, shortestD2, _CMP_LT_OQ);
+                    shortestD2 = _mm512_mask_blend_ps(closer, shortestD2, d2);
+                    nearR = _mm512_mask_blend_ps(closer, nearR, r);
+                    nearG = _mm512_mask_blend_ps(closer, nearG, g);
+                    nearB = _mm512_mask_blend_ps(closer, nearB, b);
+                }
+            }
+
+            if (!last) {
+                _mm512_store_ps(&acc->sumR[p], sumR);
+                _mm512_store_ps(&acc->sumG[p], sumG);
+                _mm512_store_ps(&acc->sumB[p], sumB);
+                _mm512_store_ps(&acc->weights[p], weights);
+                _mm512_store_ps(&acc->shortestD2[p], shortestD2);
+                _mm512_store_ps(&acc->nearR[p], nearR);
+                _mm512_store_ps(&acc->nearG[p], nearG);
+                _mm512_store_ps(&acc->nearB[p], nearB);
+                acc->hitMasks[p / 16] = hits;
+                continue;
+            }
+
+            __m512 invW = _mm512_div_ps(one, weights);
+            __m512 r = _mm512_fmadd_ps(three, _mm512_mul_ps(sumR, invW), nearR);
+            __m512 g = _mm512_fmadd_ps(three, _mm512_mul_ps(sumG, invW), nearG);
+            __m512 b = _mm512_fmadd_ps(three, _mm512_mul_ps(sumB, invW), nearB);
+            __m512i ri = _mm512_cvttps_epi32(_mm512_mul_ps(r, scale));
+            __m512i gi = _mm512_cvttps_epi32(_mm512_mul_ps(g, scale));
+            __m512i bi = _mm512_cvttps_epi32(_mm512_mul_ps(b, scale));
+            __m512i color = _mm512_or_si512(bi, _mm512_or_si512(
+                _mm512_slli_epi32(gi, 8), _mm512_slli_epi32(ri, 16)));
+            color = _mm512_mask_blend_epi32(hits, color, white);
+            color = _mm512_mask_blend_epi32(blackHole, color, _mm512_setzero_si512());
+            _mm512_storeu_si512(out, color);
+        }
+    }
+}
+#endif
+
+// Shades the tile with corner (x0, y0): row by row when all satellites
+// fit one block, else block by block
+static void shadeTile(tileaccumulator* acc, int x0, int y0, int tmpMousePosX, int tmpMousePosY) {
+    const int count = shadeSatellites->count;
+    if (count <= SCHED_SATELLITE_BLOCK) {
+        for (int y = y0; y < y0 + SCHED_TILE_HEIGHT; ++y) {
+            shadeRow(shadeSatellites, y, x0, x0 + SCHED_TILE_WIDTH, tmpMousePosX, tmpMousePosY, NULL);
+        }
+        return;
+    }
+    for (int j0 = 0; j0 < count; j0 += SCHED_SATELLITE_BLOCK) {
+        const int j1 = j0 + SCHED_SATELLITE_BLOCK < count ? j0 + SCHED_SATELLITE_BLOCK : count;
+        const int first = j0 == 0;
+        const int last = j1 == count;
+#ifdef SIMD_X86
+        if (simdLevel == SIMD_AVX512) {
+            shadeTileBlockAVX512(acc, j0, j1, x0, y0, first, last, tmpMousePosX, tmpMousePosY);
+            continue;
+        }
+        if (simdLevel == SIMD_AVX2) {
+            shadeTileBlockAVX2(acc, j0, j1, x0, y0, first, last, tmpMousePosX, tmpMousePosY);
+            continue;
+        }
+#endif
+        shadeTileBlockScalar(acc, j0, j1, x0, y0, first, last, tmpMousePosX, tmpMousePosY);
+    }
+}
+
+// Full render over work-stealing tile deques
+void parallelGraphicsEngineTiles(int tmpMousePosX, int tmpMousePosY) {
+    const int tilesX = WINDOW_WIDTH / SCHED_TILE_WIDTH;
+    const int tiles = tilesX * (WINDOW_HEIGHT / SCHED_TILE_HEIGHT);
+#pragma omp parallel
+    {
+        const int thread = omp_get_thread_num();
+        const int threads = omp_get_num_threads();
+        tiledeque* own = &tileDeques[thread];
+        tileaccumulator* acc = &tileAccumulators[thread];
+        omp_set_lock(&own->lock);
+        own->next = (int)((long long)tiles * thread / threads);
+        own->end = (int)((long long)tiles * (thread + 1) / threads);
+        omp_unset_lock(&own->lock);
+#pragma omp barrier
+        double busy = 0.0;
+        int tile;
+        while ((tile = takeTile(thread, threads)) >= 0) {
+            double start = omp_get_wtime();
+            shadeTile(acc, tile % tilesX * SCHED_TILE_WIDTH, tile / tilesX * SCHED_TILE_HEIGHT,
+                tmpMousePosX, tmpMousePosY);
+            busy += omp_get_wtime() - start;
+        }
+        own->busy = busy;
+    }
+}
+
+// Per-thread shading time of the last frame and the imbalance, the
+// slowest thread over the mean
+static void printBusyReport(void) {
+    const int threads = omp_get_max_threads();
+    double sum = 0.0, slowest = 0.0;
+    printf("Render busy (ms):");
+    for (int t = 0; t < threads; ++t) {
+        printf(" %.1f", tileDeques[t].busy * 1e3);
+        sum += tileDeques[t].busy;
+        if (tileDeques[t].busy > slowest) slowest = tileDeques[t].busy;
+    }
+    printf(" | imbalance %.2f\n", sum > 0.0 ? slowest * threads / sum : 1.0);
+}
+
+// One frame of the graphics engine: shades shadeSatellites into shadePixels
+void graphicsFrame(int tmpMousePosX, int tmpMousePosY) {
+
+    if (renderMode == RENDER_BINNED) {
+        parallelGraphicsEngineBinned(tmpMousePosX, tmpMousePosY);
+        return;
+    }
+    if (renderMode == RENDER_BOUNDS) {
+        parallelGraphicsEngineBounds(tmpMousePosX, tmpMousePosY);
+        return;
+    }
+    if (renderMode == RENDER_JFA) {
+        parallelGraphicsEngineJfa(tmpMousePosX, tmpMousePosY);
+        return;
+    }
+    if (renderMode == RENDER_TREE) {
+        parallelGraphicsEngineTree(tmpMousePosX, tmpMousePosY);
+        return;
+    }
+
+    if (renderSchedule == SCHEDULE_STEAL) {
+        parallelGraphicsEngineTiles(tmpMousePosX, tmpMousePosY);
+    } else {
+#pragma omp parallel
+        {
+            double start = omp_get_wtime();
+            int y;
+#pragma omp for schedule(static) nowait // or: schedule(static, 2)
+            for (y = 0; y < WINDOW_HEIGHT; ++y) {
+                shadeRow(shadeSatellites, y, 0, WINDOW_WIDTH, tmpMousePosX, tmpMousePosY, NULL);
+            }
+            tileDeques[omp_get_thread_num()].busy = omp_get_wtime() - start;
+        }
+    }
+    if (busyReport) {
+        printBusyReport();
+    }
+}
+
+
+pipelinestage pipelinePhysicsStage;
+pipelinestage pipelineGraphicsStage;
+color_u8* pipelineBuffers[PIPELINE_BUFFERS]; // [0] is the buffer of fixedInit()
+int pipelineShown = 0;              // buffer of the last finished frame
+int pipelineShading = 0;            // buffer being shaded
+satellitestore pipelineSnapshot;    // satellites of the frame being shaded
+int pipelinePhysicsMouse[2];        // black hole of the frame being integrated
+int pipelineShadeMouse[2];          // and of the one being shaded
+double pipelinePhysicsStart[PIPELINE_HISTORY];
+double pipelinePresentStart;
+
+static void pipelinePhysicsJob(void) {
+    physicsFrame(pipelinePhysicsMouse[0], pipelinePhysicsMouse[1]);
+}
+
+static void pipelineGraphicsJob(void) {
+    graphicsFrame(pipelineShadeMouse[0], pipelineShadeMouse[1]);
+}
+
+static int pipelineWorker(void* data) {
+    pipelinestage* stage = (pipelinestage*)data;
+    omp_set_num_threads(stage->threads);
+    for (;;) {
+        SDL_SemWait(stage->start);
+        if (stage->quit) break;
+        double start = omp_get_wtime();
+        stage->job();
+        stage->seconds = omp_get_wtime() - start;
+        SDL_SemPost(stage->done);
+    }
+    return 0;
+}
+
+static void pipelineStageStart(pipelinestage* stage, void (*job)(void), int threads, const char* name) {
+    stage->job = job;
+    stage->threads = threads;
+    stage->pending = 0;
+    stage->quit = 0;
+    stage->seconds = 0.0;
+    stage->start = SDL_CreateSemaphore(0);
+    stage->done = SDL_CreateSemaphore(0);
+    stage->thread = SDL_CreateThread(pipelineWorker, name, stage);
+}
+
+static void pipelineStageRun(pipelinestage* stage) {
+    stage->pending = 1;
+    SDL_SemPost(stage->start);
+}
+
+static void pipelineStageWait(pipelinestage* stage) {
+    if (stage->pending) {
+        SDL_SemWait(stage->done);
+        stage->pending = 0;
+    }
+}
+
+static void pipelineStageStop(pipelinestage* stage) {
+    pipelineStageWait(stage);
+    stage->quit = 1;
+    SDL_SemPost(stage->start);
+    SDL_WaitThread(stage->thread, NULL);
+    SDL_DestroySemaphore(stage->start);
+    SDL_DestroySemaphore(stage->done);
+}
+
+void pipelineAlloc(void) {
+    int threads = omp_get_max_threads();
+    int physicsThreads = pipelinePhysicsThreads > 0 ? pipelinePhysicsThreads : (threads + 1) / 2;
+    int graphicsThreads = threads - physicsThreads > 0 ? threads - physicsThreads : 1;
+
+    pipelineBuffers[0] = pixels;
+    for (int b = 1; b < PIPELINE_BUFFERS; ++b) {
+        pipelineBuffers[b] = (color_u8*)malloc(sizeof(color_u8) * SIZE);
+    }
+    satelliteStoreAlloc(&pipelineSnapshot, satellites.count);
+    pipelineStageStart(&pipelinePhysicsStage, pipelinePhysicsJob, physicsThreads, "physics");
+    pipelineStageStart(&pipelineGraphicsStage, pipelineGraphicsJob, graphicsThreads, "graphics");
+    printf("Pipeline: %d physics and %d graphics threads, %d pixel buffers\n",
+        physicsThreads, graphicsThreads, PIPELINE_BUFFERS);
+}
+
+void pipelineFree(void) {
+    pipelineStageStop(&pipelinePhysicsStage);
+    pipelineStageStop(&pipelineGraphicsStage);
+    // fixedDestroy() frees 'pixels'
+    pixels = pipelineBuffers[0];
+    for (int b = 1; b < PIPELINE_BUFFERS; ++b) {
+        free(pipelineBuffers[b]);
+    }
+    satelliteStoreFree(&pipelineSnapshot);
+}
+
+// Pipelined physics engine of frame k: collects frame k from the physics
+// team (integrating it here only in the first pipelined frame) and frame
+// k-1 from the graphics team, snapshots frame k for shading and starts
+// the physics team on frame k+1
+void pipelinePhysics(void) {
+    const int k = pipelineFrame;
+    double now = omp_get_wtime();
+
+    if (pipelinePhysicsStage.pending) {
+        pipelineStageWait(&pipelinePhysicsStage);
+    } else {
+        pipelinePhysicsStart[k % PIPELINE_HISTORY] = now;
+        pipelinePhysicsMouse[0] = mousePosX;
+        pipelinePhysicsMouse[1] = mousePosY;
+        physicsFrame(mousePosX, mousePosY);
+        pipelinePhysicsStage.seconds = omp_get_wtime() - now;
+    }
+    if (pipelineGraphicsStage.pending) {
+        pipelineStageWait(&pipelineGraphicsStage);
+        pipelineShown = pipelineShading;
+    }
+
+    // Frame k-2 was presented by the render() call that just returned
+    if (k >= PIPELINE_FIRST_FRAME + 2) {
+        printf("Pipeline: physics %.1f ms, graphics %.1f ms, present %.1f ms, latency %.1f ms\n",
+            pipelinePhysicsStage.seconds * 1e3, pipelineGraphicsStage.seconds * 1e3,
+            (now - pipelinePresentStart) * 1e3, (now - pipelinePhysicsStart[(k - 2) % PIPELINE_HISTORY]) * 1e3);
+    }
+
+    satelliteStoreCopy(&pipelineSnapshot, &satellites);
+    pipelineShadeMouse[0] = pipelinePhysicsMouse[0];
+    pipelineShadeMouse[1] = pipelinePhysicsMouse[1];
+
+    pipelinePhysicsStart[(k + 1) % PIPELINE_HISTORY] = omp_get_wtime();
+    pipelinePhysicsMouse[0] = mousePosX;
+    pipelinePhysicsMouse[1] = mousePosY;
+    pipelineStageRun(&pipelinePhysicsStage);
+}
+
+// Pipelined graphics engine: starts shading the snapshot into a free buffer
+// and hands the last finished frame to render()
+static void pipelineGraphics(void) {
+    pipelineShading = (pipelineShown + 1) % PIPELINE_BUFFERS;
+    shadeSatellites = &pipelineSnapshot;
+    shadePixels = pipelineBuffers[pipelineShading];
+    pipelineStageRun(&pipelineGraphicsStage);
+
+    pixels = pipelineBuffers[pipelineShown];
+    pipelinePresentStart = omp_get_wtime();
+}
 
+void parallelGraphicsEngine(void) {
+    if (pipelineMode && pipelineFrame >= PIPELINE_FIRST_FRAME) {
+        pipelineGraphics();
+    } else {
+        shadeSatellites = &satellites;
+        shadePixels = pixels;
+        graphicsFrame(mousePosX, mousePosY);
+    }
+    ++pipelineFrame;
+}
+
+
+void destroy(){
+    if (pipelineMode) {
+        pipelineFree();
+    }
+    if (nbodyMode) {
+        nbodyStateFree(&nbody);
+    }
+    if (renderMode == RENDER_BINNED) {
+        renderBinsFree(&renderBins);
+    }
+    if (renderMode == RENDER_BOUNDS) {
+        boundsCandidatesFree();
+    }
+    if (renderMode == RENDER_JFA) {
+        alignedFree(jfaMap[0]);
+        alignedFree(jfaMap[1]);
+        free(jfaNext);
+    }
+    if (renderMode == RENDER_TREE) {
+        renderTreeFree(&renderTree);
+    }
+    if (renderMode == RENDER_FULL) {
+        tileSchedulerFree();
+    }
 
 }
 
@@ -310,9 +4762,9 @@ void sequentialGraphicsEngine(){
       int hitsSatellite = 0;
 
       // First Graphics satellite loop: Find the closest satellite.
-      for(int j = 0; j < SATELLITE_COUNT; ++j){
-         floatvector difference = {.x = pixel.x - satellites[j].position.x,
-                                   .y = pixel.y - satellites[j].position.y};
+      for(int j = 0; j < satelliteCount; ++j){
+         floatvector difference = {.x = pixel.x - satellites.x[j],
+                                   .y = pixel.y - satellites.y[j]};
          float distance = sqrt(difference.x * difference.x +
                                difference.y * difference.y);
 
@@ -327,27 +4779,27 @@ void sequentialGraphicsEngine(){
             weights += weight;
             if(distance < shortestDistance){
                shortestDistance = distance;
-               renderColor = satellites[j].identifier;
+               renderColor = satelliteColor(&satellites, j);
             }
          }
       }
 
       // Second graphics loop: Calculate the color based on distance to every satellite.
       if (!hitsSatellite) {
-         for(int j = 0; j < SATELLITE_COUNT; ++j){
-            floatvector difference = {.x = pixel.x - satellites[j].position.x,
-                                      .y = pixel.y - satellites[j].position.y};
+         for(int j = 0; j < satelliteCount; ++j){
+            floatvector difference = {.x = pixel.x - satellites.x[j],
+                                      .y = pixel.y - satellites.y[j]};
             float dist2 = (difference.x * difference.x +
                            difference.y * difference.y);
             float weight = 1.0f/(dist2* dist2);
 
-            renderColor.red += (satellites[j].identifier.red *
+            renderColor.red += (satellites.red[j] *
                                 weight /weights) * 3.0f;
 
-            renderColor.green += (satellites[j].identifier.green *
+            renderColor.green += (satellites.green[j] *
                                   weight / weights) * 3.0f;
 
-            renderColor.blue += (satellites[j].identifier.blue *
+            renderColor.blue += (satellites.blue[j] *
                                  weight / weights) * 3.0f;
          }
       }
@@ -357,18 +4809,18 @@ void sequentialGraphicsEngine(){
     }
 }
 
-void sequentialPhysicsEngine(satellite *s){
+void sequentialPhysicsEngine(satellitestore *s){
 
    // double precision required for accumulation inside this routine,
    // but float storage is ok outside these loops.
-   doublevector tmpPosition[SATELLITE_COUNT];
-   doublevector tmpVelocity[SATELLITE_COUNT];
-
-   for (int i = 0; i < SATELLITE_COUNT; ++i) {
-       tmpPosition[i].x = s[i].position.x;
-       tmpPosition[i].y = s[i].position.y;
-       tmpVelocity[i].x = s[i].velocity.x;
-       tmpVelocity[i].y = s[i].velocity.y;
+   doublevector* tmpPosition = (doublevector*)alignedMalloc(sizeof(doublevector) * satelliteCount);
+   doublevector* tmpVelocity = (doublevector*)alignedMalloc(sizeof(doublevector) * satelliteCount);
+
+   for (int i = 0; i < satelliteCount; ++i) {
+       tmpPosition[i].x = s->x[i];
+       tmpPosition[i].y = s->y[i];
+       tmpVelocity[i].x = s->vx[i];
+       tmpVelocity[i].y = s->vy[i];
    }
 
    // Physics iteration loop
@@ -377,7 +4829,7 @@ void sequentialPhysicsEngine(satellite *s){
       ++physicsUpdateIndex){
 
        // Physics satellite loop
-      for(int i = 0; i < SATELLITE_COUNT; ++i){
+      for(int i = 0; i < satelliteCount; ++i){
 
          // Distance to the blackhole
          // (bit ugly code because C-struct cannot have member functions)
@@ -412,12 +4864,15 @@ void sequentialPhysicsEngine(satellite *s){
    // double precision required for accumulation inside this routine,
    // but float storage is ok outside these loops.
    // copy back the float storage.
-   for (int i = 0; i < SATELLITE_COUNT; ++i) {
-       s[i].position.x = tmpPosition[i].x;
-       s[i].position.y = tmpPosition[i].y;
-       s[i].velocity.x = tmpVelocity[i].x;
-       s[i].velocity.y = tmpVelocity[i].y;
+   for (int i = 0; i < satelliteCount; ++i) {
+       s->x[i] = tmpPosition[i].x;
+       s->y[i] = tmpPosition[i].y;
+       s->vx[i] = tmpVelocity[i].x;
+       s->vy[i] = tmpVelocity[i].y;
    }
+
+   alignedFree(tmpPosition);
+   alignedFree(tmpVelocity);
 }
 
 // Just some value that barely passes for OpenCL example program
@@ -452,8 +4907,8 @@ void compute(void){
 
    // Error check during first frames
    if (frameNumber < 2) {
-      memcpy(backupSatelites, satellites, sizeof(satellite) * SATELLITE_COUNT);
-      sequentialPhysicsEngine(backupSatelites);
+      satelliteStoreCopy(&backupSatelites, &satellites);
+      sequentialPhysicsEngine(&backupSatelites);
       mousePosX = HORIZONTAL_CENTER;
       mousePosY = VERTICAL_CENTER;
    } else {
@@ -465,8 +4920,8 @@ void compute(void){
    }
    parallelPhysicsEngine();
    if (frameNumber < 2) {
-      for (int i = 0; i < SATELLITE_COUNT; i++) {
-         if (memcmp (&satellites[i], &backupSatelites[i], sizeof(satellite))) {
+      for (int i = 0; i < satelliteCount; i++) {
+         if (!satelliteStoreEqual(&satellites, &backupSatelites, i)) {
             printf("Incorrect satellite data of satellite: %d\n", i);
             getchar();
          }
@@ -527,14 +4982,14 @@ void fixedInit(unsigned int seed){
    // Init pixel buffer which is used for error checking
    correctPixels = (color_u8*)malloc(sizeof(color_u8) * SIZE);
 
-   backupSatelites = (satellite*)malloc(sizeof(satellite) * SATELLITE_COUNT);
+   satelliteStoreAlloc(&backupSatelites, satelliteCount);
 
 
    // Init satellites buffer which are moving in the space
-   satellites = (satellite*)malloc(sizeof(satellite) * SATELLITE_COUNT);
+   satelliteStoreAlloc(&satellites, satelliteCount);
 
    // Create random satellites
-   for(int i = 0; i < SATELLITE_COUNT; ++i){
+   for(int i = 0; i < satelliteCount; ++i){
 
       // Random reddish color
       color_f32 id = {.red = randomNumber(0.f, 0.15f) + 0.1f,
@@ -546,7 +5001,7 @@ void fixedInit(unsigned int seed){
                               .y = VERTICAL_CENTER - randomNumber(50, 320) };
       initialPosition.x = (i / 2 % 2 == 0) ?
          initialPosition.x : WINDOW_WIDTH - initialPosition.x;
-      initialPosition.y = (i < SATELLITE_COUNT / 2) ?
+      initialPosition.y = (i < satelliteCount / 2) ?
          initialPosition.y : WINDOW_HEIGHT - initialPosition.y;
 
       // Randomize velocity tangential to the balck hole
@@ -564,9 +5019,13 @@ void fixedInit(unsigned int seed){
          initialVelocity.y = -initialVelocity.y;
       }
 
-      satellite tmpSatelite = {.identifier = id, .position = initialPosition,
-                              .velocity = initialVelocity};
-      satellites[i] = tmpSatelite;
+      satellites.red[i] = id.red;
+      satellites.green[i] = id.green;
+      satellites.blue[i] = id.blue;
+      satellites.x[i] = initialPosition.x;
+      satellites.y[i] = initialPosition.y;
+      satellites.vx[i] = initialVelocity.x;
+      satellites.vy[i] = initialVelocity.y;
    }
 }
 
@@ -576,7 +5035,8 @@ void fixedDestroy(void){
 
    free(pixels);
    free(correctPixels);
-   free(satellites);
+   satelliteStoreFree(&satellites);
+   satelliteStoreFree(&backupSatelites);
 
    if(seed != 0){
      printf("Used seed: %i\n", seed);
@@ -598,10 +5058,19 @@ void render(void){
 // Inits render window and starts mainloop
 int main(int argc, char** argv){
 
-   if(argc > 1){
-     seed = atoi(argv[1]);
-     printf("Using seed: %i\n", seed);
+   // Usage: parallel [seed] [--option=value ...]
+   for(int a = 1; a < argc; ++a){
+     if(strncmp(argv[a], "--", 2) == 0){
+       if(!parseOption(argv[a])){
+         fprintf(stderr, "Unknown or invalid option: %s\n", argv[a]);
+         return 1;
+       }
+     } else {
+       seed = atoi(argv[a]);
+       printf("Using seed: %i\n", seed);
+     }
    }
+   printf("Satellite count: %d\n", satelliteCount);
 
    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_TIMER);
    win = SDL_CreateWindow(